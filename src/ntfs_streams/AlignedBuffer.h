@@ -0,0 +1,114 @@
+/***********************************************************************
+
+  Copyright (c) 2019 Vsevolod Lukyanin
+  All rights reserved.
+
+  This file is a part of project ntfs_file_streams:
+  https://github.com/shtirlitz-dev/ntfs_file_streams
+
+  The tool that enables to list, create, copy, delete, show, write and
+  archive NTFS files streams.
+  About file streams:
+  https://docs.microsoft.com/en-us/windows/win32/fileio/file-streams
+
+***********************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <mutex>
+#include <new>
+#include <utility>
+
+// Memory for unbuffered I/O (FILE_FLAG_NO_BUFFERING): address, size and file offset
+// must be multiple of the sector size. VirtualAlloc gives page-aligned memory,
+// page size (4K) is multiple of usual sector sizes (512, 4K)
+class AlignedBuffer
+{
+public:
+	static const DWORD Alignment = 4096;
+
+	static ULONGLONG AlignUp(ULONGLONG size) { return (size + Alignment - 1) & ~(ULONGLONG)(Alignment - 1); }
+	static ULONGLONG AlignDown(ULONGLONG size) { return size & ~(ULONGLONG)(Alignment - 1); }
+	static bool IsAligned(const void* ptr) { return ((ULONG_PTR)ptr & (Alignment - 1)) == 0; }
+
+	AlignedBuffer() {}
+	explicit AlignedBuffer(DWORD size)
+		: m_pData((uint8_t*)VirtualAlloc(nullptr, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE)),
+		m_dwSize(m_pData ? size : 0)
+	{
+		if (!m_pData)
+			throw std::bad_alloc();
+	}
+	AlignedBuffer(AlignedBuffer&& other) noexcept
+		: m_pData(std::exchange(other.m_pData, nullptr)), m_dwSize(std::exchange(other.m_dwSize, 0))
+	{
+	}
+	AlignedBuffer& operator=(AlignedBuffer&& other) noexcept
+	{
+		std::swap(m_pData, other.m_pData);
+		std::swap(m_dwSize, other.m_dwSize);
+		return *this;
+	}
+	AlignedBuffer(const AlignedBuffer&) = delete;
+	AlignedBuffer& operator=(const AlignedBuffer&) = delete;
+	~AlignedBuffer()
+	{
+		if (m_pData)
+			VirtualFree(m_pData, 0, MEM_RELEASE);
+	}
+	uint8_t* data() const { return m_pData; }
+	DWORD size() const { return m_dwSize; }
+protected:
+	uint8_t* m_pData = nullptr;
+	DWORD m_dwSize = 0;
+};
+
+// Keeps released buffers of the same size to give them again without new allocation
+class AlignedBufferPool
+{
+public:
+	explicit AlignedBufferPool(DWORD block_size) : m_dwBlockSize((DWORD)AlignedBuffer::AlignUp(block_size)) {}
+	DWORD BlockSize() const { return m_dwBlockSize; }
+	AlignedBuffer Get()
+	{
+		std::lock_guard<std::mutex> lock(m_mtx);
+		if (m_free.empty())
+			return AlignedBuffer(m_dwBlockSize);
+		AlignedBuffer buf = std::move(m_free.back());
+		m_free.pop_back();
+		return buf;
+	}
+	void Release(AlignedBuffer&& buf)
+	{
+		if (buf.size() != m_dwBlockSize)
+			return; // not ours, will be freed by destructor
+		std::lock_guard<std::mutex> lock(m_mtx);
+		m_free.push_back(std::move(buf));
+	}
+	static AlignedBufferPool& Default() // 1 MB blocks
+	{
+		static AlignedBufferPool pool(1024 * 1024);
+		return pool;
+	}
+protected:
+	DWORD m_dwBlockSize;
+	std::vector<AlignedBuffer> m_free;
+	std::mutex m_mtx;
+};
+
+// Takes buffer from pool and returns it back when goes out of scope
+class PooledBuffer
+{
+public:
+	explicit PooledBuffer(AlignedBufferPool& pool = AlignedBufferPool::Default()) : m_pool(pool), m_buf(pool.Get()) {}
+	~PooledBuffer() { m_pool.Release(std::move(m_buf)); }
+	PooledBuffer(const PooledBuffer&) = delete;
+	PooledBuffer& operator=(const PooledBuffer&) = delete;
+	uint8_t* data() const { return m_buf.data(); }
+	DWORD size() const { return m_buf.size(); }
+protected:
+	AlignedBufferPool& m_pool;
+	AlignedBuffer m_buf;
+};
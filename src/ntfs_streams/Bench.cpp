@@ -0,0 +1,682 @@
+/***********************************************************************
+
+  Copyright (c) 2019 Vsevolod Lukyanin
+  All rights reserved.
+
+  This file is a part of project ntfs_file_streams:
+  https://github.com/shtirlitz-dev/ntfs_file_streams
+
+  The tool that enables to list, create, copy, delete, show, write and
+  archive NTFS files streams.
+  About file streams:
+  https://docs.microsoft.com/en-us/windows/win32/fileio/file-streams
+
+***********************************************************************/
+
+#include "pch.h"
+
+#include "Bench.h"
+#include "Tar.h"
+#include "TreeGen.h"
+#include "ntfs_streams.h"
+#include "CommonFunc.h"
+#include "FsBackend.h"
+#include "NtfsImage.h"
+#include "UnicodeFuncts.h"
+#include "UnicodeStream.h"
+#include "MaskSet.h"
+#include "aes.h"
+#include "shaker.h"
+#include "sha1.h"
+#include <tchar.h>
+#include <psapi.h>
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <chrono>
+
+using namespace std;
+using namespace std::chrono;
+
+// Micro-benchmarks of the kernels used by tar/untar and type.
+// Every kernel is first checked against reference results (FIPS-197 for AES,
+// RFC 3174 for SHA-1, round trips for the others), so an optimized version
+// can be compared with the previous one by the same command.
+// With /tar:dir tar and untar of the tree (see gentree) are measured end-to-end,
+// every run in a child process to know its peak memory.
+// With /mem the tree, the tar-file and the extracted files are in memory (MemoryFs):
+// this is the speed of the pipeline itself (serialization and encryption) without disk.
+
+namespace
+{
+	int ShowHelpBench(filesystem::path filename)
+	{
+		ShowCopyright();
+		wcout << L"\ncommand line arguments for '" << filename.c_str() << L" bench':\n\n";
+		wcout << L"bench [options] [mask1;mask2]\n";
+		wcout << L"where <maskN> select benchmarks by name, e.g. aes*;sha1*\n";
+		wcout << L"options:\n";
+		wcout << L"  /c             - only check results of kernels, no timing\n";
+		wcout << L"  /t:ms          - minimal time of each benchmark, default 200\n";
+		wcout << L"  /tar:dir       - measure tar and untar of dir (without and with password) instead\n";
+		wcout << L"  /p:password    - password for /tar, default 'bench'\n";
+		wcout << L"  /w:dir         - work directory for /tar, default <dir>.bench, it is deleted at the end\n";
+		wcout << L"  /mem:shape,N   - measure tar and untar in memory of tree generated by gentree /shape:shape /n:N\n";
+		wcout << L"  /ntfs:image    - also check reading of testdata\\ntfs4k.img of the sources, made by make_ntfs4k.py\n";
+		return 0;
+	}
+
+	volatile uint8_t sink; // results go here, so the compiler does not remove the work
+
+	vector<uint8_t> FromHex(const char* hex)
+	{
+		vector<uint8_t> res;
+		for (; hex[0] && hex[1]; hex += 2)
+			res.push_back((uint8_t)stoi(string(hex, 2), nullptr, 16));
+		return res;
+	}
+
+	vector<uint8_t> RandomBytes(size_t size)
+	{
+		default_random_engine generator(size);
+		uniform_int_distribution<int> distribution(0, 255);
+		vector<uint8_t> res(size);
+		for (auto& el : res)
+			el = (uint8_t)distribution(generator);
+		return res;
+	}
+
+	// text of the given size in UTF-8: mostly ASCII with some Cyrillic and CJK, lines of ~60 chars
+	string RandomText(size_t size)
+	{
+		static const char* words[] = { "stream", "file", "data", "\xD0\xBF\xD0\xBE\xD1\x82\xD0\xBE\xD0\xBA",
+			"archive", "\xE6\x96\x87\xE4\xBB\xB6", "directory", "name", "size" };
+		default_random_engine generator(size);
+		uniform_int_distribution<size_t> distribution(0, std::size(words) - 1);
+		string res;
+		size_t line = 0;
+		while (res.size() < size) {
+			const char* word = words[distribution(generator)];
+			res += word;
+			line += strlen(word);
+			if (line > 60) {
+				res += "\r\n";
+				line = 0;
+			}
+			else
+				res += ' ';
+		}
+		// do not cut a multibyte char
+		res.resize(size);
+		while (!res.empty() && ((uint8_t)res.back() & 0x80))
+			res.back() = ' ';
+		return res;
+	}
+
+	class MemoryStream : public CharStream
+	{
+	public:
+		MemoryStream(const string& data) : data(data) {}
+		virtual int Read(char* buf, int count) override
+		{
+			int part = (int)min<size_t>(count, data.size() - pos);
+			memcpy(buf, data.data() + pos, part);
+			pos += part;
+			return part;
+		}
+	protected:
+		const string& data;
+		size_t pos = 0;
+	};
+
+	//////////////////////////////////////////////////////////////////////////
+	// checks
+
+	int failed = 0;
+
+	void Check(const wchar_t* name, bool ok)
+	{
+		wcout << (ok ? L"  ok      " : L"  FAILED  ") << name << endl;
+		if (!ok)
+			++failed;
+	}
+
+	void CheckAes()
+	{
+		// FIPS-197, appendix C.1; with zero IV the first block of CBC is the same as ECB
+		vector<uint8_t> key = FromHex("000102030405060708090a0b0c0d0e0f");
+		vector<uint8_t> plain = FromHex("00112233445566778899aabbccddeeff");
+		vector<uint8_t> cipher = FromHex("69c4e0d86a7b0430d8cdb78070b4c55a");
+		uint8_t out[16];
+		Aes128 aes(key.data());
+		aes.encrypt(plain.data(), out);
+		Check(L"aes encrypt, FIPS-197 C.1", memcmp(out, cipher.data(), 16) == 0);
+		aes.reset_iv();
+		aes.decrypt(cipher.data(), out);
+		Check(L"aes decrypt, FIPS-197 C.1", memcmp(out, plain.data(), 16) == 0);
+
+		// CBC chain: decryption of encrypted data gives the original data
+		vector<uint8_t> data = RandomBytes(4096), work = data;
+		uint8_t iv[16] = { 1, 2, 3 };
+		Aes128 enc(key.data(), iv), dec(key.data(), iv);
+		for (size_t i = 0; i < work.size(); i += 16)
+			enc.encrypt(&work[i], &work[i]);
+		bool changed = work != data;
+		for (size_t i = 0; i < work.size(); i += 16)
+			dec.decrypt(&work[i], &work[i]);
+		Check(L"aes cbc round trip", changed && work == data);
+	}
+
+	void CheckShaker()
+	{
+		array<uint8_t, 20> key = sha1_digest("password", 8);
+		vector<uint8_t> data = RandomBytes(4096), work = data;
+		Shaker shaker(key.data());
+		for (size_t i = 0; i < work.size(); i += 32)
+			shaker.encrypt(&work[i], &work[i]);
+		bool changed = work != data;
+		for (size_t i = 0; i < work.size(); i += 32)
+			shaker.decrypt(&work[i], &work[i]);
+		Check(L"shaker round trip", changed && work == data);
+	}
+
+	void CheckSha1()
+	{
+		// RFC 3174, section 7.3
+		auto test = [](const wchar_t* name, const string& msg, const char* hex) {
+			array<uint8_t, 20> digest = sha1_digest(msg.data(), (unsigned int)msg.size());
+			Check(name, memcmp(digest.data(), FromHex(hex).data(), 20) == 0);
+		};
+		test(L"sha1 \"abc\", RFC 3174", "abc", "a9993e364706816aba3e25717850c26c9cd0d89d");
+		test(L"sha1 448 bits, RFC 3174", "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+			"84983e441c3bd26ebaae4aa1f95129e5e54670f1");
+		test(L"sha1 million of 'a', RFC 3174", string(1000000, 'a'), "34aa973cd4c4daa4f61eeb2bdbad27316534016f");
+	}
+
+	void CheckUnicode()
+	{
+		string text = RandomText(10000);
+		Check(L"IsUtf8 valid text", IsUtf8(text.data(), (int)text.size(), true));
+		string bad = text;
+		bad[100] = (char)0xFF; // never valid in UTF-8
+		Check(L"IsUtf8 invalid text", !IsUtf8(bad.data(), (int)bad.size(), true));
+
+		wstring wide = ToWideChar(text, CP_UTF8);
+		Check(L"ToWideChar/ToChar round trip", ToChar(wide, CP_UTF8) == text);
+		Check(L"ToWideChar cyrillic", ToWideChar("\xD0\xBF\xD0\xBE\xD1\x82\xD0\xBE\xD0\xBA", CP_UTF8) == L"\x43F\x43E\x442\x43E\x43A");
+
+		MemoryStream ms(text);
+		wstring joined, expected = wide;
+		for (auto& str : GetStrings(&ms))
+			joined += str;
+		for (size_t pos; (pos = expected.find(L"\r\n")) != wstring::npos; ) // lines end with '\n'
+			expected.erase(pos, 1);
+		Check(L"GetStrings utf-8", joined == expected);
+
+		string ends = "a\r\nb\n\rc\r\rd\xE2\x80\xA8" "e";
+		MemoryStream ms_ends(ends);
+		vector<wstring> lines;
+		for (auto str : GetStrings(&ms_ends))
+			lines.emplace_back(str);
+		Check(L"GetStrings line ends", lines == vector<wstring>{ L"a\n", L"b\n", L"c\n", L"\n", L"d\n", L"e" });
+	}
+
+	void CheckMasks()
+	{
+		Check(L"mask_match", mask_match(L"file.txt", L"*.txt") && mask_match(L"FILE.TXT", L"f*.t?t") &&
+			!mask_match(L"file.txt", L"*.doc") && mask_match(L"a", L"*") && !mask_match(L"ab", L"?"));
+		MaskSet set({ L"*.obj", L"thumbs.db", L"f*.t?t", L"**/debug", L"src/*.o" });
+		Check(L"MaskSet", set.Match(L"a\\X.OBJ") && set.Match(L"Thumbs.db") && set.Match(L"FILE.TXT") && !set.Match(L"file.txt.bak") &&
+			set.Match(L"debug") && set.Match(L"p\\x\\Debug") && set.Match(L"src\\a.o") && !set.Match(L"src\\x\\a.o"));
+		Check(L"FileSizeStr", FileSizeStr(0) == L"0" && FileSizeStr(1234567) == L"1 234 567");
+	}
+
+	// testdata\ntfs4k.img: 4096-byte sectors, resident and non-resident streams, a sparse
+	// file, a DOS name, an orphan and a deleted record (see make_ntfs4k.py)
+	void CheckImage(const filesystem::path& image)
+	{
+		NtfsImage img(image.c_str(), Fs());
+		wstring listed;
+		vector<filesystem::path> dirs = { img.CurrentDir() };
+		while (!dirs.empty())
+		{
+			filesystem::path dir = move(dirs.back());
+			dirs.pop_back();
+			for (auto& it : img.ListDir(dir))
+			{
+				listed += it.name.native() + L' ' + to_wstring(it.size) + L'\n';
+				if (it.type == DirItem::Dir)
+					dirs.push_back(it.name);
+				else if (it.type == DirItem::File)
+					for (auto& st : img.ListStreams(it.name, L""))
+						listed += st.name.native() + L' ' + to_wstring(st.size) + L'\n';
+			}
+		}
+		Check(L"ntfs image: files and streams", listed ==
+			L"\\:rs 10\nbig.bin 24476\nbig.bin:s 50\nDocs 0\nDocs\\a.txt 5\nDocs\\a.txt:Zone.Identifier 14\n");
+
+		vector<uint8_t> data(32768);
+		auto file = img.Open(L"BIG.BIN", IFsBackend::Read);
+		DWORD size = file ? file->Read(data.data(), (DWORD)data.size()) : 0;
+		bool ok = size == 24476;
+		for (DWORD i = 0; i < size && ok; ++i) // clusters 3 and 4 are sparse
+			ok = data[i] == (i >= 3 * 4096 && i < 5 * 4096 ? 0 : i * 7 % 251);
+		Check(L"ntfs image: sparse data", ok);
+
+		char text[32] = {};
+		auto stream = img.Open(L"docs\\A.TXT:zone.identifier:$DATA", IFsBackend::Read);
+		Check(L"ntfs image: stream data", stream && stream->Read(text, sizeof(text)) == 14 && strcmp(text, "[ZoneTransfer]") == 0);
+	}
+
+	//////////////////////////////////////////////////////////////////////////
+	// timing
+
+	milliseconds min_time(200);
+	vector<wstring> masks;
+
+	// runs f(iterations) until it takes min_time, reports time of one call and throughput
+	template<class F>
+	void Run(const wstring& name, size_t bytes, F&& f)
+	{
+		if (!masks.empty() && !mask_match(name.c_str(), masks))
+			return;
+		f(1); // warm up
+		ULONGLONG iterations = 1;
+		duration<double> elapsed;
+		while (true) {
+			auto begin = high_resolution_clock::now();
+			f(iterations);
+			elapsed = high_resolution_clock::now() - begin;
+			if (elapsed >= min_time || iterations >= (1ULL << 40))
+				break;
+			// next try is a bit longer than min_time
+			double factor = elapsed.count() > 0 ? min_time.count() / 1000.0 / elapsed.count() * 1.2 : 10;
+			iterations = (ULONGLONG)(iterations * min(max(factor, 1.5), 100.0));
+		}
+		double ns = elapsed.count() * 1e9 / iterations;
+		wcout << left << setw(28) << name << right << setw(12) << iterations << setw(14) << fixed << setprecision(1) << ns;
+		if (bytes)
+			wcout << setw(12) << bytes / ns * 1e9 / 1048576.0;
+		wcout << endl;
+	}
+
+	wstring Name(const wchar_t* kernel, size_t size)
+	{
+		return wstring(kernel) + L"/" + to_wstring(size);
+	}
+
+	void RunAll()
+	{
+		wcout << left << setw(28) << L"benchmark" << right << setw(12) << L"iterations" << setw(14) << L"ns/op" << setw(12) << L"MB/s" << endl;
+		const size_t sizes[] = { 64, 4096, 64 * 1024, 1024 * 1024 };
+		vector<uint8_t> key = FromHex("000102030405060708090a0b0c0d0e0f");
+		array<uint8_t, 20> key20 = sha1_digest("password", 8);
+
+		for (size_t size : sizes) {
+			vector<uint8_t> data = RandomBytes(size);
+			Aes128 aes(key.data());
+			Run(Name(L"aes_encrypt", size), size, [&](ULONGLONG n) {
+				while (n--)
+					for (size_t i = 0; i < size; i += 16)
+						aes.encrypt(&data[i], &data[i]);
+				sink = data[0];
+			});
+			Run(Name(L"aes_decrypt", size), size, [&](ULONGLONG n) {
+				while (n--)
+					for (size_t i = 0; i < size; i += 16)
+						aes.decrypt(&data[i], &data[i]);
+				sink = data[0];
+			});
+			Shaker shaker(key20.data());
+			Run(Name(L"shaker_encrypt", size), size, [&](ULONGLONG n) {
+				while (n--)
+					for (size_t i = 0; i < size; i += 32)
+						shaker.encrypt(&data[i], &data[i]);
+				sink = data[0];
+			});
+			Run(Name(L"shaker_decrypt", size), size, [&](ULONGLONG n) {
+				while (n--)
+					for (size_t i = 0; i < size; i += 32)
+						shaker.decrypt(&data[i], &data[i]);
+				sink = data[0];
+			});
+			Run(Name(L"sha1", size), size, [&](ULONGLONG n) {
+				while (n--)
+					sink = sha1_digest(data.data(), (unsigned int)size)[0];
+			});
+		}
+
+		for (size_t size : sizes) {
+			string text = RandomText(size);
+			wstring wide = ToWideChar(text, CP_UTF8);
+			Run(Name(L"IsUtf8", size), size, [&](ULONGLONG n) {
+				while (n--)
+					sink = IsUtf8(text.data(), (int)size, true);
+			});
+			wstring wout;
+			Run(Name(L"ToWideChar", size), size, [&](ULONGLONG n) {
+				while (n--)
+					ToWideChar(text, CP_UTF8, wout);
+				sink = (uint8_t)wout.size();
+			});
+			string out;
+			Run(Name(L"ToChar", size), size, [&](ULONGLONG n) {
+				while (n--)
+					ToChar(wide, CP_UTF8, out);
+				sink = (uint8_t)out.size();
+			});
+			Run(Name(L"GetStrings", size), size, [&](ULONGLONG n) {
+				while (n--) {
+					MemoryStream ms(text);
+					for (auto& str : GetStrings(&ms))
+						sink = (uint8_t)str.size();
+				}
+			});
+		}
+
+		// names of a typical tree against typical exclude masks
+		vector<wstring> names;
+		for (int i = 0; i < 1000; ++i)
+			names.push_back(L"Some File Name " + to_wstring(i) + (i % 3 ? L".txt" : i % 2 ? L".obj" : L".tmp"));
+		vector<wstring> exclude = { L"*.obj", L"*.tmp", L"~*", L"thumbs.db", L"*.b?k" };
+		for (size_t count : { (size_t)1, exclude.size() }) {
+			vector<wstring> ex(exclude.begin(), exclude.begin() + count);
+			Run(Name(L"mask_match", count), 0, [&](ULONGLONG n) {
+				int matched = 0;
+				while (n--)
+					for (auto& name : names)
+						matched += mask_match(name.c_str(), ex);
+				sink = (uint8_t)matched;
+			});
+			MaskSet set(ex);
+			Run(Name(L"MaskSet", count), 0, [&](ULONGLONG n) {
+				int matched = 0;
+				while (n--)
+					for (auto& name : names)
+						matched += set.Match(name);
+				sink = (uint8_t)matched;
+			});
+		}
+		Run(L"FileSizeStr", 0, [&](ULONGLONG n) {
+			ULONGLONG size = 1;
+			while (n--)
+				sink = (uint8_t)FileSizeStr(size = size * 7 + 1).size();
+		});
+		wcout << L"(mask_match, MaskSet: ns per 1000 names)" << endl;
+	}
+
+	//////////////////////////////////////////////////////////////////////////
+	// end-to-end
+
+	struct TreeSize
+	{
+		ULONGLONG entries = 0; // directories, files and streams
+		ULONGLONG bytes = 0;
+	};
+
+	TreeSize MeasureTree(const filesystem::path& root)
+	{
+		TreeSize res;
+		vector<filesystem::path> dirs = { root };
+		while (!dirs.empty())
+		{
+			filesystem::path dir = move(dirs.back());
+			dirs.pop_back();
+			for (auto& it : Fs().ListDir(dir))
+			{
+				++res.entries;
+				if (it.type == DirItem::Dir)
+					dirs.push_back(it.name);
+				else if (it.type == DirItem::File) {
+					res.bytes += it.size;
+					for (auto& st : Fs().ListStreams(it.name, L"")) {
+						++res.entries;
+						res.bytes += st.size;
+					}
+				}
+			}
+		}
+		return res;
+	}
+
+	struct RunResult
+	{
+		double sec;
+		ULONGLONG peak_rss;
+	};
+
+	// runs command line with stdout to NUL, errors are shown
+	RunResult RunChild(wstring cmdline)
+	{
+		SECURITY_ATTRIBUTES sa = { sizeof(sa), nullptr, TRUE };
+		HANDLE hNul = CreateFile(L"NUL", GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, &sa, OPEN_EXISTING, 0, 0);
+		STARTUPINFOW si = { sizeof(si) };
+		si.dwFlags = STARTF_USESTDHANDLES;
+		si.hStdInput = GetStdHandle(STD_INPUT_HANDLE);
+		si.hStdOutput = hNul;
+		si.hStdError = GetStdHandle(STD_ERROR_HANDLE);
+		PROCESS_INFORMATION pi;
+		auto begin = high_resolution_clock::now();
+		BOOL ok = CreateProcessW(nullptr, cmdline.data(), nullptr, nullptr, TRUE, 0, nullptr, nullptr, &si, &pi);
+		DWORD error = GetLastError();
+		CloseHandle(hNul);
+		if (!ok)
+			throw MyException{ L"Failed to run '<path>': <err>", cmdline, error };
+		WaitForSingleObject(pi.hProcess, INFINITE);
+		duration<double> elapsed = high_resolution_clock::now() - begin;
+		PROCESS_MEMORY_COUNTERS pmc = { sizeof(pmc) };
+		GetProcessMemoryInfo(pi.hProcess, &pmc, sizeof(pmc));
+		DWORD code = 1;
+		GetExitCodeProcess(pi.hProcess, &code);
+		CloseHandle(pi.hProcess);
+		CloseHandle(pi.hThread);
+		if (code)
+			throw MyException{ L"Failed: <path>", cmdline, 0 };
+		return { elapsed.count(), pmc.PeakWorkingSetSize };
+	}
+
+	wstring Quoted(const filesystem::path& path)
+	{
+		return L"\"" + path.native() + L"\"";
+	}
+
+	// one JSON line per run, the same fields for all builds
+	void Report(const wchar_t* op, bool password, const TreeSize& ts, const RunResult& rr)
+	{
+		wchar_t buf[400];
+		swprintf_s(buf, L"{\"op\":\"%s\",\"password\":%s,\"entries\":%llu,\"bytes\":%llu,\"sec\":%.3f,"
+			L"\"entries_per_sec\":%.0f,\"mb_per_sec\":%.1f,\"peak_rss_mb\":%.1f}",
+			op, password ? L"true" : L"false", ts.entries, ts.bytes, rr.sec,
+			ts.entries / rr.sec, ts.bytes / 1048576.0 / rr.sec, rr.peak_rss / 1048576.0);
+		wcout << buf << endl;
+	}
+
+	void RunTree(const filesystem::path& tree, const wstring& pass, filesystem::path work)
+	{
+		if (!filesystem::is_directory(tree))
+			throw MyException{ L"Path is not a directory: '<path>'", tree.native(), 0 };
+		wchar_t self[MAX_PATH];
+		GetModuleFileNameW(nullptr, self, MAX_PATH);
+		if (work.empty())
+			work = tree.native() + L".bench";
+		filesystem::create_directories(work);
+		filesystem::path star = work / L"bench.star";
+		filesystem::path out = work / L"out";
+
+		TreeSize ts = MeasureTree(tree);
+		wcout << L"Tree " << tree.c_str() << L": " << ts.entries << L" entries, " << FileSizeStr(ts.bytes) << L" bytes" << endl;
+		for (bool password : { false, true })
+		{
+			wstring opt = password ? L" \"/p:" + pass + L"\"" : L"";
+			filesystem::remove_all(out);
+			Report(L"tar", password, ts, RunChild(Quoted(self) + L" tar /q" + opt + L" " + Quoted(star) + L" " + Quoted(tree)));
+			Report(L"untar", password, ts, RunChild(Quoted(self) + L" untar /q" + opt + L" " + Quoted(star) + L" " + Quoted(out)));
+		}
+		filesystem::remove_all(work);
+	}
+
+	// calls command of this program with arguments
+	int Call(int (*command)(int argc, TCHAR **argv), vector<wstring> args)
+	{
+		wchar_t self[MAX_PATH];
+		GetModuleFileNameW(nullptr, self, MAX_PATH);
+		args.insert(args.begin(), self);
+		vector<TCHAR*> argv;
+		for (auto& arg : args)
+			argv.push_back(arg.data());
+		argv.push_back(nullptr);
+		return command((int)args.size(), argv.data());
+	}
+
+	RunResult CallTimed(int (*command)(int argc, TCHAR **argv), vector<wstring> args)
+	{
+		wstring name = args[0];
+		auto begin = high_resolution_clock::now();
+		if (Call(command, move(args)))
+			throw MyException{ L"Failed: <path>", name, 0 };
+		duration<double> elapsed = high_resolution_clock::now() - begin;
+		PROCESS_MEMORY_COUNTERS pmc = { sizeof(pmc) };
+		GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc));
+		return { elapsed.count(), pmc.PeakWorkingSetSize }; // of this process, including the tree in memory
+	}
+
+	void RunMemory(wstring_view param, const wstring& pass)
+	{
+		vector<wstring> shape = split(param, L',');
+		MemoryFs mem;
+		SetFs(&mem);
+		struct Restore { ~Restore() { SetFs(nullptr); } } restore;
+
+		vector<wstring> gen = { L"gentree", L"/shape:" + shape[0], L"tree" };
+		if (shape.size() > 1)
+			gen.insert(gen.begin() + 1, L"/n:" + shape[1]);
+		Call(GenTree, gen);
+		TreeSize ts = MeasureTree(L"tree");
+		wcout << L"Tree in memory: " << ts.entries << L" entries, " << FileSizeStr(ts.bytes) << L" bytes" << endl;
+		for (bool password : { false, true })
+		{
+			vector<wstring> opt = { L"/q" };
+			if (password)
+				opt.push_back(L"/p:" + pass);
+			vector<wstring> tar = { L"tar" }, untar = { L"untar", L"/o" };
+			tar.insert(tar.end(), opt.begin(), opt.end());
+			untar.insert(untar.end(), opt.begin(), opt.end());
+			tar.insert(tar.end(), { L"bench.star", L"tree" });
+			untar.insert(untar.end(), { L"bench.star", L"out" });
+			Report(L"tar", password, ts, CallTimed(Tar, tar));
+			Report(L"untar", password, ts, CallTimed(Untar, untar));
+		}
+	}
+
+	// tar and untar in memory of a file and a stream with holes ('P' and 'Q' records):
+	// holes stay holes, with /z blocks of zeros become holes too
+	void CheckSparseTar()
+	{
+		MemoryFs mem;
+		SetFs(&mem);
+		struct Restore { ~Restore() { SetFs(nullptr); } } restore;
+
+		const DWORD K = 1024;
+		vector<uint8_t> data = RandomBytes(128 * K), zeros(256 * K);
+		Fs().CreateDir(L"sparse");
+		auto file = Fs().Open(L"sparse\\holes.bin", IFsBackend::Create);
+		file->Write(data.data(), 128 * K); // data 128K, hole 384K, data 128K, zeros 256K, data 128K
+		file->WriteHole(384 * K);
+		file->Write(data.data(), 128 * K);
+		file->Write(zeros.data(), 256 * K);
+		file->Write(data.data(), 128 * K);
+		auto stream = Fs().Open(L"sparse\\holes.bin:s", IFsBackend::Create);
+		stream->WriteHole(256 * K); // hole 256K, data 4K, hole 64K at the end
+		stream->Write(data.data(), 4 * K);
+		stream->WriteHole(64 * K);
+		file.reset();
+		stream.reset();
+
+		// data, and allocated ranges as "offset+length;" in K
+		auto read = [K](const wchar_t* name, wstring& ranges) {
+			vector<uint8_t> res;
+			auto fs = Fs().Open(name, IFsBackend::Read);
+			if (!fs)
+				return res;
+			res.resize((size_t)fs->GetLength());
+			res.resize(fs->ReadAt(0, res.data(), (DWORD)res.size()));
+			for (auto& range : fs->AllocatedRanges(res.size()))
+				ranges += to_wstring(range.offset / K) + L'+' + to_wstring(range.length / K) + L';';
+			return res;
+		};
+		wstring file_ranges, stream_ranges;
+		vector<uint8_t> file_data = read(L"sparse\\holes.bin", file_ranges);
+		vector<uint8_t> stream_data = read(L"sparse\\holes.bin:s", stream_ranges);
+		Check(L"MemoryFs holes", file_ranges == L"0+128;512+512;" && stream_ranges == L"256+4;");
+		for (bool zero_blocks : { false, true })
+		{
+			vector<wstring> tar = { L"tar", L"/q", L"sparse.star", L"sparse" };
+			if (zero_blocks)
+				tar.insert(tar.begin() + 1, L"/z");
+			bool ok = Call(Tar, tar) == 0 && Call(Untar, { L"untar", L"/q", L"/o", L"sparse.star", L"out" }) == 0;
+			wstring out_file, out_stream;
+			ok = ok && read(L"out\\sparse\\holes.bin", out_file) == file_data && read(L"out\\sparse\\holes.bin:s", out_stream) == stream_data;
+			ok = ok && out_file == (zero_blocks ? L"0+128;512+128;896+128;" : file_ranges) && out_stream == stream_ranges;
+			Check(zero_blocks ? L"tar /z sparse round trip" : L"tar sparse round trip", ok);
+		}
+	}
+}
+
+int Bench(int argc, TCHAR **argv)
+{
+	if (argc >= 3 && _tcscmp(argv[2], L"/?") == 0)
+		return ShowHelpBench(filesystem::path(argv[0]).filename());
+
+	bool check_only = false;
+	filesystem::path tree;
+	filesystem::path work;
+	wstring pass = L"bench";
+	wstring mem;
+	filesystem::path image;
+	for (int n = 2; n < argc; ++n)
+	{
+		wstring_view param(argv[n]);
+		if (param == L"/c")
+			check_only = true;
+		else if (param.substr(0, 5) == L"/tar:")
+			tree = param.substr(5);
+		else if (param.substr(0, 5) == L"/mem:")
+			mem = param.substr(5);
+		else if (param.substr(0, 6) == L"/ntfs:")
+			image = param.substr(6);
+		else if (param.substr(0, 3) == L"/p:")
+			pass = param.substr(3);
+		else if (param.substr(0, 3) == L"/w:")
+			work = param.substr(3);
+		else if (param.substr(0, 3) == L"/t:")
+			min_time = milliseconds(max(1, _wtoi(param.substr(3).data())));
+		else if (param.substr(0, 1) == L"/")
+			throw invalid_argument("unrecognized option");
+		else
+			masks = split(param, L';');
+	}
+
+	wcout << L"Checks:" << endl;
+	CheckAes();
+	CheckShaker();
+	CheckSha1();
+	CheckUnicode();
+	CheckMasks();
+	CheckSparseTar();
+	if (!image.empty())
+		CheckImage(image);
+	if (failed) {
+		wcout << failed << L" checks failed" << endl;
+		return 1;
+	}
+	if (check_only)
+		return 0;
+	wcout << endl;
+	if (!mem.empty())
+		RunMemory(mem, pass);
+	else if (!tree.empty())
+		RunTree(tree, pass, work);
+	else
+		RunAll();
+	return 0;
+}
@@ -59,6 +59,60 @@ std::vector<wstring> split(wstring_view str, wchar_t delim)
 	return res;
 }
 
+ULONGLONG ReadSize(wstring_view view)
+{
+	wstring str(view); // wcstoull needs the terminating zero
+	wchar_t* e;
+	ULONGLONG ul = wcstoull(str.c_str(), &e, 10);
+	switch (*e) {
+	case L'K': case L'k': ul <<= 10; ++e; break;
+	case L'M': case L'm': ul <<= 20; ++e; break;
+	case L'G': case L'g': ul <<= 30; ++e; break;
+	}
+	if (e != str.c_str() + str.size())
+		throw invalid_argument("Invalid size");
+	return ul;
+}
+
+void ReadRange(wstring_view str, ULONGLONG& from, ULONGLONG& to, bool open_end)
+{
+	size_t dash = str.find(L'-');
+	from = ReadSize(str.substr(0, dash));
+	if (dash == wstring_view::npos)
+		to = open_end ? ~0ULL : from;
+	else
+		to = dash + 1 < str.size() ? ReadSize(str.substr(dash + 1)) : ~0ULL;
+}
+
+namespace
+{
+	vector<wchar_t> MakeFoldTable()
+	{
+		vector<wchar_t> table(0x10000);
+		for (size_t i = 0; i < table.size(); ++i)
+			table[i] = (wchar_t)i;
+		CharUpperBuffW(table.data(), (DWORD)table.size());
+		for (size_t i = 0xD800; i < 0xE000; ++i) // neighbours in the table are not surrogate pairs
+			table[i] = (wchar_t)i;
+		return table;
+	}
+
+	const vector<wchar_t> fold_table = MakeFoldTable();
+}
+
+wchar_t fold_char(wchar_t ch)
+{
+	return (size_t)ch < fold_table.size() ? fold_table[(size_t)ch] : ch;
+}
+
+wstring fold_name(wstring_view name)
+{
+	wstring res(name);
+	for (auto& ch : res)
+		ch = fold_char(ch);
+	return res;
+}
+
 wchar_t char_upper(wchar_t ch)
 {
 	return (wchar_t)CharUpperW((LPWSTR)(DWORD_PTR)(DWORD)ch);
@@ -102,6 +156,43 @@ bool mask_match(const wchar_t* str, const vector<wstring> &masks)
 	return false;
 }
 
+wstring_view Indent(size_t level)
+{
+	static const wstring spaces(256, L' ');
+	return wstring_view(spaces).substr(0, min(level * 2, spaces.size()));
+}
+
+const wchar_t* filename_of(const filesystem::path& path)
+{
+	const wstring& str = path.native();
+	size_t pos = str.find_last_of(L"\\/");
+	if (pos != wstring::npos)
+		return str.c_str() + pos + 1;
+	if (str.size() >= 2 && str[1] == L':') // "c:name"
+		return str.c_str() + 2;
+	return str.c_str();
+}
+
+size_t StreamPos(wstring_view path)
+{
+	size_t sep = path.find_last_of(L"\\/");
+	size_t from = sep == wstring_view::npos ? 0 : sep + 1;
+	if (from == 0 && path.size() >= 2 && path[1] == L':') // "c:name"
+		from = 2;
+	return path.find(L':', from);
+}
+
+int CompareNoCase(wstring_view a, wstring_view b)
+{
+	for (size_t i = 0; i < a.size() && i < b.size(); ++i)
+	{
+		wchar_t ca = fold_char(a[i]), cb = fold_char(b[i]);
+		if (ca != cb)
+			return ca < cb ? -1 : 1;
+	}
+	return a.size() < b.size() ? -1 : a.size() > b.size() ? 1 : 0;
+}
+
 bool is_stream_name(const wchar_t* entry)
 {
 	// a:something    file (drive letter)
@@ -117,22 +208,29 @@ bool is_stream_name(const wchar_t* entry)
 }
 
 
-experimental::generator<DirItem> get_streams(filesystem::path entry, const wchar_t * sep)
+experimental::generator<DirItem> get_streams(const filesystem::path& entry, const wchar_t * sep)
 {
 	// Enumerate file's streams and print their sizes and names
 	WIN32_FIND_STREAM_DATA fsd;
 	HANDLE hFind = ::FindFirstStreamW(entry.c_str(), FindStreamInfoStandard, &fsd, 0);
-	for (bool ok = hFind != INVALID_HANDLE_VALUE; ok; ok = !!::FindNextStreamW(hFind, &fsd))
+	if (hFind == INVALID_HANDLE_VALUE)
+		return;
+	// the same item and name buffer are reused for all streams
+	wstring full = entry.native() + sep;
+	size_t base_len = full.size();
+	DirItem it = { DirItem::Stream };
+	do
 	{
 		if (wcscmp(fsd.cStreamName, L"::$DATA") == 0) // this is the main stream
 			continue;
 		wstring_view stream_name = RemoveAtEnd(fsd.cStreamName, L":$DATA"); // name without ":$DATA" in the end
-		filesystem::path full = wstring(entry) + sep + wstring(stream_name);
-		DirItem it = { DirItem::Stream, full,  (ULONGLONG)fsd.StreamSize.QuadPart };
+		full.resize(base_len);
+		full += stream_name;
+		it.name.assign(full);
+		it.size = (ULONGLONG)fsd.StreamSize.QuadPart;
 		co_yield it;
-	}
-	if (hFind != INVALID_HANDLE_VALUE)
-		::FindClose(hFind);
+	} while (::FindNextStreamW(hFind, &fsd));
+	::FindClose(hFind);
 }
 
 std::experimental::generator<DirItem> get_files(std::filesystem::path path)
@@ -145,13 +243,22 @@ std::experimental::generator<DirItem> get_files(std::filesystem::path path)
 	if (hFind == INVALID_HANDLE_VALUE)
 		return;
 
+	// the same item and name buffer are reused for all entries
+	wstring full = (path / L"").native();
+	size_t base_len = full.size();
+	DirItem it = {};
 	do
 	{
 		if (wcscmp(ffd.cFileName, L".") == 0 || wcscmp(ffd.cFileName, L"..") == 0)
 			continue;
-		DirItem::Type type = ffd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY ? DirItem::Dir : DirItem::File;
-		co_yield DirItem{ type, path / ffd.cFileName, FileSizeFrom(ffd),
-			ffd.dwFileAttributes, ffd.ftLastWriteTime };
+		full.resize(base_len);
+		full += ffd.cFileName;
+		it.type = ffd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY ? DirItem::Dir : DirItem::File;
+		it.name.assign(full);
+		it.size = FileSizeFrom(ffd);
+		it.dwFileAttributes = ffd.dwFileAttributes;
+		it.ftLastWriteTime = ffd.ftLastWriteTime;
+		co_yield it;
 	} while (FindNextFile(hFind, &ffd) != 0);
 	FindClose(hFind);
 }
@@ -174,21 +281,3 @@ experimental::generator<DirItem> directory_items(filesystem::path path)
 		}
 	}
 }
-
-std::experimental::generator<DirItem> get_files_multi(const std::vector<filesystem::path>& items)
-{
-	for (auto& p : items)
-	{
-		if (p == L".") {
-			for (auto& it : get_files(filesystem::current_path()))
-				co_yield it;
-			continue;
-		}
-		WIN32_FILE_ATTRIBUTE_DATA adata = {};
-		DirItem::Type type =
-			!GetFileAttributesEx(p.c_str(), GetFileExInfoStandard, &adata) ? DirItem::Invalid :
-			adata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY ? DirItem::Dir :
-			is_stream_name(p.c_str()) ? DirItem::Stream : DirItem::File;
-		co_yield DirItem{ type, p, FileSizeFrom(adata), adata.dwFileAttributes, adata.ftLastWriteTime };
-	}
-}
@@ -25,6 +25,9 @@
 std::wstring_view RemoveAtEnd(std::wstring_view str, std::wstring_view end);
 std::wstring FileSizeStr(ULONGLONG fsize);
 std::vector<std::wstring> split(std::wstring_view str, wchar_t delim);
+ULONGLONG ReadSize(std::wstring_view str); // "100", "64K", "500M", "2G"; throws invalid_argument
+// "from-to", "from-" (to is ~0), "-to" (from is 0); "from" alone: to is ~0 if open_end, else from
+void ReadRange(std::wstring_view str, ULONGLONG& from, ULONGLONG& to, bool open_end);
 bool mask_match(const wchar_t* str, const wchar_t* mask);
 bool mask_match(const wchar_t* str, const std::vector<std::wstring> &masks);
 
@@ -38,8 +41,14 @@ struct DirItem
 	FILETIME ftLastWriteTime;
 };
 
+std::wstring_view Indent(size_t level); // 2 spaces per level, without allocation
+const wchar_t* filename_of(const std::filesystem::path& path); // like path::filename(), but without allocation
+size_t StreamPos(std::wstring_view path); // position of ':' before the stream name, npos for a file or directory
+wchar_t fold_char(wchar_t ch); // upper case by a table, the same as CharUpperW
+std::wstring fold_name(std::wstring_view name); // fold_char of every char: key of a case-insensitive name
+int CompareNoCase(std::wstring_view a, std::wstring_view b); // as NTFS compares names: <0, 0, >0
 bool is_stream_name(const wchar_t* entry);
-std::experimental::generator<DirItem> get_streams(std::filesystem::path entry, const wchar_t* sep);
+// entry must live while the generator is used
+std::experimental::generator<DirItem> get_streams(const std::filesystem::path& entry, const wchar_t* sep);
 std::experimental::generator<DirItem> get_files(std::filesystem::path path); // WinAPI
 std::experimental::generator<DirItem> directory_items(std::filesystem::path path); // std::filesystem
-std::experimental::generator<DirItem> get_files_multi(const std::vector<std::filesystem::path>& items);
@@ -0,0 +1,277 @@
+/***********************************************************************
+
+  Copyright (c) 2019 Vsevolod Lukyanin
+  All rights reserved.
+
+  This file is a part of project ntfs_file_streams:
+  https://github.com/shtirlitz-dev/ntfs_file_streams
+
+  The tool that enables to list, create, copy, delete, show, write and
+  archive NTFS files streams.
+  About file streams:
+  https://docs.microsoft.com/en-us/windows/win32/fileio/file-streams
+
+***********************************************************************/
+
+#include "pch.h"
+
+#include "CopyAll.h"
+#include "ntfs_streams.h"
+#include "CommonFunc.h"
+#include "FsBackend.h"
+#include "TreeWalker.h"
+#include <tchar.h>
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+using namespace std;
+using namespace std::chrono;
+
+// Copy of files with all their streams, or of trees (see TreeWalker).
+// A file is copied by one thread of the walker: the main data first (creating
+// the file could remove streams), then its streams; streams of BigStream bytes
+// and more are also copied by extra threads, MaxStreamThreads for all files at
+// once, while the walker thread copies the rest. Attributes and time are set when
+// the file is complete, of directories - at the end, since their contents change the time.
+
+namespace
+{
+	int ShowHelpCopyAll(filesystem::path filename)
+	{
+		ShowCopyright();
+		wcout << L"\ncommand line arguments for '" << filename.c_str() << L" copyall':\n\n";
+		wcout << L"copyall [options] <src> <dest>\n";
+		wcout << L"where <src> is a file or a directory, it is copied with all streams and attributes\n";
+		wcout << L"to <dest>; a directory is copied with all subdirectories\n";
+		wcout << L"If <src> is a file and <dest> is a directory, the file is copied into it\n";
+		wcout << L"A directory cannot be copied into itself: <dest> must not be inside <src>\n";
+		wcout << L"options:\n";
+		wcout << L"  /j:threads     - number of threads copying files, default 4\n";
+		return 0;
+	}
+
+	const ULONGLONG BigStream = 16 * 1024 * 1024; // copied by extra threads
+	const int MaxStreamThreads = 4;                // extra threads of all walker threads
+	const DWORD BlockSize = 1024 * 1024;
+
+	atomic<int> free_stream_threads{ MaxStreamThreads };
+
+	// takes up to count extra threads from the shared limit
+	int ReserveThreads(int count)
+	{
+		int free = free_stream_threads.load();
+		while (free > 0 && !free_stream_threads.compare_exchange_weak(free, free - min(free, count)))
+			;
+		return max(0, min(free, count));
+	}
+
+	// true if path is dir or is inside it
+	bool IsInside(const filesystem::path& path, const filesystem::path& dir)
+	{
+		wstring p = filesystem::absolute(path).lexically_normal().native();
+		wstring d = filesystem::absolute(dir).lexically_normal().native();
+		while (d.size() > 1 && (d.back() == L'\\' || d.back() == L'/'))
+			d.pop_back();
+		return p.size() >= d.size() && CompareNoCase(wstring_view(p).substr(0, d.size()), d) == 0 &&
+			(p.size() == d.size() || p[d.size()] == L'\\' || p[d.size()] == L'/');
+	}
+
+	struct DirAttribs
+	{
+		wstring name;
+		DWORD attribs;
+		FILETIME last_write;
+	};
+
+	// results of one thread
+	struct alignas(64) Results
+	{
+		vector<char> buf;
+		vector<DirAttribs> dirs;
+		ULONGLONG files = 0;
+		ULONGLONG streams = 0;
+		ULONGLONG bytes = 0;
+	};
+
+	ULONGLONG CopyData(const wchar_t* src, const wchar_t* dest, vector<char>& buf)
+	{
+		auto in = Fs().Open(src, IFsBackend::Read);
+		if (!in)
+			throw MyException{ L"Failed to open source '<path>': <err>", src, GetLastError() };
+		auto out = Fs().Open(dest, IFsBackend::Create);
+		if (!out)
+			throw MyException{ L"Failed to create destination '<path>': <err>", dest, GetLastError() };
+		buf.resize(BlockSize);
+		ULONGLONG total = 0;
+		while (true)
+		{
+			SetLastError(0);
+			DWORD count = in->Read(buf.data(), BlockSize);
+			DWORD err = GetLastError();
+			if (err && err != ERROR_HANDLE_EOF)
+				throw MyException{ L"Failed to read '<path>': <err>", src, err };
+			if (!count)
+				break;
+			if (out->Write(buf.data(), count) != count)
+				throw MyException{ L"Failed to write '<path>': <err>", dest, GetLastError() };
+			total += count;
+		}
+		return total;
+	}
+
+	// main data, then streams, big ones also by extra threads if there are free; then attributes
+	void CopyWithStreams(const DirItem& file, const wstring& dest, Results& res)
+	{
+		res.bytes += CopyData(file.name.c_str(), dest.c_str(), res.buf);
+		++res.files;
+		vector<DirItem> small_streams, big_streams;
+		for (auto& stream : Fs().ListStreams(file.name, L""))
+		{
+			++res.streams;
+			(stream.size < BigStream ? small_streams : big_streams).push_back(stream);
+		}
+		auto dest_of = [&](const DirItem& stream) {
+			return dest + stream.name.native().substr(file.name.native().size()); // + ":name"
+		};
+
+		// big streams are taken one by one by the extra threads and by this one
+		atomic<size_t> next{ 0 };
+		vector<exception_ptr> errors;
+		mutex mtx;
+		ULONGLONG big_bytes = 0;
+		auto copy_big = [&](vector<char>& buf) {
+			for (size_t n; (n = next++) < big_streams.size(); )
+			{
+				try {
+					ULONGLONG done = CopyData(big_streams[n].name.c_str(), dest_of(big_streams[n]).c_str(), buf);
+					lock_guard<mutex> lock(mtx);
+					big_bytes += done;
+				}
+				catch (...) {
+					lock_guard<mutex> lock(mtx);
+					errors.push_back(current_exception());
+				}
+			}
+		};
+		int extra = big_streams.empty() ? 0 : ReserveThreads((int)big_streams.size());
+		vector<thread> workers;
+		for (int n = 0; n < extra; ++n)
+			workers.emplace_back([&] {
+				vector<char> buf;
+				copy_big(buf);
+			});
+
+		exception_ptr error;
+		try {
+			for (auto& stream : small_streams)
+				res.bytes += CopyData(stream.name.c_str(), dest_of(stream).c_str(), res.buf);
+		}
+		catch (...) {
+			error = current_exception();
+		}
+		if (error)
+			next = big_streams.size(); // the rest is not started
+		copy_big(res.buf);
+		for (auto& t : workers)
+			t.join();
+		free_stream_threads += extra;
+		res.bytes += big_bytes;
+		if (!error && !errors.empty())
+			error = errors.front();
+		if (error)
+			rethrow_exception(error);
+		if (!Fs().SetAttribs(dest.c_str(), file.dwFileAttributes, file.ftLastWriteTime))
+			throw MyException{ L"Failed to set attributes of '<path>': <err>", dest, GetLastError() };
+	}
+}
+
+int CopyAll(int argc, TCHAR **argv)
+{
+	if (argc < 3 || _tcscmp(argv[2], L"/?") == 0)
+		return ShowHelpCopyAll(filesystem::path(argv[0]).filename());
+
+	int threads = 4;
+	vector<filesystem::path> paths;
+	for (int n = 2; n < argc; ++n)
+	{
+		wstring_view param(argv[n]);
+		if (param.substr(0, 3) == L"/j:")
+			threads = max(1, _wtoi(param.data() + 3));
+		else if (param.substr(0, 1) == L"/")
+			throw invalid_argument("unrecognized option");
+		else
+			paths.push_back(param);
+	}
+	if (paths.size() != 2)
+		throw invalid_argument("Specify source and destination");
+
+	auto begin_time = high_resolution_clock::now();
+	DirItem root = Fs().GetItem(paths[0]);
+	if (root.type != DirItem::File && root.type != DirItem::Dir)
+		throw MyException{ L"Not found: '<path>'", paths[0].native(), ERROR_FILE_NOT_FOUND };
+	filesystem::path dest_root = paths[1];
+	if (root.type == DirItem::File && Fs().GetItem(dest_root).type == DirItem::Dir)
+		dest_root /= root.name.filename();
+	if (root.type == DirItem::Dir && IsInside(dest_root, root.name)) // it would be copied into itself
+		throw MyException{ L"Destination is inside the source: '<path>'", dest_root.native(), ERROR_INVALID_PARAMETER };
+
+	// names of items are the name of root with the rest, which is added to dest
+	wstring src_base = root.name.native(), dest_base = dest_root.native();
+	for (auto* base : { &src_base, &dest_base })
+		while (base->size() > 1 && (base->back() == L'\\' || base->back() == L'/'))
+			base->pop_back();
+	auto dest_of = [&](const filesystem::path& name) {
+		return dest_base + name.native().substr(min(src_base.size(), name.native().size()));
+	};
+
+	TreeWalker walker(threads, false); // streams of files are listed by CopyWithStreams
+	vector<Results> results(walker.Threads());
+	if (root.type == DirItem::Dir) {
+		if (!Fs().CreateDir(dest_root))
+			throw MyException{ L"Failed to create directory '<path>': <err>", dest_base, GetLastError() };
+		results[0].dirs.push_back(DirAttribs{ dest_base, root.dwFileAttributes, root.ftLastWriteTime });
+	}
+	walker.Walk({ root }, [&](const DirItem& item, int thread) {
+		Results& res = results[thread];
+		wstring dest = dest_of(item.name);
+		switch (item.type)
+		{
+		case DirItem::Dir: // before its items
+			if (!Fs().CreateDir(dest))
+				throw MyException{ L"Failed to create directory '<path>': <err>", dest, GetLastError() };
+			res.dirs.push_back(DirAttribs{ dest, item.dwFileAttributes, item.ftLastWriteTime });
+			break;
+		case DirItem::File:
+			CopyWithStreams(item, dest, res);
+			break;
+		case DirItem::Stream: // of a directory
+			++res.streams;
+			res.bytes += CopyData(item.name.c_str(), dest.c_str(), res.buf);
+			break;
+		default:
+			break;
+		}
+	});
+
+	ULONGLONG files = 0, streams = 0, bytes = 0;
+	vector<DirAttribs> dirs;
+	for (auto& res : results)
+	{
+		files += res.files;
+		streams += res.streams;
+		bytes += res.bytes;
+		move(res.dirs.begin(), res.dirs.end(), back_inserter(dirs));
+	}
+	// children before their parents
+	sort(dirs.begin(), dirs.end(), [](const DirAttribs& a, const DirAttribs& b) { return a.name > b.name; });
+	for (auto& d : dirs)
+		if (!Fs().SetAttribs(d.name.c_str(), d.attribs, d.last_write))
+			throw MyException{ L"Failed to set attributes of '<path>': <err>", d.name, GetLastError() };
+
+	duration<double> time_span = high_resolution_clock::now() - begin_time;
+	wcout << files << L" files, " << dirs.size() << L" directories, " << streams << L" streams, " << FileSizeStr(bytes)
+		<< L" bytes copied from " << src_base << L" to " << dest_base << L" (" << time_span.count() << L" sec)" << endl;
+	return 0;
+}
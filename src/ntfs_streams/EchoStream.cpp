@@ -0,0 +1,155 @@
+/***********************************************************************
+
+  Copyright (c) 2019 Vsevolod Lukyanin
+  All rights reserved.
+
+  This file is a part of project ntfs_file_streams:
+  https://github.com/shtirlitz-dev/ntfs_file_streams
+
+  The tool that enables to list, create, copy, delete, show, write and
+  archive NTFS files streams.
+  About file streams:
+  https://docs.microsoft.com/en-us/windows/win32/fileio/file-streams
+
+***********************************************************************/
+
+#include "pch.h"
+
+#include "EchoStream.h"
+#include "ntfs_streams.h"
+#include "CommonFunc.h"
+#include "FileSimple.h"
+#include "UnicodeFuncts.h"
+#include <tchar.h>
+#include <iostream>
+#include <vector>
+#include <chrono>
+
+using namespace std;
+using namespace std::chrono;
+
+// Text is read by lines from wcin and written as UTF-8 with CR LF, by big portions.
+// With /b stdin is read by its handle in big blocks, every block is written to the
+// stream as it is by one call; clusters are reserved beforehand if the size is known
+// (/s or stdin redirected from a file), so the stream is not extended block by block.
+
+namespace
+{
+	int ShowHelpEcho(filesystem::path filename)
+	{
+		ShowCopyright();
+		wcout << L"\ncommand line arguments for '" << filename.c_str() << L" echo':\n\n";
+		wcout << L"echo [options] <dest>\n";
+		wcout << L"where <dest> is a file or a stream, e.g. file.txt:stream1\n";
+		wcout << L"Without /b stdin is text, lines are written in UTF-8 with \\r\\n\n";
+		wcout << L"options:\n";
+		wcout << L"  /b             - binary: bytes of stdin are written as they are, e.g. gen.exe | fstreams echo /b f:data\n";
+		wcout << L"  /a             - append to the stream instead of replacing it\n";
+		wcout << L"  /s:size        - expected size with /b, space is reserved; suffixes K, M, G, e.g. /s:500M\n";
+		wcout << L"If stdin is redirected from a file, its size is used\n";
+		return 0;
+	}
+
+	const DWORD BlockSize = 4 * 1024 * 1024;
+
+	void WriteAll(FileSimple& fs, const wchar_t* dest, const void* data, DWORD size)
+	{
+		if (fs.Write(data, size) != size)
+			throw MyException{ L"Failed to write '<path>': <err>", dest, GetLastError() };
+	}
+
+	// fills the block as far as possible: a pipe gives at most its buffer by one read
+	DWORD ReadBlock(HANDLE in, char* data, DWORD size)
+	{
+		DWORD total = 0;
+		while (total < size)
+		{
+			DWORD done = 0;
+			if (!ReadFile(in, data + total, size - total, &done, nullptr)) {
+				DWORD err = GetLastError();
+				if (err == ERROR_BROKEN_PIPE || err == ERROR_HANDLE_EOF) // the writer has closed the pipe
+					break;
+				throw MyException{ L"Failed to read '<path>': <err>", L"stdin", err };
+			}
+			if (!done)
+				break;
+			total += done;
+		}
+		return total;
+	}
+}
+
+int EchoStream(int argc, TCHAR **argv)
+{
+	if (argc >= 3 && _tcscmp(argv[2], L"/?") == 0)
+		return ShowHelpEcho(filesystem::path(argv[0]).filename());
+
+	bool binary = false, append = false;
+	ULONGLONG expected = 0;
+	const wchar_t* dest = nullptr;
+	for (int n = 2; n < argc; ++n)
+	{
+		wstring_view param(argv[n]);
+		if (param == L"/b")
+			binary = true;
+		else if (param == L"/a")
+			append = true;
+		else if (param.substr(0, 3) == L"/s:")
+			expected = ReadSize(param.substr(3));
+		else if (param.substr(0, 1) == L"/")
+			throw invalid_argument("unrecognized option");
+		else if (!dest)
+			dest = argv[n];
+		else
+			throw invalid_argument("too many parameters");
+	}
+	if (!dest)
+		throw invalid_argument("Specify stream to echo to");
+
+	FileSimple fs_dest;
+	if (!(append ? fs_dest.OpenRW(dest) && fs_dest.SetPosition(0, FILE_END) != FileSimple::InvalidPosition : fs_dest.Open(dest, true, true)))
+		throw MyException{ L"Failed to create destination '<path>': <err>", dest, GetLastError() };
+
+	auto begin_time = high_resolution_clock::now();
+	ULONGLONG total = 0;
+	if (binary)
+	{
+		HANDLE in = GetStdHandle(STD_INPUT_HANDLE);
+		LARGE_INTEGER size;
+		if (!expected && GetFileType(in) == FILE_TYPE_DISK && GetFileSizeEx(in, &size))
+			expected = (ULONGLONG)size.QuadPart;
+		if (expected)
+			fs_dest.Reserve(fs_dest.GetLength() + expected); // only a hint, the stream may be compressed or sparse
+		vector<char> buf(BlockSize);
+		while (DWORD count = ReadBlock(in, buf.data(), BlockSize))
+		{
+			WriteAll(fs_dest, dest, buf.data(), count);
+			total += count;
+		}
+	}
+	else
+	{
+		wcout << L"Type Ctrl-Z at the end of your text" << endl;
+		wstring str;
+		string out;
+		while (getline(wcin, str))
+		{
+			str += L"\r\n";
+			out += ToChar(str, CP_UTF8);
+			if (out.size() >= BlockSize) {
+				WriteAll(fs_dest, dest, out.data(), (DWORD)out.size());
+				total += out.size();
+				out.clear();
+			}
+		}
+		WriteAll(fs_dest, dest, out.data(), (DWORD)out.size());
+		total += out.size();
+	}
+
+	duration<double> time_span = high_resolution_clock::now() - begin_time;
+	wcout << total << L" bytes written to " << dest;
+	if (binary)
+		wcout << L" (" << time_span.count() << L" sec, " << (ULONGLONG)(total / max(time_span.count(), 1e-6) / (1024 * 1024)) << L" MB/s)";
+	wcout << endl;
+	return 0;
+}
@@ -18,6 +18,8 @@
 class FileSimple
 {
 public:
+	static const ULONGLONG InvalidPosition = ~0ULL;
+
 	FileSimple() : m_hFile(INVALID_HANDLE_VALUE) {}
 	FileSimple(LPCTSTR name, bool write = false, bool sequential = true)
 		: m_hFile(INVALID_HANDLE_VALUE)
@@ -32,11 +34,34 @@ public:
 			sequential ? FILE_FLAG_SEQUENTIAL_SCAN : 0, 0);
 		return IsOpen();
 	}
+	bool OpenShared(LPCTSTR name) // for reading while others may write it, e.g. a growing log
+	{
+		m_hFile = CreateFile(name, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, 0, OPEN_EXISTING, 0, 0);
+		return IsOpen();
+	}
+	bool OpenDirect(LPCTSTR name, bool write) // unbuffered: bypasses file cache, needs aligned buffers, see AlignedBuffer
+	{
+		m_hFile = CreateFile(name, write ? GENERIC_WRITE : GENERIC_READ,
+			write ? 0 : FILE_SHARE_READ, 0, write ? CREATE_ALWAYS : OPEN_EXISTING,
+			FILE_FLAG_NO_BUFFERING | (write ? FILE_FLAG_WRITE_THROUGH : FILE_FLAG_SEQUENTIAL_SCAN), 0);
+		return IsOpen();
+	}
 	bool OpenRW(LPCTSTR name) // opens for read-write
 	{
 		m_hFile = CreateFile(name, GENERIC_WRITE | GENERIC_READ, 0, 0, OPEN_ALWAYS, 0, 0);
 		return IsOpen();
 	}
+	bool OpenTemp() // read-write file in the temp directory, it is deleted when closed
+	{
+		TCHAR dir[MAX_PATH], name[MAX_PATH];
+		if (!GetTempPath(MAX_PATH, dir) || !GetTempFileName(dir, TEXT("fst"), 0, name))
+			return false;
+		m_hFile = CreateFile(name, GENERIC_WRITE | GENERIC_READ, 0, 0, CREATE_ALWAYS,
+			FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, 0);
+		if (!IsOpen())
+			DeleteFile(name);
+		return IsOpen();
+	}
 	bool OpenForAttribs(LPCTSTR name, bool bReadWrite) // for get/set attributes (bReadWrite or only read)
 	{
 		m_hFile = CreateFile(name,
@@ -67,16 +92,24 @@ public:
 		if (IsOpen()) CloseHandle(m_hFile);
 		m_hFile = INVALID_HANDLE_VALUE;
 	}
-	DWORD SetPosition(LONG offset, DWORD from = FILE_BEGIN)//FILE_CURRENT, FILE_END
-	{
-		if (!IsOpen()) return 0;
-		return SetFilePointer(m_hFile, offset, 0, from);
+	ULONGLONG SetPosition(LONGLONG offset, DWORD from = FILE_BEGIN)//FILE_CURRENT, FILE_END
+	{ // returns new position or InvalidPosition
+		LARGE_INTEGER dist, pos;
+		dist.QuadPart = offset;
+		if (!IsOpen() || !SetFilePointerEx(m_hFile, dist, &pos, from)) return InvalidPosition;
+		return (ULONGLONG)pos.QuadPart;
 	}
 	BOOL SetEOF()
 	{
 		if (!IsOpen()) return FALSE;
 		return SetEndOfFile(m_hFile);
 	}
+	bool Reserve(ULONGLONG size) // allocates clusters for size bytes, the length is not changed
+	{
+		FILE_ALLOCATION_INFO ai;
+		ai.AllocationSize.QuadPart = (LONGLONG)size;
+		return IsOpen() && SetFileInformationByHandle(m_hFile, FileAllocationInfo, &ai, sizeof(ai));
+	}
 	DWORD Read(void *buffer, DWORD count)
 	{
 		if (!IsOpen()) return 0;
@@ -91,10 +124,62 @@ public:
 		if (!WriteFile(m_hFile, buffer, count, &count, 0)) return 0;
 		return count;
 	}
-	DWORD GetLength()
+	// positional read/write (like pread/pwrite): offset is given explicitly,
+	// so several threads can work with different handles of the same file
+	DWORD ReadAt(ULONGLONG offset, void *buffer, DWORD count)
+	{
+		if (!IsOpen()) return 0;
+		if (count == 0) return 0;
+		OVERLAPPED ov = {};
+		ov.Offset = (DWORD)offset;
+		ov.OffsetHigh = (DWORD)(offset >> 32);
+		if (!ReadFile(m_hFile, buffer, count, &count, &ov)) return 0;
+		return count;
+	}
+	DWORD WriteAt(ULONGLONG offset, const void *buffer, DWORD count)
 	{
 		if (!IsOpen()) return 0;
-		return GetFileSize(m_hFile, 0);
+		if (count == 0) return 0;
+		OVERLAPPED ov = {};
+		ov.Offset = (DWORD)offset;
+		ov.OffsetHigh = (DWORD)(offset >> 32);
+		if (!WriteFile(m_hFile, buffer, count, &count, &ov)) return 0;
+		return count;
+	}
+	// scatter/gather (like readv/writev): fills/writes buffers one after another starting at offset,
+	// returns total count of bytes, stops at the first short read/write
+	struct IoVec
+	{
+		void* data;
+		DWORD size;
+	};
+	ULONGLONG ReadV(ULONGLONG offset, const IoVec* vec, int count)
+	{
+		ULONGLONG total = 0;
+		for (int i = 0; i < count; ++i) {
+			DWORD done = ReadAt(offset + total, vec[i].data, vec[i].size);
+			total += done;
+			if (done != vec[i].size)
+				break;
+		}
+		return total;
+	}
+	ULONGLONG WriteV(ULONGLONG offset, const IoVec* vec, int count)
+	{
+		ULONGLONG total = 0;
+		for (int i = 0; i < count; ++i) {
+			DWORD done = WriteAt(offset + total, vec[i].data, vec[i].size);
+			total += done;
+			if (done != vec[i].size)
+				break;
+		}
+		return total;
+	}
+	ULONGLONG GetLength()
+	{
+		LARGE_INTEGER size;
+		if (!IsOpen() || !GetFileSizeEx(m_hFile, &size)) return 0;
+		return (ULONGLONG)size.QuadPart;
 	}
 	HANDLE Handle() { return m_hFile; }
 protected:
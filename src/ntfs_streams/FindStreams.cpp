@@ -0,0 +1,194 @@
+/***********************************************************************
+
+  Copyright (c) 2019 Vsevolod Lukyanin
+  All rights reserved.
+
+  This file is a part of project ntfs_file_streams:
+  https://github.com/shtirlitz-dev/ntfs_file_streams
+
+  The tool that enables to list, create, copy, delete, show, write and
+  archive NTFS files streams.
+  About file streams:
+  https://docs.microsoft.com/en-us/windows/win32/fileio/file-streams
+
+***********************************************************************/
+
+#include "pch.h"
+
+#include "FindStreams.h"
+#include "ntfs_streams.h"
+#include "CommonFunc.h"
+#include "FsBackend.h"
+#include "TreeWalker.h"
+#include "MaskSet.h"
+#include <tchar.h>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+
+using namespace std;
+using namespace std::chrono;
+
+// Recursive search of streams in several threads (see TreeWalker).
+// Without sorting streams are printed as they are found; with /top only N biggest
+// are kept by each thread (a heap), so memory does not depend on the size of the tree.
+
+namespace
+{
+	int ShowHelpFind(filesystem::path filename)
+	{
+		ShowCopyright();
+		wcout << L"\ncommand line arguments for '" << filename.c_str() << L" find':\n\n";
+		wcout << L"find [options] [<item1> <item2> ...]\n";
+		wcout << L"where <itemN> are files or directories to search in, with all subdirectories\n";
+		wcout << L"If <itemN> are not specified, the current directory is searched\n";
+		wcout << L"options:\n";
+		wcout << L"  /n:mask1;mask2 - stream names, e.g. Zone.Identifier or *.txt\n";
+		wcout << L"  /s:min-max     - range of stream sizes, suffixes K, M, G, e.g. /s:1M- or /s:0-4K\n";
+		wcout << L"  /after:date    - file or directory modified at date (yyyy-mm-dd) or later\n";
+		wcout << L"  /before:date   - file or directory modified before date\n";
+		wcout << L"  /top:N         - only N biggest streams, biggest first\n";
+		wcout << L"  /o:s /o:n      - sort by size (biggest first) or by name, default: as found\n";
+		wcout << L"  /j:threads     - number of threads listing directories, default 8\n";
+		return 0;
+	}
+
+	ULONGLONG ReadDate(wstring_view str) // local yyyy-mm-dd to UTC FILETIME
+	{
+		auto parts = split(str, L'-');
+		if (parts.size() != 3)
+			throw invalid_argument("Invalid date, use yyyy-mm-dd");
+		SYSTEMTIME st = {};
+		st.wYear = (WORD)_wtoi(parts[0].c_str());
+		st.wMonth = (WORD)_wtoi(parts[1].c_str());
+		st.wDay = (WORD)_wtoi(parts[2].c_str());
+		FILETIME local, utc;
+		if (!SystemTimeToFileTime(&st, &local) || !LocalFileTimeToFileTime(&local, &utc))
+			throw invalid_argument("Invalid date, use yyyy-mm-dd");
+		return ((ULONGLONG)utc.dwHighDateTime << 32) | utc.dwLowDateTime;
+	}
+
+	struct Found
+	{
+		wstring name;
+		ULONGLONG size;
+	};
+
+	bool Bigger(const Found& a, const Found& b)
+	{
+		return a.size > b.size;
+	}
+
+	// results of one thread
+	struct alignas(64) Results
+	{
+		vector<Found> found; // with /top: heap, the smallest is the first
+		ULONGLONG count = 0;
+		ULONGLONG bytes = 0;
+	};
+}
+
+int FindStreams(int argc, TCHAR **argv)
+{
+	if (argc >= 3 && _tcscmp(argv[2], L"/?") == 0)
+		return ShowHelpFind(filesystem::path(argv[0]).filename());
+
+	vector<wstring> masks;
+	ULONGLONG min_size = 0, max_size = ~0ULL;
+	ULONGLONG after = 0, before = ~0ULL;
+	size_t top = 0;
+	wchar_t order = 0;
+	int threads = 8;
+	vector<filesystem::path> items;
+	for (int n = 2; n < argc; ++n)
+	{
+		wstring_view param(argv[n]);
+		if (param.substr(0, 3) == L"/n:")
+			masks = split(param.substr(3), L';');
+		else if (param.substr(0, 3) == L"/s:")
+			ReadRange(param.substr(3), min_size, max_size, false);
+		else if (param.substr(0, 7) == L"/after:")
+			after = ReadDate(param.substr(7));
+		else if (param.substr(0, 8) == L"/before:")
+			before = ReadDate(param.substr(8));
+		else if (param.substr(0, 5) == L"/top:")
+			top = max(1, _wtoi(param.data() + 5));
+		else if (param == L"/o:s" || param == L"/o:n")
+			order = param[3];
+		else if (param.substr(0, 3) == L"/j:")
+			threads = max(1, _wtoi(param.data() + 3));
+		else if (param.substr(0, 1) == L"/")
+			throw invalid_argument("unrecognized option");
+		else
+			items.push_back(param);
+	}
+
+	auto begin_time = high_resolution_clock::now();
+	vector<DirItem> roots;
+	if (items.empty())
+		items.push_back(Fs().CurrentDir());
+	for (auto& it : items)
+	{
+		roots.push_back(Fs().GetItem(it));
+		if (roots.back().type == DirItem::Invalid)
+			throw MyException{ L"Not found: '<path>'", it.native(), ERROR_FILE_NOT_FOUND };
+	}
+
+	MaskSet match(masks);
+	bool keep = top || order; // else printed at once
+	mutex out_mtx;
+	TreeWalker walker(threads);
+	vector<Results> results(walker.Threads());
+	walker.Walk(roots, [&](const DirItem& item, int thread) {
+		if (item.type != DirItem::Stream || item.size < min_size || item.size > max_size)
+			return;
+		ULONGLONG time = ((ULONGLONG)item.ftLastWriteTime.dwHighDateTime << 32) | item.ftLastWriteTime.dwLowDateTime;
+		if (time < after || time >= before)
+			return;
+		const wchar_t* name = filename_of(item.name);
+		if (!match.empty() && !match.Match(wcschr(name, L':') + 1))
+			return;
+		Results& res = results[thread];
+		++res.count;
+		res.bytes += item.size;
+		if (!keep) {
+			lock_guard<mutex> lock(out_mtx);
+			wcout << setw(15) << FileSizeStr(item.size) << L" " << item.name.c_str() << L"\n";
+		}
+		else if (!top)
+			res.found.push_back(Found{ item.name.native(), item.size });
+		else if (res.found.size() < top || item.size > res.found.front().size) {
+			if (res.found.size() == top) {
+				pop_heap(res.found.begin(), res.found.end(), Bigger);
+				res.found.pop_back();
+			}
+			res.found.push_back(Found{ item.name.native(), item.size });
+			push_heap(res.found.begin(), res.found.end(), Bigger);
+		}
+	});
+
+	ULONGLONG count = 0, bytes = 0;
+	vector<Found> all;
+	for (auto& res : results)
+	{
+		count += res.count;
+		bytes += res.bytes;
+		move(res.found.begin(), res.found.end(), back_inserter(all));
+		res.found = vector<Found>();
+	}
+	if (top && all.size() > top) {
+		partial_sort(all.begin(), all.begin() + top, all.end(), Bigger);
+		all.resize(top);
+	}
+	if (order == L'n')
+		sort(all.begin(), all.end(), [](const Found& a, const Found& b) { return a.name < b.name; });
+	else
+		sort(all.begin(), all.end(), Bigger);
+	for (auto& it : all)
+		wcout << setw(15) << FileSizeStr(it.size) << L" " << it.name << L"\n";
+
+	duration<double> time_span = high_resolution_clock::now() - begin_time;
+	wcout << count << L" streams, " << FileSizeStr(bytes) << L" bytes; " << walker.Dirs() << L" directories, "
+		<< walker.Files() << L" files (" << time_span.count() << L" sec)" << endl;
+	return 0;
+}
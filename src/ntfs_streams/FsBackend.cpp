@@ -0,0 +1,536 @@
+/***********************************************************************
+
+  Copyright (c) 2019 Vsevolod Lukyanin
+  All rights reserved.
+
+  This file is a part of project ntfs_file_streams:
+  https://github.com/shtirlitz-dev/ntfs_file_streams
+
+  The tool that enables to list, create, copy, delete, show, write and
+  archive NTFS files streams.
+  About file streams:
+  https://docs.microsoft.com/en-us/windows/win32/fileio/file-streams
+
+***********************************************************************/
+
+#include "pch.h"
+#include "FsBackend.h"
+
+using namespace std;
+
+namespace
+{
+	IFsBackend* current_fs = nullptr;
+
+	class NativeFile : public IFsFile
+	{
+	public:
+		FileSimple fs;
+		bool sparse = false;     // FSCTL_SET_SPARSE is done
+		bool not_sparse = false; // it has failed (e.g. FAT, exFAT), holes are written as zeros
+		virtual DWORD Read(void* buffer, DWORD count) override { return fs.Read(buffer, count); }
+		virtual DWORD ReadAt(ULONGLONG offset, void* buffer, DWORD count) override { return fs.ReadAt(offset, buffer, count); }
+		virtual DWORD Write(const void* buffer, DWORD count) override { return fs.Write(buffer, count); }
+		virtual ULONGLONG GetLength() override { return fs.GetLength(); }
+		virtual vector<Range> AllocatedRanges(ULONGLONG length) override
+		{
+			vector<Range> ranges;
+			FILE_ALLOCATED_RANGE_BUFFER query = {}, found[64];
+			query.Length.QuadPart = (LONGLONG)length;
+			while (true)
+			{
+				DWORD bytes = 0;
+				BOOL ok = DeviceIoControl(fs.Handle(), FSCTL_QUERY_ALLOCATED_RANGES, &query, sizeof(query), found, sizeof(found), &bytes, nullptr);
+				if (!ok && GetLastError() != ERROR_MORE_DATA)
+					return IFsFile::AllocatedRanges(length); // e.g. not NTFS
+				DWORD count = bytes / sizeof(found[0]);
+				for (DWORD i = 0; i < count; ++i)
+					ranges.push_back(Range{ (ULONGLONG)found[i].FileOffset.QuadPart, (ULONGLONG)found[i].Length.QuadPart });
+				if (ok || !count)
+					return ranges;
+				ULONGLONG next = (ULONGLONG)(found[count - 1].FileOffset.QuadPart + found[count - 1].Length.QuadPart);
+				query.FileOffset.QuadPart = (LONGLONG)next;
+				query.Length.QuadPart = (LONGLONG)(length - next);
+			}
+		}
+		virtual bool WriteHole(ULONGLONG count) override
+		{
+			if (!sparse && !not_sparse) {
+				DWORD bytes = 0;
+				sparse = DeviceIoControl(fs.Handle(), FSCTL_SET_SPARSE, nullptr, 0, nullptr, 0, &bytes, nullptr) != FALSE;
+				not_sparse = !sparse;
+			}
+			if (not_sparse)
+				return IFsFile::WriteHole(count);
+			// the end of a sparse file is moved without allocation
+			return fs.SetPosition((LONGLONG)count, FILE_CURRENT) != FileSimple::InvalidPosition && fs.SetEOF();
+		}
+	};
+
+	// removes [offset, end) from holes, then adds it as a hole if hole; adjacent holes are joined
+	void MarkHole(vector<IFsFile::Range>& holes, ULONGLONG offset, ULONGLONG end, bool hole)
+	{
+		vector<IFsFile::Range> res;
+		if (hole)
+			res.push_back(IFsFile::Range{ offset, end - offset });
+		for (auto& h : holes)
+		{
+			ULONGLONG h_end = h.offset + h.length;
+			if (h.offset < offset)
+				res.push_back(IFsFile::Range{ h.offset, min(h_end, offset) - h.offset });
+			if (h_end > end)
+				res.push_back(IFsFile::Range{ max(h.offset, end), h_end - max(h.offset, end) });
+		}
+		sort(res.begin(), res.end(), [](const IFsFile::Range& a, const IFsFile::Range& b) { return a.offset < b.offset; });
+		holes.clear();
+		for (auto& r : res)
+			if (!holes.empty() && holes.back().offset + holes.back().length == r.offset)
+				holes.back().length += r.length;
+			else
+				holes.push_back(r);
+	}
+
+	class MemoryFile : public IFsFile
+	{
+	public:
+		MemoryFile(shared_ptr<MemoryFs::Data> data, atomic<ULONGLONG>& total)
+			: data(move(data)), total(total)
+		{
+		}
+		virtual DWORD Read(void* buffer, DWORD count) override
+		{
+			DWORD done = ReadAt(pos, buffer, count);
+			pos += done;
+			return done;
+		}
+		virtual DWORD ReadAt(ULONGLONG offset, void* buffer, DWORD count) override
+		{
+			if (offset >= data->size())
+				return 0;
+			count = (DWORD)min<ULONGLONG>(count, data->size() - offset);
+			memcpy(buffer, data->data() + offset, count);
+			return count;
+		}
+		virtual DWORD Write(const void* buffer, DWORD count) override
+		{
+			if (pos + count > data->size()) {
+				total += pos + count - data->size();
+				data->resize(pos + count);
+			}
+			memcpy(data->data() + pos, buffer, count);
+			if (!data->holes.empty())
+				MarkHole(data->holes, pos, pos + count, false);
+			pos += count;
+			return count;
+		}
+		virtual ULONGLONG GetLength() override { return data->size(); }
+		virtual vector<Range> AllocatedRanges(ULONGLONG length) override
+		{
+			vector<Range> ranges;
+			ULONGLONG from = 0;
+			for (auto& h : data->holes)
+			{
+				if (h.offset >= length)
+					break;
+				if (h.offset > from)
+					ranges.push_back(Range{ from, h.offset - from });
+				from = h.offset + h.length;
+			}
+			if (from < length)
+				ranges.push_back(Range{ from, length - from });
+			return ranges;
+		}
+		virtual bool WriteHole(ULONGLONG count) override
+		{
+			if (!count)
+				return true;
+			if (pos + count > data->size()) {
+				total += pos + count - data->size();
+				data->resize(pos + count);
+			}
+			memset(data->data() + pos, 0, (size_t)min<ULONGLONG>(count, data->size() - pos));
+			MarkHole(data->holes, pos, pos + count, true);
+			pos += count;
+			return true;
+		}
+	protected:
+		shared_ptr<MemoryFs::Data> data; // kept even if the file is overwritten
+		atomic<ULONGLONG>& total;
+		ULONGLONG pos = 0;
+	};
+}
+
+vector<IFsFile::Range> IFsFile::AllocatedRanges(ULONGLONG length)
+{
+	vector<Range> ranges;
+	if (length)
+		ranges.push_back(Range{ 0, length });
+	return ranges;
+}
+
+bool IFsFile::WriteHole(ULONGLONG count)
+{
+	static const vector<char> zeros(64 * 1024);
+	while (count)
+	{
+		DWORD part = (DWORD)min<ULONGLONG>(count, zeros.size());
+		if (Write(zeros.data(), part) != part)
+			return false;
+		count -= part;
+	}
+	return true;
+}
+
+IFsBackend& Fs()
+{
+	static NativeFs native;
+	return current_fs ? *current_fs : native;
+}
+
+void SetFs(IFsBackend* fs)
+{
+	current_fs = fs;
+}
+
+experimental::generator<DirItem> IFsBackend::ListItems(const vector<filesystem::path>& items)
+{
+	for (auto& p : items)
+	{
+		if (p == L".") {
+			for (auto& it : ListDir(CurrentDir()))
+				co_yield it;
+			continue;
+		}
+		co_yield GetItem(p);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+// NativeFs
+//////////////////////////////////////////////////////////////////////////
+
+filesystem::path NativeFs::CurrentDir()
+{
+	return filesystem::current_path();
+}
+
+experimental::generator<DirItem> NativeFs::ListDir(filesystem::path dir)
+{
+	return get_files(move(dir));
+}
+
+experimental::generator<DirItem> NativeFs::ListStreams(const filesystem::path& entry, const wchar_t* sep)
+{
+	return get_streams(entry, sep);
+}
+
+DirItem NativeFs::GetItem(const filesystem::path& path)
+{
+	WIN32_FILE_ATTRIBUTE_DATA adata = {};
+	DirItem::Type type =
+		!GetFileAttributesEx(path.c_str(), GetFileExInfoStandard, &adata) ? DirItem::Invalid :
+		adata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY ? DirItem::Dir :
+		is_stream_name(path.c_str()) ? DirItem::Stream : DirItem::File;
+	ULONGLONG size = ((ULONGLONG)adata.nFileSizeHigh << 32) | adata.nFileSizeLow;
+	return DirItem{ type, path, size, adata.dwFileAttributes, adata.ftLastWriteTime };
+}
+
+unique_ptr<IFsFile> NativeFs::Open(const wchar_t* name, OpenMode mode)
+{
+	auto file = make_unique<NativeFile>();
+	bool ok = false;
+	switch (mode)
+	{
+	case Read: ok = file->fs.Open(name, false, true); break;
+	case ReadDirect: ok = file->fs.OpenDirect(name, false); break;
+	case Create: ok = file->fs.Open(name, true, true); break;
+	case CreateDirect: ok = file->fs.OpenDirect(name, true); break;
+	}
+	return ok ? move(file) : nullptr;
+}
+
+bool NativeFs::SetLength(const wchar_t* name, ULONGLONG length)
+{
+	FileSimple fs;
+	return fs.OpenRW(name) && fs.SetPosition(length) != FileSimple::InvalidPosition && fs.SetEOF();
+}
+
+bool NativeFs::CreateDir(const filesystem::path& dir)
+{
+	error_code ec;
+	filesystem::create_directories(dir, ec);
+	if (ec)
+		SetLastError(ec.value());
+	return !ec;
+}
+
+bool NativeFs::SetAttribs(const wchar_t* name, DWORD attribs, const FILETIME& last_write)
+{
+	FileSimple f;
+	FILE_BASIC_INFO fbi;
+	if (!f.OpenForAttribs(name, true) || !f.GetAttribs(&fbi))
+		return false;
+	fbi.LastWriteTime = fbi.ChangeTime = (const LARGE_INTEGER&)last_write;
+	fbi.FileAttributes = attribs;
+	return f.SetAttribs(&fbi);
+}
+
+bool NativeFs::Delete(const wchar_t* name)
+{
+	return ::DeleteFile(name) != FALSE;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// MemoryFs
+//////////////////////////////////////////////////////////////////////////
+
+MemoryFs::MemoryFs()
+{
+	Node& root = m_nodes[L""];
+	root.dir = true;
+	root.attribs = FILE_ATTRIBUTE_DIRECTORY;
+}
+
+wstring MemoryFs::Norm(wstring_view path)
+{
+	wstring res;
+	res.reserve(path.size());
+	size_t pos = 0;
+	while (pos <= path.size())
+	{
+		size_t end = path.find_first_of(L"\\/", pos);
+		if (end == wstring_view::npos)
+			end = path.size();
+		wstring_view part = path.substr(pos, end - pos);
+		if (part == L"..") {
+			size_t last = res.rfind(L'\\');
+			res.resize(last == wstring::npos ? 0 : last);
+		}
+		else if (!part.empty() && part != L".") {
+			if (!res.empty())
+				res += L'\\';
+			res += part;
+		}
+		pos = end + 1;
+	}
+	return res;
+}
+
+wstring MemoryFs::Key(wstring_view path)
+{
+	return fold_name(Norm(path));
+}
+
+MemoryFs::Node* MemoryFs::Find(wstring_view path, wstring* stream_name)
+{
+	size_t sp = StreamPos(path);
+	auto it = m_nodes.find(Key(path.substr(0, sp)));
+	if (it == m_nodes.end())
+		return nullptr;
+	if (stream_name) {
+		stream_name->clear();
+		if (sp != wstring_view::npos)
+			stream_name->assign(RemoveAtEnd(path.substr(sp), L":$DATA"));
+	}
+	return &it->second;
+}
+
+MemoryFs::Node* MemoryFs::Add(wstring_view path, bool dir)
+{
+	wstring norm = Norm(path);
+	size_t sep = norm.rfind(L'\\');
+	Node* parent = Find(sep == wstring::npos ? L"" : wstring_view(norm).substr(0, sep));
+	if (!parent || !parent->dir) {
+		SetLastError(ERROR_PATH_NOT_FOUND);
+		return nullptr;
+	}
+	Node& node = m_nodes[Key(norm)];
+	node.name = norm.substr(sep == wstring::npos ? 0 : sep + 1);
+	node.dir = dir;
+	node.attribs = dir ? FILE_ATTRIBUTE_DIRECTORY : FILE_ATTRIBUTE_ARCHIVE;
+	parent->children.push_back(&node);
+	return &node;
+}
+
+experimental::generator<DirItem> MemoryFs::ListDir(filesystem::path dir)
+{
+	for (auto& dir_stream : ListStreams(dir, L"\\")) // stream for directory itself
+		co_yield dir_stream;
+
+	// items are copied: the lock is not kept while they are used
+	vector<DirItem> items;
+	{
+		lock_guard<mutex> lock(m_mtx);
+		Node* node = Find(dir.native());
+		if (node && node->dir) {
+			wstring base = dir.native();
+			if (!base.empty() && base.back() != L'\\' && base.back() != L'/')
+				base += L'\\';
+			items.reserve(node->children.size());
+			for (Node* child : node->children)
+				items.push_back(DirItem{ child->dir ? DirItem::Dir : DirItem::File, base + child->name,
+					child->dir ? 0 : child->data->size(), child->attribs, child->last_write });
+		}
+	}
+	for (auto& it : items)
+		co_yield it;
+}
+
+experimental::generator<DirItem> MemoryFs::ListStreams(const filesystem::path& entry, const wchar_t* sep)
+{
+	vector<DirItem> items;
+	{
+		lock_guard<mutex> lock(m_mtx);
+		Node* node = Find(entry.native());
+		if (!node)
+			return;
+		wstring base = entry.native() + sep;
+		for (auto& st : node->streams)
+			items.push_back(DirItem{ DirItem::Stream, base + st.first, st.second->size() });
+	}
+	for (auto& it : items)
+		co_yield it;
+}
+
+DirItem MemoryFs::GetItem(const filesystem::path& path)
+{
+	lock_guard<mutex> lock(m_mtx);
+	wstring stream;
+	Node* node = Find(path.native(), &stream);
+	if (!node)
+		return DirItem{ DirItem::Invalid, path };
+	if (stream.empty())
+		return DirItem{ node->dir ? DirItem::Dir : DirItem::File, path, node->dir ? 0 : node->data->size(), node->attribs, node->last_write };
+	for (auto& st : node->streams)
+		if (Key(st.first) == Key(stream))
+			return DirItem{ DirItem::Stream, path, st.second->size() };
+	return DirItem{ DirItem::Invalid, path };
+}
+
+unique_ptr<IFsFile> MemoryFs::Open(const wchar_t* name, OpenMode mode)
+{
+	lock_guard<mutex> lock(m_mtx);
+	wstring stream;
+	Node* node = Find(name, &stream);
+	bool create = mode == Create || mode == CreateDirect;
+	if (!node && create)
+		node = Add(wstring_view(name).substr(0, StreamPos(name)), false); // as NTFS, file is created for its stream
+	if (!node) {
+		SetLastError(ERROR_FILE_NOT_FOUND);
+		return nullptr;
+	}
+	if (stream.empty()) {
+		if (node->dir) {
+			SetLastError(ERROR_ACCESS_DENIED);
+			return nullptr;
+		}
+		if (create) {
+			m_data_size -= node->data->size();
+			node->data = make_shared<Data>();
+		}
+		return make_unique<MemoryFile>(node->data, m_data_size);
+	}
+	wstring key = Key(stream);
+	for (auto& st : node->streams)
+		if (Key(st.first) == key) {
+			if (create) {
+				m_data_size -= st.second->size();
+				st.second = make_shared<Data>();
+			}
+			return make_unique<MemoryFile>(st.second, m_data_size);
+		}
+	if (!create) {
+		SetLastError(ERROR_FILE_NOT_FOUND);
+		return nullptr;
+	}
+	node->streams.emplace_back(stream, make_shared<Data>());
+	return make_unique<MemoryFile>(node->streams.back().second, m_data_size);
+}
+
+bool MemoryFs::SetLength(const wchar_t* name, ULONGLONG length)
+{
+	auto file = Open(name, Read);
+	if (!file)
+		return false;
+	lock_guard<mutex> lock(m_mtx);
+	wstring stream;
+	Node* node = Find(name, &stream);
+	shared_ptr<Data> data = node->data;
+	for (auto& st : node->streams)
+		if (!stream.empty() && Key(st.first) == Key(stream))
+			data = st.second;
+	m_data_size += length;
+	m_data_size -= data->size();
+	data->resize(length);
+	MarkHole(data->holes, length, ~0ULL, false);
+	return true;
+}
+
+bool MemoryFs::CreateDir(const filesystem::path& dir)
+{
+	lock_guard<mutex> lock(m_mtx);
+	wstring norm = Norm(dir.native());
+	for (size_t pos = 0; pos != wstring::npos; )
+	{
+		pos = norm.find(L'\\', pos + 1);
+		wstring_view part = wstring_view(norm).substr(0, pos);
+		Node* node = Find(part);
+		if (!node)
+			node = Add(part, true);
+		if (!node)
+			return false;
+		if (!node->dir) {
+			SetLastError(ERROR_ALREADY_EXISTS);
+			return false;
+		}
+	}
+	return true;
+}
+
+bool MemoryFs::SetAttribs(const wchar_t* name, DWORD attribs, const FILETIME& last_write)
+{
+	lock_guard<mutex> lock(m_mtx);
+	Node* node = Find(name);
+	if (!node) {
+		SetLastError(ERROR_FILE_NOT_FOUND);
+		return false;
+	}
+	node->attribs = attribs | (node->dir ? FILE_ATTRIBUTE_DIRECTORY : 0);
+	node->last_write = last_write;
+	return true;
+}
+
+bool MemoryFs::Delete(const wchar_t* name)
+{
+	lock_guard<mutex> lock(m_mtx);
+	wstring stream;
+	Node* node = Find(name, &stream);
+	if (!node) {
+		SetLastError(ERROR_FILE_NOT_FOUND);
+		return false;
+	}
+	if (!stream.empty()) {
+		wstring key = Key(stream);
+		auto it = find_if(node->streams.begin(), node->streams.end(), [&](auto& st) { return Key(st.first) == key; });
+		if (it == node->streams.end()) {
+			SetLastError(ERROR_FILE_NOT_FOUND);
+			return false;
+		}
+		m_data_size -= it->second->size();
+		node->streams.erase(it);
+		return true;
+	}
+	if (node->dir) { // as DeleteFile
+		SetLastError(ERROR_ACCESS_DENIED);
+		return false;
+	}
+	wstring key = Key(name);
+	size_t sep = key.rfind(L'\\');
+	Node* parent = Find(sep == wstring::npos ? L"" : wstring_view(key).substr(0, sep));
+	parent->children.erase(find(parent->children.begin(), parent->children.end(), node));
+	m_data_size -= node->data->size();
+	for (auto& st : node->streams)
+		m_data_size -= st.second->size();
+	m_nodes.erase(key);
+	return true;
+}
@@ -0,0 +1,146 @@
+/***********************************************************************
+
+  Copyright (c) 2019 Vsevolod Lukyanin
+  All rights reserved.
+
+  This file is a part of project ntfs_file_streams:
+  https://github.com/shtirlitz-dev/ntfs_file_streams
+
+  The tool that enables to list, create, copy, delete, show, write and
+  archive NTFS files streams.
+  About file streams:
+  https://docs.microsoft.com/en-us/windows/win32/fileio/file-streams
+
+***********************************************************************/
+
+#pragma once
+
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <map>
+#include <vector>
+#include "CommonFunc.h"
+#include "FileSimple.h"
+
+// Files, directories and streams as seen by tar, untar and listing commands.
+// NativeFs is Win32 (FindFirstFile, FindFirstStreamW, CreateFile), MemoryFs keeps
+// everything in memory: it measures the pipeline without disk.
+// Errors are returned as false/nullptr with GetLastError(), like in FileSimple.
+
+// Opened file or stream
+class IFsFile
+{
+public:
+	virtual ~IFsFile() {}
+	virtual DWORD Read(void* buffer, DWORD count) = 0;
+	virtual DWORD ReadAt(ULONGLONG offset, void* buffer, DWORD count) = 0; // can be called by several threads
+	virtual DWORD Write(const void* buffer, DWORD count) = 0;
+	virtual ULONGLONG GetLength() = 0;
+
+	// ranges with data in [0, length), the rest are holes of zeros (sparse files);
+	// by default all is data
+	struct Range
+	{
+		ULONGLONG offset;
+		ULONGLONG length;
+	};
+	virtual std::vector<Range> AllocatedRanges(ULONGLONG length);
+	// extends the file by count zeros after the data written: a hole, if the file
+	// can be sparse, by default zeros are written
+	virtual bool WriteHole(ULONGLONG count);
+};
+
+class IFsBackend
+{
+public:
+	enum OpenMode
+	{
+		Read,         // sequential read
+		ReadDirect,   // read bypassing file cache, by whole sectors to aligned buffers
+		Create,       // create or overwrite
+		CreateDirect, // create, write bypassing file cache, by whole sectors from aligned buffers
+	};
+
+	virtual ~IFsBackend() {}
+	virtual bool IsNative() const { return false; }
+	virtual std::filesystem::path CurrentDir() = 0;
+	// streams of the directory itself, then its directories and files (like get_files)
+	virtual std::experimental::generator<DirItem> ListDir(std::filesystem::path dir) = 0;
+	// streams of a file or directory, names are entry + sep + ":name" (like get_streams)
+	virtual std::experimental::generator<DirItem> ListStreams(const std::filesystem::path& entry, const wchar_t* sep) = 0;
+	// directory, file or stream, type is Invalid if it does not exist
+	virtual DirItem GetItem(const std::filesystem::path& path) = 0;
+	virtual std::unique_ptr<IFsFile> Open(const wchar_t* name, OpenMode mode) = 0;
+	virtual bool SetLength(const wchar_t* name, ULONGLONG length) = 0; // for tail of unbuffered files
+	virtual bool CreateDir(const std::filesystem::path& dir) = 0;     // with all parents
+	virtual bool SetAttribs(const wchar_t* name, DWORD attribs, const FILETIME& last_write) = 0;
+	virtual bool Delete(const wchar_t* name) = 0; // file or stream
+
+	// items given in command line: "." is the current directory, others as GetItem
+	std::experimental::generator<DirItem> ListItems(const std::vector<std::filesystem::path>& items);
+};
+
+IFsBackend& Fs();          // backend in use, NativeFs by default
+void SetFs(IFsBackend* fs); // nullptr - NativeFs
+
+class NativeFs : public IFsBackend
+{
+public:
+	virtual bool IsNative() const override { return true; }
+	virtual std::filesystem::path CurrentDir() override;
+	virtual std::experimental::generator<DirItem> ListDir(std::filesystem::path dir) override;
+	virtual std::experimental::generator<DirItem> ListStreams(const std::filesystem::path& entry, const wchar_t* sep) override;
+	virtual DirItem GetItem(const std::filesystem::path& path) override;
+	virtual std::unique_ptr<IFsFile> Open(const wchar_t* name, OpenMode mode) override;
+	virtual bool SetLength(const wchar_t* name, ULONGLONG length) override;
+	virtual bool CreateDir(const std::filesystem::path& dir) override;
+	virtual bool SetAttribs(const wchar_t* name, DWORD attribs, const FILETIME& last_write) override;
+	virtual bool Delete(const wchar_t* name) override;
+};
+
+// Names are case-insensitive, "\\" and "/" are the same, the root is "" (relative names).
+// Streams are "file:name" and "dir:name" (or "dir\\:name"), like on NTFS.
+class MemoryFs : public IFsBackend
+{
+public:
+	MemoryFs();
+	virtual std::filesystem::path CurrentDir() override { return std::filesystem::path(); }
+	virtual std::experimental::generator<DirItem> ListDir(std::filesystem::path dir) override;
+	virtual std::experimental::generator<DirItem> ListStreams(const std::filesystem::path& entry, const wchar_t* sep) override;
+	virtual DirItem GetItem(const std::filesystem::path& path) override;
+	virtual std::unique_ptr<IFsFile> Open(const wchar_t* name, OpenMode mode) override;
+	virtual bool SetLength(const wchar_t* name, ULONGLONG length) override;
+	virtual bool CreateDir(const std::filesystem::path& dir) override;
+	virtual bool SetAttribs(const wchar_t* name, DWORD attribs, const FILETIME& last_write) override;
+	virtual bool Delete(const wchar_t* name) override;
+
+	ULONGLONG DataSize() const { return m_data_size; } // all files and streams
+
+	// bytes of a file or a stream; holes are zeros in the bytes, they are kept
+	// to be reported as not allocated, like holes of sparse files on NTFS
+	struct Data : public std::vector<uint8_t>
+	{
+		std::vector<IFsFile::Range> holes; // by offset, not adjacent
+	};
+protected:
+	struct Node
+	{
+		std::wstring name; // as given at creation, without directory
+		bool dir = false;
+		DWORD attribs = FILE_ATTRIBUTE_ARCHIVE;
+		FILETIME last_write = {};
+		std::shared_ptr<Data> data = std::make_shared<Data>();
+		std::vector<std::pair<std::wstring, std::shared_ptr<Data>>> streams; // ":name", data
+		std::vector<Node*> children;
+	};
+	static std::wstring Norm(std::wstring_view path); // "\\" only, without ".", ".." and trailing "\\"
+	static std::wstring Key(std::wstring_view path);   // Norm folded (fold_name)
+	// splits "file:stream" to node and stream name (empty for the main data)
+	Node* Find(std::wstring_view path, std::wstring* stream_name = nullptr);
+	Node* Add(std::wstring_view path, bool dir); // parent must exist
+
+	std::mutex m_mtx;
+	std::map<std::wstring, Node> m_nodes; // by Key
+	std::atomic<ULONGLONG> m_data_size{ 0 };
+};
@@ -0,0 +1,449 @@
+/***********************************************************************
+
+  Copyright (c) 2019 Vsevolod Lukyanin
+  All rights reserved.
+
+  This file is a part of project ntfs_file_streams:
+  https://github.com/shtirlitz-dev/ntfs_file_streams
+
+  The tool that enables to list, create, copy, delete, show, write and
+  archive NTFS files streams.
+  About file streams:
+  https://docs.microsoft.com/en-us/windows/win32/fileio/file-streams
+
+***********************************************************************/
+
+#include "pch.h"
+
+#include "Inventory.h"
+#include "ntfs_streams.h"
+#include "CommonFunc.h"
+#include "FsBackend.h"
+#include "FileSimple.h"
+#include "MaskSet.h"
+#include <tchar.h>
+#include <iostream>
+#include <iomanip>
+#include <unordered_map>
+#include <chrono>
+
+using namespace std;
+using namespace std::chrono;
+
+// Inventory of streams of a tree, kept in a file and read through file mapping.
+// The file is: Header, directories, files (of every directory together, sorted
+// by name), streams (of every file together) and one pool of names.
+// Refresh lists all directories again (it is cheap), but enumerates streams
+// (it opens the file) only for files that are new, changed (time or size)
+// or in a changed directory; streams of other files are taken from the old inventory.
+
+namespace
+{
+	const char Magic[8] = { 'S', 'T', 'R', 'M', 'I', 'N', 'V', '1' };
+
+	struct Header
+	{
+		char magic[8];
+		ULONGLONG file_size;
+		ULONGLONG dirs, files, streams, chars;
+		ULONGLONG dirs_offset, files_offset, streams_offset, chars_offset;
+		FILETIME built;
+		ULONGLONG root;   // in the pool of names
+		DWORD root_len;
+		DWORD reserved;
+	};
+
+	struct DirRec
+	{
+		ULONGLONG path;   // relative to the root, "" for the root
+		DWORD path_len;
+		DWORD attribs;
+		FILETIME last_write;
+		ULONGLONG first_file;
+		ULONGLONG files;
+	};
+
+	struct FileRec
+	{
+		ULONGLONG name;   // "" - streams of the directory itself
+		DWORD name_len;
+		DWORD attribs;
+		ULONGLONG size;
+		FILETIME last_write;
+		ULONGLONG dir;
+		ULONGLONG first_stream;
+		ULONGLONG streams;
+	};
+
+	struct StreamRec
+	{
+		ULONGLONG name;   // without ':'
+		DWORD name_len;
+		DWORD reserved;
+		ULONGLONG size;
+		ULONGLONG file;
+	};
+
+	int ShowHelpInventory(filesystem::path filename)
+	{
+		ShowCopyright();
+		wcout << L"\ncommand line arguments for '" << filename.c_str() << L" inventory':\n\n";
+		wcout << L"inventory <db> /r [<dir>]  - create or refresh inventory of streams of <dir>\n";
+		wcout << L"inventory <db> [options]   - show streams from the inventory\n";
+		wcout << L"where <db> is the inventory file, <dir> is needed when it is created\n";
+		wcout << L"options:\n";
+		wcout << L"  /n:mask1;mask2 - stream names, e.g. Zone.Identifier or *.txt\n";
+		wcout << L"  /s:min-max     - range of stream sizes, suffixes K, M, G, e.g. /s:1M- or /s:0-4K\n";
+		wcout << L"  /p:prefix      - path prefix relative to the root, e.g. Users\\john\n";
+		return 0;
+	}
+
+	bool operator==(const FILETIME& a, const FILETIME& b)
+	{
+		return a.dwLowDateTime == b.dwLowDateTime && a.dwHighDateTime == b.dwHighDateTime;
+	}
+
+	// read-only view of an inventory file
+	class MappedInventory
+	{
+	public:
+		~MappedInventory() { Close(); }
+		// false if there is no file, throws if it is not an inventory
+		bool Open(const wstring& name)
+		{
+			if (!file.Open(name.c_str(), false, false))
+			{
+				DWORD err = GetLastError();
+				if (err == ERROR_FILE_NOT_FOUND)
+					return false;
+				throw MyException{ L"Failed to open '<path>': <err>", name, err };
+			}
+			ULONGLONG size = file.GetLength();
+			if (size >= sizeof(Header))
+				mapping = CreateFileMapping(file.Handle(), nullptr, PAGE_READONLY, 0, 0, nullptr);
+			if (mapping)
+				view = (const BYTE*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			hdr = (const Header*)view;
+			if (!hdr || memcmp(hdr->magic, Magic, sizeof(Magic)) != 0 || hdr->file_size != size
+				|| !Fits(hdr->dirs_offset, hdr->dirs, sizeof(DirRec), size) || !Fits(hdr->files_offset, hdr->files, sizeof(FileRec), size)
+				|| !Fits(hdr->streams_offset, hdr->streams, sizeof(StreamRec), size) || !Fits(hdr->chars_offset, hdr->chars, sizeof(wchar_t), size))
+				throw MyException{ L"Invalid inventory file '<path>'", name, ERROR_FILE_CORRUPT };
+			dirs = (const DirRec*)(view + hdr->dirs_offset);
+			files = (const FileRec*)(view + hdr->files_offset);
+			streams = (const StreamRec*)(view + hdr->streams_offset);
+			chars = (const wchar_t*)(view + hdr->chars_offset);
+			return true;
+		}
+		void Close()
+		{
+			if (view)
+				UnmapViewOfFile(view);
+			if (mapping)
+				CloseHandle(mapping);
+			file.Close();
+			view = nullptr;
+			mapping = nullptr;
+			hdr = nullptr;
+		}
+		bool IsOpen() const { return hdr != nullptr; }
+		wstring_view Str(ULONGLONG offset, DWORD len) const
+		{
+			return offset + len <= hdr->chars ? wstring_view(chars + offset, len) : wstring_view();
+		}
+		wstring_view Root() const { return Str(hdr->root, hdr->root_len); }
+
+		const Header* hdr = nullptr;
+		const DirRec* dirs = nullptr;
+		const FileRec* files = nullptr;
+		const StreamRec* streams = nullptr;
+		const wchar_t* chars = nullptr;
+
+	protected:
+		static bool Fits(ULONGLONG offset, ULONGLONG count, size_t rec, ULONGLONG size)
+		{
+			return offset <= size && count <= (size - offset) / rec;
+		}
+
+		FileSimple file;
+		HANDLE mapping = nullptr;
+		const BYTE* view = nullptr;
+	};
+
+	class Builder
+	{
+	public:
+		Builder(const MappedInventory& old, wstring root)
+			: old(old), root(move(root))
+		{
+			if (old.IsOpen())
+				for (ULONGLONG d = 0; d < old.hdr->dirs; ++d)
+					old_dirs[fold_name(old.Str(old.dirs[d].path, old.dirs[d].path_len))] = d;
+		}
+
+		void Run()
+		{
+			DirItem info = Fs().GetItem(root);
+			if (info.type != DirItem::Dir)
+				throw MyException{ L"Directory not found: '<path>'", root, ERROR_PATH_NOT_FOUND };
+			AddDir(L"", info);
+		}
+
+		void Write(const wstring& name)
+		{
+			Header hdr = {};
+			memcpy(hdr.magic, Magic, sizeof(Magic));
+			hdr.root = AddName(root);
+			hdr.root_len = (DWORD)root.size();
+			hdr.dirs = dirs.size();
+			hdr.files = files.size();
+			hdr.streams = streams.size();
+			hdr.chars = chars.size();
+			hdr.dirs_offset = sizeof(Header);
+			hdr.files_offset = hdr.dirs_offset + dirs.size() * sizeof(DirRec);
+			hdr.streams_offset = hdr.files_offset + files.size() * sizeof(FileRec);
+			hdr.chars_offset = hdr.streams_offset + streams.size() * sizeof(StreamRec);
+			hdr.file_size = hdr.chars_offset + chars.size() * sizeof(wchar_t);
+			GetSystemTimeAsFileTime(&hdr.built);
+
+			FileSimple fs(name.c_str(), true);
+			if (!fs.IsOpen())
+				throw MyException{ L"Failed to create '<path>': <err>", name, GetLastError() };
+			auto write = [&](const void* data, size_t size) {
+				for (const BYTE* p = (const BYTE*)data; size; ) {
+					DWORD part = (DWORD)min<size_t>(size, 1 << 30);
+					if (fs.Write(p, part) != part)
+						throw MyException{ L"Failed to write '<path>': <err>", name, GetLastError() };
+					p += part;
+					size -= part;
+				}
+			};
+			write(&hdr, sizeof(hdr));
+			write(dirs.data(), dirs.size() * sizeof(DirRec));
+			write(files.data(), files.size() * sizeof(FileRec));
+			write(streams.data(), streams.size() * sizeof(StreamRec));
+			write(chars.data(), chars.size() * sizeof(wchar_t));
+		}
+
+		ULONGLONG Dirs() const { return dirs.size(); }
+		ULONGLONG Files() const { return files.size(); }
+		ULONGLONG Streams() const { return streams.size(); }
+		ULONGLONG rescanned = 0; // files whose streams were enumerated
+		ULONGLONG reused = 0;    // files whose streams were taken from the old inventory
+
+	protected:
+		ULONGLONG AddName(wstring_view name)
+		{
+			ULONGLONG offset = chars.size();
+			chars.append(name);
+			return offset;
+		}
+
+		void AddStream(wstring_view name, ULONGLONG size)
+		{
+			streams.push_back(StreamRec{ AddName(name), (DWORD)name.size(), 0, size, files.size() - 1 });
+			++files.back().streams;
+		}
+
+		void AddFile(ULONGLONG dir, wstring_view name, const DirItem& item)
+		{
+			files.push_back(FileRec{ AddName(name), (DWORD)name.size(), item.dwFileAttributes, item.size, item.ftLastWriteTime, dir, streams.size(), 0 });
+		}
+
+		// file with the same name in the old inventory
+		const FileRec* FindOld(ULONGLONG old_dir, wstring_view name)
+		{
+			const DirRec& d = old.dirs[old_dir];
+			if (d.first_file > old.hdr->files || d.files > old.hdr->files - d.first_file)
+				return nullptr;
+			const FileRec* begin = old.files + d.first_file;
+			const FileRec* end = begin + d.files;
+			auto it = lower_bound(begin, end, name, [&](const FileRec& f, wstring_view n) {
+				return CompareNoCase(old.Str(f.name, f.name_len), n) < 0;
+			});
+			if (it == end || CompareNoCase(old.Str(it->name, it->name_len), name) != 0)
+				return nullptr;
+			return &*it;
+		}
+
+		void AddDir(const wstring& rel, const DirItem& info)
+		{
+			ULONGLONG d = dirs.size();
+			dirs.push_back(DirRec{ AddName(rel), (DWORD)rel.size(), info.dwFileAttributes, info.ftLastWriteTime, files.size(), 0 });
+
+			// entries added, deleted or renamed - the directory time is changed
+			auto it_old = old_dirs.find(fold_name(rel));
+			ULONGLONG old_dir = it_old != old_dirs.end() && old.dirs[it_old->second].last_write == info.ftLastWriteTime
+				? it_old->second : ~0ULL;
+
+			filesystem::path path = rel.empty() ? filesystem::path(root) : filesystem::path(root) / rel;
+			vector<DirItem> subdirs, entries;
+			for (auto& item : Fs().ListDir(path))
+			{
+				if (item.type == DirItem::Stream) // of the directory itself
+				{
+					if (files.size() == dirs[d].first_file)
+						AddFile(d, L"", info);
+					wstring_view name = item.name.native();
+					AddStream(name.substr(name.rfind(L':') + 1), item.size);
+				}
+				else if (item.type == DirItem::Dir)
+					subdirs.push_back(item);
+				else if (item.type == DirItem::File)
+					entries.push_back(item);
+			}
+			sort(entries.begin(), entries.end(), [](const DirItem& a, const DirItem& b) {
+				return CompareNoCase(filename_of(a.name), filename_of(b.name)) < 0;
+			});
+			for (auto& item : entries)
+			{
+				wstring_view name = filename_of(item.name);
+				AddFile(d, name, item);
+				const FileRec* prev = old_dir != ~0ULL ? FindOld(old_dir, name) : nullptr;
+				if (prev && prev->size == item.size && prev->last_write == item.ftLastWriteTime
+					&& prev->first_stream <= old.hdr->streams && prev->streams <= old.hdr->streams - prev->first_stream)
+				{
+					for (ULONGLONG s = prev->first_stream; s < prev->first_stream + prev->streams; ++s)
+						AddStream(old.Str(old.streams[s].name, old.streams[s].name_len), old.streams[s].size);
+					++reused;
+					continue;
+				}
+				for (auto& stream : Fs().ListStreams(item.name, L""))
+				{
+					wstring_view sname = stream.name.native();
+					AddStream(sname.substr(sname.rfind(L':') + 1), stream.size);
+				}
+				++rescanned;
+			}
+			dirs[d].files = files.size() - dirs[d].first_file;
+
+			for (auto& item : subdirs)
+			{
+				wstring sub = rel.empty() ? wstring(filename_of(item.name)) : rel + L"\\" + filename_of(item.name);
+				AddDir(sub, item);
+			}
+		}
+
+		const MappedInventory& old;
+		unordered_map<wstring, ULONGLONG> old_dirs; // upper-case path - index
+		wstring root;
+		vector<DirRec> dirs;
+		vector<FileRec> files;
+		vector<StreamRec> streams;
+		wstring chars;
+	};
+
+	int Refresh(const wstring& db, const wchar_t* dir)
+	{
+		auto begin_time = high_resolution_clock::now();
+		MappedInventory old;
+		old.Open(db);
+		wstring root;
+		if (dir)
+			root = Fs().IsNative() ? filesystem::absolute(dir).native() : wstring(dir);
+		else if (old.IsOpen())
+			root = old.Root();
+		else
+			throw invalid_argument("Specify directory");
+		if (old.IsOpen() && CompareNoCase(root, old.Root()) != 0)
+			old.Close(); // other tree: all anew
+
+		Builder builder(old, root);
+		builder.Run();
+		wstring tmp = db + L".tmp";
+		builder.Write(tmp);
+		old.Close();
+		if (!MoveFileEx(tmp.c_str(), db.c_str(), MOVEFILE_REPLACE_EXISTING))
+			throw MyException{ L"Failed to replace '<path>': <err>", db, GetLastError() };
+
+		duration<double> time_span = high_resolution_clock::now() - begin_time;
+		wcout << root << L": " << builder.Dirs() << L" directories, " << builder.Files() << L" files, "
+			<< builder.Streams() << L" streams; streams enumerated for " << builder.rescanned << L" files, kept for "
+			<< builder.reused << L" (" << time_span.count() << L" sec)" << endl;
+		return 0;
+	}
+
+	int Query(const wstring& db, const MaskSet& masks, ULONGLONG min_size, ULONGLONG max_size, wstring_view prefix)
+	{
+		auto begin_time = high_resolution_clock::now();
+		MappedInventory inv;
+		if (!inv.Open(db))
+			throw MyException{ L"Failed to open '<path>': <err>", db, ERROR_FILE_NOT_FOUND };
+
+		// directories under the prefix
+		vector<bool> dir_match(inv.hdr->dirs, prefix.empty());
+		if (!prefix.empty())
+			for (ULONGLONG d = 0; d < inv.hdr->dirs; ++d)
+			{
+				wstring_view path = inv.Str(inv.dirs[d].path, inv.dirs[d].path_len);
+				dir_match[d] = path.size() >= prefix.size() && CompareNoCase(path.substr(0, prefix.size()), prefix) == 0
+					&& (path.size() == prefix.size() || path[prefix.size()] == L'\\');
+			}
+
+		wstring root(inv.Root());
+		wstring name, full;
+		ULONGLONG count = 0, bytes = 0;
+		for (ULONGLONG s = 0; s < inv.hdr->streams; ++s)
+		{
+			const StreamRec& sr = inv.streams[s];
+			if (sr.size < min_size || sr.size > max_size || sr.file >= inv.hdr->files)
+				continue;
+			const FileRec& fr = inv.files[sr.file];
+			if (fr.dir >= inv.hdr->dirs || !dir_match[fr.dir])
+				continue;
+			name = inv.Str(sr.name, sr.name_len);
+			if (!masks.empty() && !masks.Match(name))
+				continue;
+			const DirRec& dr = inv.dirs[fr.dir];
+			full = root;
+			if (dr.path_len)
+				full.append(L"\\").append(inv.Str(dr.path, dr.path_len));
+			full.append(L"\\").append(inv.Str(fr.name, fr.name_len)).append(L":").append(name);
+			wcout << setw(15) << FileSizeStr(sr.size) << L" " << full << L"\n";
+			++count;
+			bytes += sr.size;
+		}
+		duration<double> time_span = high_resolution_clock::now() - begin_time;
+		wcout << count << L" streams, " << FileSizeStr(bytes) << L" bytes (" << time_span.count() * 1000 << L" ms)" << endl;
+		return 0;
+	}
+}
+
+int Inventory(int argc, TCHAR **argv)
+{
+	if (argc < 3 || _tcscmp(argv[2], L"/?") == 0)
+		return ShowHelpInventory(filesystem::path(argv[0]).filename());
+
+	wstring db;
+	const wchar_t* dir = nullptr;
+	bool refresh = false;
+	vector<wstring> masks;
+	ULONGLONG min_size = 0, max_size = ~0ULL;
+	wstring prefix;
+	for (int n = 2; n < argc; ++n)
+	{
+		wstring_view param(argv[n]);
+		if (param == L"/r")
+			refresh = true;
+		else if (param.substr(0, 3) == L"/n:")
+			masks = split(param.substr(3), L';');
+		else if (param.substr(0, 3) == L"/s:")
+			ReadRange(param.substr(3), min_size, max_size, false);
+		else if (param.substr(0, 3) == L"/p:")
+			prefix = RemoveAtEnd(param.substr(3), L"\\");
+		else if (param.substr(0, 1) == L"/")
+			throw invalid_argument("unrecognized option");
+		else if (db.empty())
+			db = param;
+		else if (!dir)
+			dir = argv[n];
+		else
+			throw invalid_argument("too many parameters");
+	}
+	if (db.empty())
+		throw invalid_argument("Specify inventory file");
+	if (refresh)
+		return Refresh(db, dir);
+	if (dir)
+		throw invalid_argument("Directory is needed only with /r");
+	return Query(db, MaskSet(masks), min_size, max_size, prefix);
+}
@@ -0,0 +1,219 @@
+/***********************************************************************
+
+  Copyright (c) 2019 Vsevolod Lukyanin
+  All rights reserved.
+
+  This file is a part of project ntfs_file_streams:
+  https://github.com/shtirlitz-dev/ntfs_file_streams
+
+  The tool that enables to list, create, copy, delete, show, write and
+  archive NTFS files streams.
+  About file streams:
+  https://docs.microsoft.com/en-us/windows/win32/fileio/file-streams
+
+***********************************************************************/
+
+#include "pch.h"
+#include "MaskSet.h"
+#include "CommonFunc.h"
+#include <algorithm>
+
+using namespace std;
+
+namespace
+{
+	bool is_sep(wchar_t ch)
+	{
+		return ch == L'\\' || ch == L'/';
+	}
+
+	// "**\" may match no directories, "\**" at the end - the directory itself
+	void Expand(const wstring& mask, size_t from, vector<wstring>& out)
+	{
+		size_t pos = mask.find(L"**\\", from);
+		while (pos != wstring::npos && pos > 0 && mask[pos - 1] != L'\\')
+			pos = mask.find(L"**\\", pos + 1);
+		if (pos == wstring::npos) {
+			out.push_back(mask);
+			if (mask.size() > 3 && mask.compare(mask.size() - 3, 3, L"\\**") == 0)
+				out.push_back(mask.substr(0, mask.size() - 3));
+			return;
+		}
+		Expand(mask, pos + 3, out);
+		Expand(mask.substr(0, pos) + mask.substr(pos + 3), pos, out);
+	}
+
+	const size_t MaxLiteral = 260; // longer names are not folded for hash sets
+}
+
+MaskSet::MaskSet(const vector<wstring>& masks)
+{
+	m_ascii[L'\\'] = m_ascii[L'/'] = 1;
+	for (auto& mask : masks)
+	{
+		if (mask.empty())
+			continue;
+		++m_count;
+		if (find_if(mask.begin(), mask.end(), is_sep) == mask.end()) {
+			Add(mask, false);
+			continue;
+		}
+		wstring norm = mask;
+		replace(norm.begin(), norm.end(), L'/', L'\\');
+		while (norm.size() > 1 && norm.back() == L'\\') // "dir\" is "dir"
+			norm.pop_back();
+		norm.erase(0, min(norm.find_first_not_of(L'\\'), norm.size() - 1)); // "\dir" - only at the top
+		vector<wstring> variants;
+		Expand(norm, 0, variants);
+		for (auto& it : variants)
+			Add(it, true);
+	}
+	Compile(m_name, m_name_patterns);
+	Compile(m_path, m_path_patterns);
+}
+
+void MaskSet::Add(wstring_view mask, bool path)
+{
+	wstring folded;
+	for (wchar_t ch : mask)
+		folded += fold_char(ch);
+	if (!path && folded.size() <= MaxLiteral) {
+		if (folded.find_first_of(L"*?") == wstring::npos) {
+			m_names.insert(folded);
+			return;
+		}
+		if (folded.size() > 2 && folded[0] == L'*' && folded[1] == L'.' && folded.find_first_of(L"*?.", 2) == wstring::npos) {
+			m_exts.insert(folded.substr(1));
+			return;
+		}
+	}
+	Pattern p;
+	p.loops += NoLoop;
+	for (size_t i = 0; i < folded.size(); ++i)
+	{
+		wchar_t ch = folded[i];
+		if (ch != L'*') {
+			p.chars += ch;
+			p.loops += NoLoop;
+			if (ch == L'?' || ch == L'\\')
+				continue;
+			if (Class(ch))
+				continue;
+			if ((size_t)ch < 128)
+				m_ascii[(size_t)ch] = m_classes++;
+			else
+				m_other.insert(lower_bound(m_other.begin(), m_other.end(), make_pair(ch, (uint16_t)0)), make_pair(ch, m_classes++));
+			continue;
+		}
+		size_t stars = 1;
+		while (i + 1 < folded.size() && folded[i + 1] == L'*')
+			++stars, ++i;
+		Loop loop = path && stars == 1 ? NameLoop : AnyLoop;
+		p.loops.back() = max(p.loops.back(), (char)loop);
+	}
+	(path ? m_path_patterns : m_name_patterns).push_back(move(p));
+}
+
+uint16_t MaskSet::Class(wchar_t folded) const
+{
+	if ((size_t)folded < 128)
+		return m_ascii[(size_t)folded];
+	auto it = lower_bound(m_other.begin(), m_other.end(), folded, [](auto& a, wchar_t ch) { return a.first < ch; });
+	return it != m_other.end() && it->first == folded ? it->second : 0;
+}
+
+void MaskSet::Compile(Automaton& a, const vector<Pattern>& patterns)
+{
+	size_t states = 0;
+	for (auto& p : patterns)
+		states += p.chars.size() + 1;
+	if (!states)
+		return;
+	a.words = (states + 63) / 64;
+	a.start = a.final = a.loop_any = a.loop_name = Bits(a.words);
+	a.accept.assign(m_classes, Bits(a.words));
+	auto set = [](Bits& bits, size_t bit) { bits[bit / 64] |= 1ULL << (bit % 64); };
+	size_t base = 0;
+	for (auto& p : patterns)
+	{
+		set(a.start, base);
+		set(a.final, base + p.chars.size());
+		for (size_t s = 0; s < p.loops.size(); ++s)
+			if (p.loops[s] == AnyLoop)
+				set(a.loop_any, base + s);
+			else if (p.loops[s] == NameLoop)
+				set(a.loop_name, base + s);
+		for (size_t i = 0; i < p.chars.size(); ++i)
+		{
+			size_t state = base + i + 1;
+			wchar_t ch = p.chars[i];
+			if (ch == L'\\')
+				set(a.accept[1], state);
+			else if (ch != L'?')
+				set(a.accept[Class(ch)], state);
+			else
+				for (size_t cls = 0; cls < m_classes; ++cls)
+					if (cls != 1)
+						set(a.accept[cls], state);
+		}
+		base += p.chars.size() + 1;
+	}
+}
+
+bool MaskSet::Run(const Automaton& a, wstring_view str) const
+{
+	// Shift-And: bit of a state moves to the next state if the char is accepted by it,
+	// and stays where '*' is
+	uint64_t local[16];
+	vector<uint64_t> big;
+	uint64_t* d = local;
+	if (a.words > size(local))
+		d = (big = a.start).data();
+	else
+		copy(a.start.begin(), a.start.end(), d);
+	for (wchar_t ch : str)
+	{
+		uint16_t cls = Class(fold_char(ch));
+		const uint64_t* accept = a.accept[cls].data();
+		uint64_t carry = 0, alive = 0;
+		for (size_t w = 0; w < a.words; ++w)
+		{
+			uint64_t cur = d[w];
+			uint64_t loops = a.loop_any[w] | (cls == 1 ? 0 : a.loop_name[w]);
+			d[w] = (((cur << 1) | carry) & accept[w]) | (cur & loops);
+			carry = cur >> 63;
+			alive |= d[w];
+		}
+		if (!alive)
+			return false;
+	}
+	for (size_t w = 0; w < a.words; ++w)
+		if (d[w] & a.final[w])
+			return true;
+	return false;
+}
+
+bool MaskSet::Match(wstring_view path) const
+{
+	if (!m_count)
+		return false;
+	size_t sep = path.find_last_of(L"\\/");
+	wstring_view name = sep == wstring_view::npos ? path : path.substr(sep + 1);
+	if ((!m_names.empty() || !m_exts.empty()) && name.size() <= MaxLiteral)
+	{
+		thread_local wstring key; // keeps its buffer between calls
+		key.resize(name.size());
+		for (size_t i = 0; i < name.size(); ++i)
+			key[i] = fold_char(name[i]);
+		if (m_names.count(key))
+			return true;
+		if (size_t dot = key.rfind(L'.'); dot != wstring::npos && !m_exts.empty()) {
+			key.erase(0, dot);
+			if (m_exts.count(key))
+				return true;
+		}
+	}
+	if (m_name.words && Run(m_name, name))
+		return true;
+	return m_path.words && Run(m_path, path);
+}
@@ -0,0 +1,70 @@
+/***********************************************************************
+
+  Copyright (c) 2019 Vsevolod Lukyanin
+  All rights reserved.
+
+  This file is a part of project ntfs_file_streams:
+  https://github.com/shtirlitz-dev/ntfs_file_streams
+
+  The tool that enables to list, create, copy, delete, show, write and
+  archive NTFS files streams.
+  About file streams:
+  https://docs.microsoft.com/en-us/windows/win32/fileio/file-streams
+
+***********************************************************************/
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+
+// List of masks (as /e:mask1;mask2) compiled once: Match is linear in the length
+// of the name, whatever the number of masks, and can be called by several threads.
+// Masks without '\' or '/' are matched against the last component of the path:
+// '*' - any chars, '?' - one char, case-insensitive.
+// Masks with '\' or '/' are matched against the whole (relative) path: '*' and '?'
+// do not cross separators, '**' does; "**\" may match nothing, "dir\**" matches
+// "dir" itself too, so the whole subtree is excluded with the directory.
+// Literal names (thumbs.db) and extensions (*.obj) are looked up in hash sets,
+// the rest are simulated together by one bit-parallel automaton.
+class MaskSet
+{
+public:
+	MaskSet() = default;
+	explicit MaskSet(const std::vector<std::wstring>& masks);
+	bool empty() const { return m_count == 0; }
+	bool Match(std::wstring_view path) const;
+
+protected:
+	typedef std::vector<uint64_t> Bits;
+	enum Loop : char { NoLoop, NameLoop, AnyLoop }; // NameLoop: '*' of path masks, not over separators
+	struct Pattern
+	{
+		std::wstring chars; // folded; '?' - any char, '\\' - separator ('\\' or '/')
+		std::string loops;  // Loop before every char and at the end
+	};
+	// states of all patterns are bits: pattern of n chars has n + 1 states
+	struct Automaton
+	{
+		size_t words = 0;
+		Bits start, final;
+		Bits loop_any, loop_name;
+		std::vector<Bits> accept; // by class of char: states entered by it
+	};
+
+	void Add(std::wstring_view mask, bool path);
+	void Compile(Automaton& a, const std::vector<Pattern>& patterns);
+	uint16_t Class(wchar_t folded) const;
+	bool Run(const Automaton& a, std::wstring_view str) const;
+
+	size_t m_count = 0;
+	std::unordered_set<std::wstring> m_names; // folded whole names
+	std::unordered_set<std::wstring> m_exts;  // folded ".ext" of "*.ext"
+	std::vector<Pattern> m_name_patterns, m_path_patterns;
+	Automaton m_name, m_path;
+	uint16_t m_ascii[128] = {};                        // class of ASCII chars: 0 - other, 1 - separator
+	std::vector<std::pair<wchar_t, uint16_t>> m_other; // class of other chars, sorted
+	uint16_t m_classes = 2;
+};
@@ -0,0 +1,493 @@
+/***********************************************************************
+
+  Copyright (c) 2019 Vsevolod Lukyanin
+  All rights reserved.
+
+  This file is a part of project ntfs_file_streams:
+  https://github.com/shtirlitz-dev/ntfs_file_streams
+
+  The tool that enables to list, create, copy, delete, show, write and
+  archive NTFS files streams.
+  About file streams:
+  https://docs.microsoft.com/en-us/windows/win32/fileio/file-streams
+
+***********************************************************************/
+
+#include "pch.h"
+#include "NtfsImage.h"
+#include "ntfs_streams.h"
+#include <cstring>
+
+using namespace std;
+
+// Layout of the structures: "NTFS Documentation" by R. Russon and Y. Fledel (linux-ntfs project).
+// All numbers are little-endian.
+
+namespace
+{
+	const ULONGLONG RootRecord = 5;       // "."
+	const ULONGLONG FirstUserRecord = 24; // 0..23 are metafiles and reserved
+	const size_t MftChunk = 4 << 20;      // sequential reads of $MFT
+	const ULONGLONG UsaStride = 512;      // update sequence covers every 512 bytes, whatever the sector size
+
+	const DWORD AttrStandardInfo = 0x10;
+	const DWORD AttrFileName = 0x30;
+	const DWORD AttrData = 0x80;
+	const DWORD AttrEnd = 0xFFFFFFFF;
+
+	const WORD RecordInUse = 0x0001;
+	const WORD RecordDirectory = 0x0002;
+
+	const WORD DataCompressed = 0x00FF;
+	const WORD DataEncrypted = 0x4000;
+
+	const BYTE NameSpaceDos = 2;
+
+	template <class T> T Get(const uint8_t* p, size_t offset)
+	{
+		T val;
+		memcpy(&val, p + offset, sizeof(T));
+		return val;
+	}
+
+	wstring GetName(const uint8_t* p, size_t chars) // UTF-16LE
+	{
+		wstring name(chars, L'\0');
+		for (size_t i = 0; i < chars; ++i)
+			name[i] = Get<uint16_t>(p, i * 2);
+		return name;
+	}
+
+	// data runs of a non-resident attribute: header byte, length, offset from the previous run
+	bool DecodeRuns(const uint8_t* p, const uint8_t* end, ULONGLONG vcn, vector<NtfsImage::Run>& runs)
+	{
+		LONGLONG lcn = 0;
+		while (p < end && *p)
+		{
+			int len_size = *p & 0x0F, off_size = *p >> 4;
+			if (len_size == 0 || len_size > 8 || off_size > 8 || p + 1 + len_size + off_size > end)
+				return false;
+			++p;
+			ULONGLONG clusters = 0;
+			for (int i = 0; i < len_size; ++i)
+				clusters |= (ULONGLONG)p[i] << (i * 8);
+			p += len_size;
+			if (off_size == 0)
+				runs.push_back({ vcn, NtfsImage::Sparse, clusters });
+			else
+			{
+				LONGLONG delta = 0;
+				for (int i = 0; i < off_size; ++i)
+					delta |= (LONGLONG)p[i] << (i * 8);
+				if (p[off_size - 1] & 0x80 && off_size < 8) // negative
+					delta |= -1LL << (off_size * 8);
+				lcn += delta;
+				runs.push_back({ vcn, (ULONGLONG)lcn, clusters });
+			}
+			p += off_size;
+			vcn += clusters;
+		}
+		return true;
+	}
+
+	class ImageFile : public IFsFile
+	{
+	public:
+		ImageFile(NtfsImage& image, const NtfsImage::Data& data)
+			: image(image), data(data)
+		{
+		}
+		virtual DWORD Read(void* buffer, DWORD count) override
+		{
+			DWORD done = ReadAt(pos, buffer, count);
+			pos += done;
+			return done;
+		}
+		virtual DWORD ReadAt(ULONGLONG offset, void* buffer, DWORD count) override
+		{
+			return image.ReadData(data, offset, buffer, count);
+		}
+		virtual DWORD Write(const void*, DWORD) override
+		{
+			SetLastError(ERROR_ACCESS_DENIED);
+			return 0;
+		}
+		virtual ULONGLONG GetLength() override { return data.size; }
+		virtual vector<Range> AllocatedRanges(ULONGLONG length) override
+		{
+			// runs on the volume; sparse runs and the part after valid length read as zeros
+			if (data.resident || (data.flags & (DataCompressed | DataEncrypted)))
+				return IFsFile::AllocatedRanges(length);
+			vector<Range> ranges;
+			ULONGLONG cluster = image.ClusterSize(), end = min(length, data.valid);
+			for (auto& run : data.runs)
+			{
+				if (run.lcn == NtfsImage::Sparse)
+					continue;
+				ULONGLONG from = run.vcn * cluster, to = min(end, (run.vcn + run.clusters) * cluster);
+				if (from >= to)
+					continue;
+				if (!ranges.empty() && ranges.back().offset + ranges.back().length == from)
+					ranges.back().length += to - from;
+				else
+					ranges.push_back(Range{ from, to - from });
+			}
+			return ranges;
+		}
+	protected:
+		NtfsImage& image;
+		const NtfsImage::Data& data; // nodes are not changed after loading
+		ULONGLONG pos = 0;
+	};
+}
+
+NtfsImage::NtfsImage(const wchar_t* image, IFsBackend& host)
+	: m_image_name(image)
+	, m_host(host)
+{
+	m_image = host.Open(image, Read);
+	if (!m_image)
+		throw MyException{ L"Failed to open image '<path>': <err>", m_image_name, GetLastError() };
+	ReadBoot();
+	ReadMft();
+	BuildTree();
+}
+
+void NtfsImage::ReadBoot()
+{
+	uint8_t boot[512];
+	if (m_image->ReadAt(0, boot, sizeof(boot)) != sizeof(boot) || memcmp(boot + 3, "NTFS    ", 8) != 0)
+		throw MyException{ L"Not an NTFS volume: '<path>'", m_image_name, ERROR_BAD_FORMAT };
+	m_sector = Get<uint16_t>(boot, 0x0B);
+	BYTE spc = boot[0x0D];
+	ULONGLONG sectors_per_cluster = spc <= 0x80 ? spc : 1ULL << (256 - spc);
+	m_cluster = m_sector * sectors_per_cluster;
+	m_mft_lcn = Get<uint64_t>(boot, 0x30);
+	int8_t rec = (int8_t)boot[0x40]; // clusters per record, or -log2(bytes)
+	m_record = rec > 0 ? rec * m_cluster : 1ULL << -rec;
+	if (m_sector < 256 || m_sector > 4096 || m_cluster == 0 || m_record < UsaStride || m_record > 65536)
+		throw MyException{ L"Invalid NTFS boot sector: '<path>'", m_image_name, ERROR_FILE_CORRUPT };
+}
+
+bool NtfsImage::ApplyFixups(uint8_t* record)
+{
+	// the last 2 bytes of every 512-byte block are saved in the update sequence array
+	// and replaced by the update sequence number, to detect torn writes
+	if (memcmp(record, "FILE", 4) != 0)
+		return false;
+	WORD usa_offset = Get<uint16_t>(record, 0x04);
+	WORD usa_count = Get<uint16_t>(record, 0x06);
+	if (usa_count == 0 || usa_offset + usa_count * 2ULL > m_record || (usa_count - 1) * UsaStride > m_record)
+		return false;
+	uint8_t* usa = record + usa_offset;
+	for (WORD i = 1; i < usa_count; ++i)
+	{
+		uint8_t* tail = record + i * UsaStride - 2;
+		if (memcmp(tail, usa, 2) != 0)
+			return false;
+		memcpy(tail, usa + i * 2, 2);
+	}
+	return true;
+}
+
+void NtfsImage::ReadMft()
+{
+	// record 0 is $MFT itself, its $DATA gives where the rest is
+	vector<uint8_t> buf(m_record);
+	if (m_image->ReadAt(m_mft_lcn * m_cluster, buf.data(), (DWORD)m_record) != m_record || !ApplyFixups(buf.data()))
+		throw MyException{ L"Failed to read $MFT of '<path>': <err>", m_image_name, ERROR_FILE_CORRUPT };
+	vector<Run> mft_runs;
+	m_nodes.resize(1);
+	ParseRecord(0, buf.data(), &mft_runs);
+	ULONGLONG mft_size = m_nodes[0].data.empty() ? 0 : m_nodes[0].data[0].size;
+	if (mft_runs.empty() || mft_size < m_record)
+		throw MyException{ L"Failed to read $MFT of '<path>': <err>", m_image_name, ERROR_FILE_CORRUPT };
+
+	m_nodes.clear();
+	m_nodes.resize(mft_size / m_record);
+	buf.resize(MftChunk - MftChunk % m_record);
+	auto read_run = [&](const Run& run) {
+		if (run.lcn == Sparse)
+			return;
+		ULONGLONG first = run.vcn * m_cluster;     // offset in $MFT
+		ULONGLONG bytes = min(run.clusters * m_cluster, mft_size > first ? mft_size - first : 0);
+		for (ULONGLONG done = 0; done < bytes; )
+		{
+			DWORD part = (DWORD)min<ULONGLONG>(buf.size(), bytes - done);
+			if (m_image->ReadAt(run.lcn * m_cluster + done, buf.data(), part) != part)
+				throw MyException{ L"Failed to read $MFT of '<path>': <err>", m_image_name, GetLastError() };
+			for (DWORD pos = 0; pos + m_record <= part; pos += (DWORD)m_record)
+			{
+				ULONGLONG number = (first + done + pos) / m_record;
+				if (number < m_nodes.size() && ApplyFixups(buf.data() + pos))
+					ParseRecord(number, buf.data() + pos, nullptr);
+			}
+			done += part;
+		}
+	};
+	for (auto& run : mft_runs)
+		read_run(run);
+	// runs of a very fragmented $MFT continue in its extension records, which are read by now
+	ULONGLONG read_vcn = mft_runs.back().vcn + mft_runs.back().clusters;
+	vector<Run> more;
+	for (auto& data : m_nodes[0].data)
+		if (data.name.empty())
+			copy_if(data.runs.begin(), data.runs.end(), back_inserter(more), [&](const Run& r) { return r.vcn >= read_vcn; });
+	for (auto& run : more)
+		read_run(run);
+}
+
+void NtfsImage::ParseRecord(ULONGLONG number, uint8_t* record, vector<Run>* mft_runs)
+{
+	WORD flags = Get<uint16_t>(record, 0x16);
+	ULONGLONG base = Get<uint64_t>(record, 0x20) & 0xFFFFFFFFFFFFULL;
+	// attributes of extension records belong to the base record (via $ATTRIBUTE_LIST)
+	if (base >= m_nodes.size())
+		return;
+	Node& node = m_nodes[base ? base : number];
+	if (!base) {
+		node.seq = Get<uint16_t>(record, 0x10);
+		node.in_use = (flags & RecordInUse) != 0;
+		node.dir = (flags & RecordDirectory) != 0;
+	}
+	if (!(flags & RecordInUse))
+		return;
+
+	ULONGLONG pos = Get<uint16_t>(record, 0x14);
+	while (pos + 16 <= m_record)
+	{
+		const uint8_t* attr = record + pos;
+		DWORD type = Get<uint32_t>(attr, 0);
+		DWORD len = Get<uint32_t>(attr, 4);
+		if (type == AttrEnd || len < 16 || pos + len > m_record)
+			break;
+		pos += len;
+		bool non_resident = attr[8] != 0;
+		BYTE name_len = attr[9];
+		WORD name_offset = Get<uint16_t>(attr, 0x0A);
+		const uint8_t* value = nullptr;
+		DWORD value_len = 0;
+		if (!non_resident) {
+			value_len = Get<uint32_t>(attr, 0x10);
+			value = attr + Get<uint16_t>(attr, 0x14);
+			if (value + value_len > attr + len)
+				continue;
+		}
+		else if (len < 0x40)
+			continue;
+		if (name_offset + name_len * 2ULL > len)
+			continue;
+
+		if (type == AttrStandardInfo && value && value_len >= 0x24)
+		{
+			node.last_write = Get<FILETIME>(value, 0x08);
+			node.attribs = Get<uint32_t>(value, 0x20);
+		}
+		else if (type == AttrFileName && value && value_len >= 0x42)
+		{
+			BYTE chars = value[0x40];
+			BYTE name_space = value[0x41];
+			if (0x42 + chars * 2ULL > value_len)
+				continue;
+			if (node.name.empty() || (node.name_space == NameSpaceDos && name_space != NameSpaceDos))
+			{
+				node.parent = Get<uint64_t>(value, 0);
+				node.name = GetName(value + 0x42, chars);
+				node.name_space = name_space;
+			}
+		}
+		else if (type == AttrData)
+		{
+			wstring name = GetName(attr + name_offset, name_len);
+			auto it = find_if(node.data.begin(), node.data.end(), [&](const Data& d) { return d.name == name; });
+			if (it == node.data.end()) {
+				node.data.emplace_back();
+				it = node.data.end() - 1;
+				it->name = move(name);
+			}
+			Data& data = *it;
+			if (!non_resident)
+			{
+				data.size = data.valid = value_len;
+				data.resident = make_shared<vector<uint8_t>>(value, value + value_len);
+				continue;
+			}
+			ULONGLONG start_vcn = Get<uint64_t>(attr, 0x10);
+			if (start_vcn == 0) // sizes are in the first part of the attribute only
+			{
+				data.flags = Get<uint16_t>(attr, 0x0C);
+				data.size = Get<uint64_t>(attr, 0x30);
+				data.valid = Get<uint64_t>(attr, 0x38);
+			}
+			WORD runs_offset = Get<uint16_t>(attr, 0x20);
+			if (runs_offset >= len || !DecodeRuns(attr + runs_offset, attr + len, start_vcn, data.runs))
+				continue;
+			sort(data.runs.begin(), data.runs.end(), [](const Run& a, const Run& b) { return a.vcn < b.vcn; });
+			if (mft_runs && name.empty())
+				*mft_runs = data.runs;
+		}
+	}
+}
+
+void NtfsImage::BuildTree()
+{
+	for (ULONGLONG n = 0; n < m_nodes.size(); ++n)
+	{
+		Node& node = m_nodes[n];
+		if (!node.in_use || node.name.empty() || (n < FirstUserRecord && n != RootRecord))
+			continue;
+		if (node.dir)
+			node.attribs |= FILE_ATTRIBUTE_DIRECTORY;
+		// main data first
+		stable_partition(node.data.begin(), node.data.end(), [](const Data& d) { return d.name.empty(); });
+		if (n == RootRecord)
+			continue;
+		ULONGLONG parent = node.parent & 0xFFFFFFFFFFFFULL;
+		WORD parent_seq = (WORD)(node.parent >> 48);
+		if (parent < m_nodes.size() && m_nodes[parent].in_use && m_nodes[parent].dir
+			&& (parent == RootRecord || parent >= FirstUserRecord) && (parent_seq == 0 || parent_seq == m_nodes[parent].seq))
+			m_nodes[parent].children.push_back(n);
+		// else: orphan, its directory is deleted or reused
+	}
+	for (auto& node : m_nodes)
+		sort(node.children.begin(), node.children.end(), [this](ULONGLONG a, ULONGLONG b) {
+			return CompareNoCase(m_nodes[a].name, m_nodes[b].name) < 0;
+		});
+	if (m_nodes.size() <= RootRecord || !m_nodes[RootRecord].in_use || !m_nodes[RootRecord].dir)
+		throw MyException{ L"Root directory not found in '<path>'", m_image_name, ERROR_FILE_CORRUPT };
+}
+
+const NtfsImage::Node* NtfsImage::Find(wstring_view path, const Data** data)
+{
+	size_t sp = StreamPos(path);
+	wstring_view file = path.substr(0, sp);
+	const Node* node = &m_nodes[RootRecord];
+	size_t pos = 0;
+	while (node && pos <= file.size())
+	{
+		size_t end = file.find_first_of(L"\\/", pos);
+		if (end == wstring_view::npos)
+			end = file.size();
+		wstring_view part = file.substr(pos, end - pos);
+		pos = end + 1;
+		if (part.empty() || part == L".")
+			continue;
+		if (part == L"..") {
+			ULONGLONG parent = node->parent & 0xFFFFFFFFFFFFULL;
+			node = node == &m_nodes[RootRecord] ? node : &m_nodes[parent];
+			continue;
+		}
+		auto it = lower_bound(node->children.begin(), node->children.end(), part, [this](ULONGLONG n, wstring_view name) {
+			return CompareNoCase(m_nodes[n].name, name) < 0;
+		});
+		node = it != node->children.end() && CompareNoCase(m_nodes[*it].name, part) == 0 ? &m_nodes[*it] : nullptr;
+	}
+	if (node && data)
+	{
+		wstring_view stream = sp == wstring_view::npos ? L"" : RemoveAtEnd(path.substr(sp + 1), L":$DATA");
+		auto it = find_if(node->data.begin(), node->data.end(), [&](const Data& d) { return CompareNoCase(d.name, stream) == 0; });
+		*data = it == node->data.end() ? nullptr : &*it;
+	}
+	return node;
+}
+
+DirItem NtfsImage::ToDirItem(const Node& node, filesystem::path name)
+{
+	ULONGLONG size = !node.dir && !node.data.empty() && node.data[0].name.empty() ? node.data[0].size : 0;
+	return DirItem{ node.dir ? DirItem::Dir : DirItem::File, move(name), size, node.attribs, node.last_write };
+}
+
+experimental::generator<DirItem> NtfsImage::ListDir(filesystem::path dir)
+{
+	const Node* node = Find(dir.wstring());
+	if (!node || !node->dir)
+		co_return;
+	for (auto& it : ListStreams(dir, L"\\"))
+		co_yield it;
+	for (ULONGLONG n : node->children)
+		co_yield ToDirItem(m_nodes[n], dir / m_nodes[n].name);
+}
+
+experimental::generator<DirItem> NtfsImage::ListStreams(const filesystem::path& entry, const wchar_t* sep)
+{
+	const Node* node = Find(entry.wstring());
+	if (!node)
+		co_return;
+	for (auto& data : node->data)
+	{
+		if (data.name.empty())
+			continue;
+		DirItem stream{ DirItem::Stream, entry.wstring() + sep + L":" + data.name, data.size, node->attribs & ~FILE_ATTRIBUTE_DIRECTORY, node->last_write };
+		co_yield stream;
+	}
+}
+
+DirItem NtfsImage::GetItem(const filesystem::path& path)
+{
+	wstring name = path.wstring();
+	const Data* data = nullptr;
+	const Node* node = Find(name, &data);
+	if (!node)
+		return DirItem{ DirItem::Invalid, path };
+	if (StreamPos(name) == wstring::npos)
+		return ToDirItem(*node, path);
+	if (!data)
+		return DirItem{ DirItem::Invalid, path };
+	return DirItem{ DirItem::Stream, path, data->size, node->attribs & ~FILE_ATTRIBUTE_DIRECTORY, node->last_write };
+}
+
+unique_ptr<IFsFile> NtfsImage::Open(const wchar_t* name, OpenMode mode)
+{
+	if (mode == Create || mode == CreateDirect)
+		return m_host.Open(name, mode);
+	const Data* data = nullptr;
+	const Node* node = Find(name, &data);
+	if (!node || !data || (node->dir && data->name.empty())) {
+		SetLastError(ERROR_FILE_NOT_FOUND);
+		return nullptr;
+	}
+	return make_unique<ImageFile>(*this, *data);
+}
+
+DWORD NtfsImage::ReadData(const Data& data, ULONGLONG offset, void* buffer, DWORD count)
+{
+	if (offset >= data.size)
+		return 0;
+	count = (DWORD)min<ULONGLONG>(count, data.size - offset);
+	if (data.resident) {
+		memcpy(buffer, data.resident->data() + offset, count);
+		return count;
+	}
+	if (data.flags & (DataCompressed | DataEncrypted)) {
+		SetLastError(ERROR_NOT_SUPPORTED);
+		return 0;
+	}
+	uint8_t* out = (uint8_t*)buffer;
+	DWORD done = 0;
+	while (done < count)
+	{
+		ULONGLONG pos = offset + done;
+		DWORD part = count - done;
+		if (pos >= data.valid) { // not written yet
+			memset(out + done, 0, part);
+			done += part;
+			break;
+		}
+		part = (DWORD)min<ULONGLONG>(part, data.valid - pos);
+		ULONGLONG vcn = pos / m_cluster;
+		auto it = upper_bound(data.runs.begin(), data.runs.end(), vcn, [](ULONGLONG v, const Run& r) { return v < r.vcn; });
+		if (it == data.runs.begin() || vcn >= (it - 1)->vcn + (it - 1)->clusters) {
+			SetLastError(ERROR_FILE_CORRUPT);
+			return done;
+		}
+		const Run& run = *(it - 1);
+		ULONGLONG in_run = pos - run.vcn * m_cluster;
+		part = (DWORD)min<ULONGLONG>(part, run.clusters * m_cluster - in_run);
+		if (run.lcn == Sparse)
+			memset(out + done, 0, part);
+		else if (m_image->ReadAt(run.lcn * m_cluster + in_run, out + done, part) != part)
+			return done;
+		done += part;
+	}
+	return done;
+}
@@ -0,0 +1,95 @@
+/***********************************************************************
+
+  Copyright (c) 2019 Vsevolod Lukyanin
+  All rights reserved.
+
+  This file is a part of project ntfs_file_streams:
+  https://github.com/shtirlitz-dev/ntfs_file_streams
+
+  The tool that enables to list, create, copy, delete, show, write and
+  archive NTFS files streams.
+  About file streams:
+  https://docs.microsoft.com/en-us/windows/win32/fileio/file-streams
+
+***********************************************************************/
+
+#pragma once
+
+#include "FsBackend.h"
+
+// Read-only NTFS volume image (a file with a copy of the volume, e.g. made by dd).
+// $MFT is read once sequentially: the tree of files and directories with all their
+// $DATA attributes (the main data and named streams) is kept in memory, data are
+// read from the image by their runs, no file is opened per entry.
+// Names are relative to the root of the volume, "\\" and "/" are the same,
+// case-insensitive. Files created (e.g. by tar) go to the host backend.
+// Compressed and encrypted data are listed but cannot be read.
+class NtfsImage : public IFsBackend
+{
+public:
+	NtfsImage(const wchar_t* image, IFsBackend& host); // throws MyException
+	virtual std::filesystem::path CurrentDir() override { return std::filesystem::path(); }
+	virtual std::experimental::generator<DirItem> ListDir(std::filesystem::path dir) override;
+	virtual std::experimental::generator<DirItem> ListStreams(const std::filesystem::path& entry, const wchar_t* sep) override;
+	virtual DirItem GetItem(const std::filesystem::path& path) override;
+	virtual std::unique_ptr<IFsFile> Open(const wchar_t* name, OpenMode mode) override;
+	virtual bool SetLength(const wchar_t* name, ULONGLONG length) override { return m_host.SetLength(name, length); }
+	virtual bool CreateDir(const std::filesystem::path& dir) override { return m_host.CreateDir(dir); }
+	virtual bool SetAttribs(const wchar_t* name, DWORD attribs, const FILETIME& last_write) override { return m_host.SetAttribs(name, attribs, last_write); }
+	virtual bool Delete(const wchar_t*) override { SetLastError(ERROR_WRITE_PROTECT); return false; } // the image is read-only
+
+	ULONGLONG Records() const { return m_nodes.size(); } // in $MFT
+	ULONGLONG ClusterSize() const { return m_cluster; }
+
+	static const ULONGLONG Sparse = ~0ULL;
+	struct Run
+	{
+		ULONGLONG vcn;      // first cluster in the attribute
+		ULONGLONG lcn;      // first cluster on the volume, Sparse for holes
+		ULONGLONG clusters;
+	};
+	struct Data
+	{
+		std::wstring name;  // empty for the main data
+		ULONGLONG size = 0;
+		ULONGLONG valid = 0; // initialized, the rest reads as zeros
+		WORD flags = 0;      // compressed, encrypted, sparse
+		std::vector<Run> runs;
+		std::shared_ptr<std::vector<uint8_t>> resident;
+	};
+	struct Node
+	{
+		std::wstring name;
+		ULONGLONG parent = 0;
+		WORD seq = 0;         // sequence number of the record, parent references must match it
+		BYTE name_space = 0;  // of name: DOS names (2) are replaced by long ones
+		bool in_use = false;
+		bool dir = false;
+		DWORD attribs = 0;
+		FILETIME last_write = {};
+		std::vector<Data> data;
+		std::vector<ULONGLONG> children; // sorted by name
+	};
+
+	// reads data of the attribute, can be called by several threads
+	DWORD ReadData(const Data& data, ULONGLONG offset, void* buffer, DWORD count);
+
+protected:
+	void ReadBoot();
+	void ReadMft();
+	void ParseRecord(ULONGLONG number, uint8_t* record, std::vector<Run>* mft_runs);
+	bool ApplyFixups(uint8_t* record);
+	void BuildTree();
+	// splits "file:stream" to node and data (nullptr if there is no such stream)
+	const Node* Find(std::wstring_view path, const Data** data = nullptr);
+	DirItem ToDirItem(const Node& node, std::filesystem::path name);
+
+	std::wstring m_image_name;
+	IFsBackend& m_host;
+	std::unique_ptr<IFsFile> m_image;
+	ULONGLONG m_sector = 512;
+	ULONGLONG m_cluster = 4096;
+	ULONGLONG m_record = 1024;   // size of MFT record
+	ULONGLONG m_mft_lcn = 0;
+	std::vector<Node> m_nodes;  // by record number
+};
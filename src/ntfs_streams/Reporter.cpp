@@ -0,0 +1,209 @@
+/***********************************************************************
+
+  Copyright (c) 2019 Vsevolod Lukyanin
+  All rights reserved.
+
+  This file is a part of project ntfs_file_streams:
+  https://github.com/shtirlitz-dev/ntfs_file_streams
+
+  The tool that enables to list, create, copy, delete, show, write and
+  archive NTFS files streams.
+  About file streams:
+  https://docs.microsoft.com/en-us/windows/win32/fileio/file-streams
+
+***********************************************************************/
+
+#include "pch.h"
+#include "Reporter.h"
+#include <iostream>
+
+using namespace std;
+
+namespace
+{
+	const size_t HandSize = 64 * 1024;  // text is handed to the output thread when it is so big
+	const ULONGLONG HandPeriod = 200;   // or so old (ms)
+	const DWORD ProgressPeriod = 250;   // ms
+
+	const wchar_t* AnsiDir = L"\x1b[33m";    // FOREGROUND_RED | FOREGROUND_GREEN
+	const wchar_t* AnsiFile = L"\x1b[37m";   // FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE
+	const wchar_t* AnsiStream = L"\x1b[36m"; // FOREGROUND_GREEN | FOREGROUND_BLUE
+	const wchar_t* AnsiError = L"\x1b[31m";  // FOREGROUND_RED
+	const wchar_t* AnsiReset = L"\x1b[0m";
+
+	void AppendNumber(wstring& str, ULONGLONG num)
+	{
+		wchar_t buf[24];
+		wchar_t* p = buf + std::size(buf);
+		do {
+			*--p = L'0' + (wchar_t)(num % 10);
+			num /= 10;
+		} while (num);
+		str.append(p, buf + std::size(buf));
+	}
+}
+
+void Reporter::Start(Mode mode, ULONGLONG total_input)
+{
+	Stop();
+	m_mode = mode;
+	m_total_input = total_input;
+	m_dirs = m_files = m_streams = m_errors = m_data = m_input = 0;
+	m_start_tick = m_last_hand = GetTickCount64();
+
+	HANDLE hOut = GetStdHandle(STD_OUTPUT_HANDLE);
+	DWORD dwMode = 0;
+	m_console = GetConsoleMode(hOut, &dwMode) != FALSE;
+	m_ansi = m_console &&
+		((dwMode & ENABLE_VIRTUAL_TERMINAL_PROCESSING) || SetConsoleMode(hOut, dwMode | ENABLE_VIRTUAL_TERMINAL_PROCESSING));
+
+	m_text.reserve(HandSize + 1024);
+	m_stop = false;
+	m_started = true;
+	wcout.flush();
+	m_thread = thread(&Reporter::Work, this);
+}
+
+void Reporter::Stop()
+{
+	if (!m_started)
+		return;
+	Hand();
+	{
+		lock_guard<mutex> lock(m_mtx);
+		m_stop = true;
+	}
+	m_cv.notify_all();
+	m_thread.join();
+	m_started = false;
+
+	if (m_mode != Quiet)
+	{
+		wcout << m_dirs << L" directories, " << m_files << L" files, " << m_streams << L" streams, "
+			<< FileSizeStr(m_data) << L" bytes of data";
+		if (m_errors)
+			wcout << L", " << m_errors << L" errors";
+		wcout << endl;
+	}
+}
+
+void Reporter::Color(const wchar_t* ansi)
+{
+	if (m_ansi)
+		m_text += ansi;
+}
+
+void Reporter::Entry(DirItem::Type type, wstring_view prefix, const wchar_t* name, ULONGLONG size)
+{
+	switch (type)
+	{
+	case DirItem::Dir: ++m_dirs; break;
+	case DirItem::File: ++m_files; break;
+	case DirItem::Stream: ++m_streams; break;
+	}
+	if (m_mode != Verbose)
+		return;
+
+	Color(type == DirItem::Stream ? AnsiStream : type == DirItem::Dir ? AnsiDir : AnsiFile);
+	m_text += prefix;
+	m_text += type == DirItem::Dir ? L"> " : L"+ ";
+	m_text += name;
+	if (type != DirItem::Dir) {
+		m_text += L"   ";
+		AppendNumber(m_text, size);
+	}
+	Color(AnsiReset);
+	m_text += L'\n';
+
+	if (m_text.size() >= HandSize || GetTickCount64() - m_last_hand >= HandPeriod)
+		Hand();
+}
+
+void Reporter::Error(wstring_view prefix, wstring_view name, const wchar_t* msg)
+{
+	++m_errors;
+	Color(AnsiError);
+	m_text += prefix;
+	m_text += L"* ";
+	m_text += name;
+	m_text += L"  *** ";
+	m_text += msg;
+	m_text += L" ***";
+	Color(AnsiReset);
+	m_text += L'\n';
+	Hand(); // errors are shown at once
+}
+
+void Reporter::Hand()
+{
+	m_last_hand = GetTickCount64();
+	if (m_text.empty())
+		return;
+	{
+		lock_guard<mutex> lock(m_mtx);
+		if (m_pending.empty())
+			m_pending.swap(m_text); // memory of both buffers is reused
+		else
+			m_pending += m_text;
+	}
+	m_text.clear();
+	m_cv.notify_one();
+}
+
+void Reporter::Progress(wstring& line)
+{
+	ULONGLONG ms = GetTickCount64() - m_start_tick;
+	double sec = ms ? ms / 1000.0 : 0.001;
+	ULONGLONG entries = Entries();
+	ULONGLONG data = m_data;
+	ULONGLONG input = m_input;
+
+	wchar_t buf[200];
+	int len = swprintf_s(buf, L"%llu entries, %.1f MB, %.0f entries/s, %.1f MB/s",
+		entries, data / 1048576.0, entries / sec, data / 1048576.0 / sec);
+	line.assign(buf, len > 0 ? len : 0);
+	if (m_total_input && input && input <= m_total_input) {
+		len = swprintf_s(buf, L", ETA %.0f s", sec * (m_total_input - input) / input);
+		line.append(buf, len > 0 ? len : 0);
+	}
+}
+
+void Reporter::Work()
+{
+	wstring out;      // text being written, swapped with m_pending
+	wstring line;     // progress line
+	size_t shown = 0; // length of the progress line on the screen
+	bool progress = m_mode == Summary && m_console;
+	while (true)
+	{
+		bool stop;
+		{
+			unique_lock<mutex> lock(m_mtx);
+			m_cv.wait_for(lock, chrono::milliseconds(ProgressPeriod), [this] { return m_stop || !m_pending.empty(); });
+			out.swap(m_pending);
+			stop = m_stop;
+		}
+		if (!out.empty())
+		{
+			if (shown) { // text goes over the progress line
+				wcout << L'\r' << wstring(shown, L' ') << L'\r';
+				shown = 0;
+			}
+			wcout << out;
+			out.clear();
+		}
+		if (progress)
+		{
+			Progress(line);
+			wcout << L'\r' << line;
+			if (line.size() < shown)
+				wcout << wstring(shown - line.size(), L' ');
+			shown = line.size();
+		}
+		wcout.flush();
+		if (stop)
+			break;
+	}
+	if (shown)
+		wcout << endl;
+}
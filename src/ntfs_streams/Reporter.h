@@ -0,0 +1,93 @@
+/***********************************************************************
+
+  Copyright (c) 2019 Vsevolod Lukyanin
+  All rights reserved.
+
+  This file is a part of project ntfs_file_streams:
+  https://github.com/shtirlitz-dev/ntfs_file_streams
+
+  The tool that enables to list, create, copy, delete, show, write and
+  archive NTFS files streams.
+  About file streams:
+  https://docs.microsoft.com/en-us/windows/win32/fileio/file-streams
+
+***********************************************************************/
+
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "CommonFunc.h"
+
+// Output of tar/untar progress.
+// Lines are collected in a big buffer and written to stdout by a background thread,
+// the progress line is refreshed by the same thread not more often than 4 times per second.
+// Colors are ANSI sequences on console, no colors if stdout is redirected.
+class Reporter
+{
+public:
+	enum Mode
+	{
+		Quiet,   // only errors
+		Summary, // progress line (on console) and totals at the end
+		Verbose, // every directory, file and stream
+	};
+
+	~Reporter() { Stop(); }
+	void Start(Mode mode, ULONGLONG total_input = 0); // total_input - size of input data for ETA, 0 if unknown
+	void Stop(); // writes everything collected and the totals
+
+	// called by the working thread
+	void Entry(DirItem::Type type, std::wstring_view prefix, const wchar_t* name, ULONGLONG size);
+	void Error(std::wstring_view prefix, std::wstring_view name, const wchar_t* msg);
+	// can be called by any thread
+	void AddData(ULONGLONG bytes) { m_data.fetch_add(bytes, std::memory_order_relaxed); }
+	void AddInput(ULONGLONG bytes) { m_input.fetch_add(bytes, std::memory_order_relaxed); }
+
+	ULONGLONG Entries() const { return m_dirs + m_files + m_streams; }
+	ULONGLONG DataBytes() const { return m_data.load(std::memory_order_relaxed); }
+
+protected:
+	void Color(const wchar_t* ansi);
+	void Hand(); // passes collected text to the output thread
+	void Work();
+	void Progress(std::wstring& line);
+
+	Mode m_mode = Verbose;
+	bool m_started = false;
+	bool m_console = false; // stdout is console
+	bool m_ansi = false;    // console understands ANSI sequences
+	ULONGLONG m_total_input = 0;
+	ULONGLONG m_start_tick = 0;
+	ULONGLONG m_last_hand = 0;
+
+	std::atomic<ULONGLONG> m_dirs{ 0 }, m_files{ 0 }, m_streams{ 0 }, m_errors{ 0 };
+	std::atomic<ULONGLONG> m_data{ 0 }, m_input{ 0 };
+
+	std::wstring m_text;    // filled by the working thread
+	std::wstring m_pending; // handed to the output thread
+	std::mutex m_mtx;
+	std::condition_variable m_cv;
+	bool m_stop = false;
+	std::thread m_thread;
+};
+
+// Starts reporter and stops it when goes out of scope (also on exception)
+class ReporterSession
+{
+public:
+	ReporterSession(Reporter& reporter, Reporter::Mode mode, ULONGLONG total_input = 0)
+		: m_reporter(reporter)
+	{
+		m_reporter.Start(mode, total_input);
+	}
+	~ReporterSession() { m_reporter.Stop(); }
+	ReporterSession(const ReporterSession&) = delete;
+	ReporterSession& operator=(const ReporterSession&) = delete;
+protected:
+	Reporter& m_reporter;
+};
@@ -0,0 +1,214 @@
+/***********************************************************************
+
+  Copyright (c) 2019 Vsevolod Lukyanin
+  All rights reserved.
+
+  This file is a part of project ntfs_file_streams:
+  https://github.com/shtirlitz-dev/ntfs_file_streams
+
+  The tool that enables to list, create, copy, delete, show, write and
+  archive NTFS files streams.
+  About file streams:
+  https://docs.microsoft.com/en-us/windows/win32/fileio/file-streams
+
+***********************************************************************/
+
+#include "pch.h"
+#include "Stats.h"
+#include "Trace.h"
+#include <iostream>
+#include <cstdarg>
+
+using namespace std;
+
+thread_local StageTimer* StageTimer::s_current = nullptr;
+
+namespace
+{
+	wstring Format(const wchar_t* fmt, ...)
+	{
+		wchar_t buf[256];
+		va_list args;
+		va_start(args, fmt);
+		int len = _vsnwprintf_s(buf, _TRUNCATE, fmt, args);
+		va_end(args);
+		return wstring(buf, len > 0 ? len : 0);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+// LatencyHistogram
+//////////////////////////////////////////////////////////////////////////
+
+void LatencyHistogram::Add(ULONGLONG us)
+{
+	int n = 0;
+	for (ULONGLONG v = us; v && n < Buckets - 1; v >>= 1)
+		++n;
+	m_buckets[n].fetch_add(1, memory_order_relaxed);
+	ULONGLONG prev = m_max.load(memory_order_relaxed);
+	while (us > prev && !m_max.compare_exchange_weak(prev, us, memory_order_relaxed)) {}
+}
+
+ULONGLONG LatencyHistogram::Count() const
+{
+	ULONGLONG total = 0;
+	for (auto& b : m_buckets)
+		total += b.load(memory_order_relaxed);
+	return total;
+}
+
+ULONGLONG LatencyHistogram::Percentile(double p) const
+{
+	ULONGLONG total = Count();
+	if (!total)
+		return 0;
+	ULONGLONG need = (ULONGLONG)(total * p + 0.5), sum = 0;
+	for (int n = 0; n < Buckets; ++n) {
+		sum += m_buckets[n].load(memory_order_relaxed);
+		if (sum >= need && sum)
+			return min(1ULL << n, Max());
+	}
+	return Max();
+}
+
+void LatencyHistogram::Reset()
+{
+	for (auto& b : m_buckets)
+		b = 0;
+	m_max = 0;
+}
+
+wstring LatencyHistogram::Json() const
+{
+	wstring res = Format(L"{\"count\":%llu,\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,\"max\":%llu,\"buckets\":[",
+		Count(), Percentile(0.5), Percentile(0.9), Percentile(0.99), Max());
+	int last = Buckets - 1;
+	while (last > 0 && !m_buckets[last].load(memory_order_relaxed))
+		--last;
+	for (int n = 0; n <= last; ++n)
+		res += Format(n ? L",%llu" : L"%llu", m_buckets[n].load(memory_order_relaxed));
+	return res + L"]}";
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Stats
+//////////////////////////////////////////////////////////////////////////
+
+Stats::Stats()
+{
+	LARGE_INTEGER li;
+	QueryPerformanceFrequency(&li);
+	m_frequency = li.QuadPart;
+	m_start = Now();
+}
+
+void Stats::Reset()
+{
+	for (auto& c : m_stages)
+		c.count = c.bytes = 0, c.ticks = 0;
+	open_latency.Reset();
+	read_latency.Reset();
+	m_start = Now();
+}
+
+LONGLONG Stats::Now() const
+{
+	LARGE_INTEGER li;
+	QueryPerformanceCounter(&li);
+	return li.QuadPart;
+}
+
+const wchar_t* Stats::StageName(Stage stage)
+{
+	static const wchar_t* names[] = { L"enumerate", L"open", L"read", L"crypt", L"tar_write", L"tar_read", L"write" };
+	static_assert(std::size(names) == (size_t)Stage::Count, "name for each stage");
+	return names[(int)stage];
+}
+
+wstring Stats::Json() const
+{
+	double elapsed = Seconds(Now() - m_start);
+	wstring res = Format(L"{\"elapsed_sec\":%.3f,\"stages\":{", elapsed);
+	for (int i = 0; i < (int)Stage::Count; ++i)
+	{
+		const Counters& c = m_stages[i];
+		double sec = Seconds(c.ticks.load(memory_order_relaxed));
+		ULONGLONG bytes = c.bytes.load(memory_order_relaxed);
+		res += Format(L"%s\"%s\":{\"count\":%llu,\"bytes\":%llu,\"sec\":%.6f,\"mb_per_sec\":%.1f}",
+			i ? L"," : L"", StageName((Stage)i), c.count.load(memory_order_relaxed), bytes, sec,
+			sec > 0 ? bytes / 1048576.0 / sec : 0.0);
+	}
+	res += L"},\"latency_us\":{\"open\":" + open_latency.Json() + L",\"read\":" + read_latency.Json() + L"}}";
+	return res;
+}
+
+wstring Stats::Table() const
+{
+	double elapsed = Seconds(Now() - m_start);
+	wstring res = Format(L"%-10s %12s %18s %10s %6s %10s\n", L"stage", L"calls", L"bytes", L"sec", L"%", L"MB/s");
+	for (int i = 0; i < (int)Stage::Count; ++i)
+	{
+		const Counters& c = m_stages[i];
+		double sec = Seconds(c.ticks.load(memory_order_relaxed));
+		ULONGLONG bytes = c.bytes.load(memory_order_relaxed);
+		res += Format(L"%-10s %12llu %18llu %10.3f %6.1f %10.1f\n", StageName((Stage)i),
+			c.count.load(memory_order_relaxed), bytes, sec, elapsed > 0 ? 100 * sec / elapsed : 0.0,
+			sec > 0 ? bytes / 1048576.0 / sec : 0.0);
+	}
+	res += Format(L"total %.3f sec\n", elapsed);
+	res += Format(L"open latency us: p50 %llu, p90 %llu, p99 %llu, max %llu\n",
+		open_latency.Percentile(0.5), open_latency.Percentile(0.9), open_latency.Percentile(0.99), open_latency.Max());
+	res += Format(L"read latency us: p50 %llu, p90 %llu, p99 %llu, max %llu\n",
+		read_latency.Percentile(0.5), read_latency.Percentile(0.9), read_latency.Percentile(0.99), read_latency.Max());
+	return res;
+}
+
+void Stats::StartSnapshots(int seconds)
+{
+	StopSnapshots();
+	m_stop = false;
+	m_snapshots = thread([this, seconds] {
+		unique_lock<mutex> lock(m_mtx);
+		while (!m_cv.wait_for(lock, chrono::seconds(seconds), [this] { return m_stop; }))
+			wcerr << Json() << endl; // one line per snapshot
+	});
+}
+
+void Stats::StopSnapshots()
+{
+	if (!m_snapshots.joinable())
+		return;
+	{
+		lock_guard<mutex> lock(m_mtx);
+		m_stop = true;
+	}
+	m_cv.notify_all();
+	m_snapshots.join();
+}
+
+//////////////////////////////////////////////////////////////////////////
+// StageTimer
+//////////////////////////////////////////////////////////////////////////
+
+StageTimer::StageTimer(Stats& stats, Stage stage, ULONGLONG bytes)
+	: m_stats(stats), m_stage(stage), m_start(stats.Now()), m_bytes(bytes), m_parent(s_current)
+{
+	s_current = this;
+	Stats::Counters& c = m_stats[m_stage];
+	c.count.fetch_add(1, memory_order_relaxed);
+	if (bytes)
+		c.bytes.fetch_add(bytes, memory_order_relaxed);
+}
+
+StageTimer::~StageTimer()
+{
+	LONGLONG end = m_stats.Now();
+	LONGLONG elapsed = end - m_start;
+	if (Trace::Enabled())
+		Trace::Complete(L"stage", Stats::StageName(m_stage), m_start, end, m_bytes);
+	m_stats[m_stage].ticks.fetch_add(elapsed - m_nested, memory_order_relaxed);
+	if (m_parent)
+		m_parent->m_nested += elapsed;
+	s_current = m_parent;
+}
@@ -0,0 +1,115 @@
+/***********************************************************************
+
+  Copyright (c) 2019 Vsevolod Lukyanin
+  All rights reserved.
+
+  This file is a part of project ntfs_file_streams:
+  https://github.com/shtirlitz-dev/ntfs_file_streams
+
+  The tool that enables to list, create, copy, delete, show, write and
+  archive NTFS files streams.
+  About file streams:
+  https://docs.microsoft.com/en-us/windows/win32/fileio/file-streams
+
+***********************************************************************/
+
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// Counters of tar/untar stages: calls, bytes and time.
+// Time of a stage is exclusive: time of nested stages (e.g. writing to the tar-file
+// inside of encryption) is not included. Cost is 2 QueryPerformanceCounter per timed call.
+enum class Stage
+{
+	Enumerate, // listing of directories and streams
+	Open,      // opening and creating of files
+	Read,      // reading of files being archived
+	Crypt,     // encryption and decryption
+	TarWrite,  // writing to tar-file
+	TarRead,   // reading from tar-file
+	Write,     // writing of extracted files
+	Count
+};
+
+// Latencies in microseconds by powers of 2: bucket n counts values in [2^(n-1), 2^n)
+class LatencyHistogram
+{
+public:
+	static const int Buckets = 32;
+	void Add(ULONGLONG us);
+	ULONGLONG Count() const;
+	ULONGLONG Percentile(double p) const; // upper bound of the bucket
+	ULONGLONG Max() const { return m_max.load(std::memory_order_relaxed); }
+	void Reset();
+	std::wstring Json() const;
+protected:
+	std::atomic<ULONGLONG> m_buckets[Buckets] = {};
+	std::atomic<ULONGLONG> m_max{ 0 };
+};
+
+class Stats
+{
+public:
+	struct Counters
+	{
+		std::atomic<ULONGLONG> count{ 0 };
+		std::atomic<ULONGLONG> bytes{ 0 };
+		std::atomic<LONGLONG> ticks{ 0 };
+	};
+
+	Stats();
+	~Stats() { StopSnapshots(); }
+	void Reset();
+	static const wchar_t* StageName(Stage stage);
+
+	Counters& operator[](Stage stage) { return m_stages[(int)stage]; }
+	void AddBytes(Stage stage, ULONGLONG bytes) { (*this)[stage].bytes.fetch_add(bytes, std::memory_order_relaxed); }
+	LatencyHistogram open_latency;
+	LatencyHistogram read_latency;
+
+	LONGLONG Now() const;
+	double Seconds(LONGLONG ticks) const { return (double)ticks / m_frequency; }
+	ULONGLONG Microseconds(LONGLONG ticks) const { return (ULONGLONG)(ticks * 1000000 / m_frequency); }
+
+	std::wstring Json() const;
+	std::wstring Table() const;
+
+	void StartSnapshots(int seconds); // writes Json() to stderr every 'seconds'
+	void StopSnapshots();
+
+protected:
+	Counters m_stages[(int)Stage::Count];
+	LONGLONG m_frequency;
+	LONGLONG m_start;
+
+	std::thread m_snapshots;
+	std::mutex m_mtx;
+	std::condition_variable m_cv;
+	bool m_stop = false;
+};
+
+// Measures time of a stage in the current thread; nested timers are subtracted.
+// If tracing is enabled, every timed call is also a trace event (see Trace.h)
+class StageTimer
+{
+public:
+	StageTimer(Stats& stats, Stage stage, ULONGLONG bytes = 0);
+	~StageTimer();
+	StageTimer(const StageTimer&) = delete;
+	StageTimer& operator=(const StageTimer&) = delete;
+	void AddBytes(ULONGLONG bytes) { m_stats.AddBytes(m_stage, bytes); m_bytes += bytes; }
+	LONGLONG Elapsed() const { return m_stats.Now() - m_start; } // including nested
+protected:
+	Stats& m_stats;
+	Stage m_stage;
+	LONGLONG m_start;
+	LONGLONG m_nested = 0;
+	ULONGLONG m_bytes;
+	StageTimer* m_parent;
+	static thread_local StageTimer* s_current;
+};
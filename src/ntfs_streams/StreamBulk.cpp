@@ -0,0 +1,315 @@
+/***********************************************************************
+
+  Copyright (c) 2019 Vsevolod Lukyanin
+  All rights reserved.
+
+  This file is a part of project ntfs_file_streams:
+  https://github.com/shtirlitz-dev/ntfs_file_streams
+
+  The tool that enables to list, create, copy, delete, show, write and
+  archive NTFS files streams.
+  About file streams:
+  https://docs.microsoft.com/en-us/windows/win32/fileio/file-streams
+
+***********************************************************************/
+
+#include "pch.h"
+
+#include "StreamBulk.h"
+#include "ntfs_streams.h"
+#include "CommonFunc.h"
+#include "FsBackend.h"
+#include "FileSimple.h"
+#include "TreeWalker.h"
+#include "MaskSet.h"
+#include "UnicodeStream.h"
+#include <tchar.h>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+
+using namespace std;
+using namespace std::chrono;
+
+// del, copy and type for all streams of trees matched by masks, in one process.
+// The operation is done by the thread of TreeWalker that has found the stream, so
+// threads list directories and work with streams at once; errors of streams are
+// kept by the threads and shown at the end, they do not stop the walk.
+// type decodes a stream without the output lock, into the buffer of the thread and,
+// for a big stream, its temporary file; the lock is taken to write the ready text.
+
+namespace
+{
+	int ShowHelpBulk(filesystem::path filename)
+	{
+		ShowCopyright();
+		wcout << L"\ncommand line arguments for '" << filename.c_str() << L" bulk':\n\n";
+		wcout << L"bulk del|copy|type /n:masks [options] [<item1> <item2> ...]\n";
+		wcout << L"where <itemN> are files or directories, with all subdirectories\n";
+		wcout << L"If <itemN> are not specified, the current directory is used\n";
+		wcout << L"  del            - deletes the streams\n";
+		wcout << L"  copy           - copies every stream to a file: file.txt:meta to file.txt.meta\n";
+		wcout << L"  type           - writes text of every stream after its name\n";
+		wcout << L"options:\n";
+		wcout << L"  /n:mask1;mask2 - names of streams, e.g. /n:Zone.Identifier, /n:* for all\n";
+		wcout << L"  /f:mask1;mask2 - files: names or paths relative to <itemN>, e.g. *.pdf or docs\\**\n";
+		wcout << L"  /to:dir        - copy: files are created in dir with the same relative paths\n";
+		wcout << L"  /dry           - only show what would be done\n";
+		wcout << L"  /q             - no line per stream, only errors and the summary\n";
+		wcout << L"  /j:threads     - number of threads, default 8\n";
+		return 0;
+	}
+
+	enum Operation { Delete, Copy, Type };
+
+	const DWORD BlockSize = 1024 * 1024;
+	const size_t OutputChunk = 64 * 1024; // chars of text kept in memory by type, the rest is spilled
+
+	struct FileStream : public CharStream
+	{
+		FileStream(IFsFile& file) : file(file) {}
+		virtual int Read(char* buf, int count) override
+		{
+			return (int)file.Read(buf, (DWORD)count);
+		}
+		IFsFile& file;
+	};
+
+	struct Failed
+	{
+		wstring name;
+		DWORD error;
+	};
+
+	// results of one thread
+	struct alignas(64) Results
+	{
+		vector<char> buf;
+		vector<Failed> failed;
+		wstring text;     // type: decoded text of the stream, up to OutputChunk
+		FileSimple spill; // type: text of a big stream that did not fit in text
+		ULONGLONG streams = 0;
+		ULONGLONG bytes = 0;
+	};
+
+	bool CopyData(const wchar_t* src, const wchar_t* dest, vector<char>& buf, ULONGLONG& bytes)
+	{
+		auto in = Fs().Open(src, IFsBackend::Read);
+		if (!in)
+			return false;
+		auto out = Fs().Open(dest, IFsBackend::Create);
+		if (!out)
+			return false;
+		buf.resize(BlockSize);
+		SetLastError(0);
+		while (DWORD count = in->Read(buf.data(), BlockSize))
+		{
+			if (out->Write(buf.data(), count) != count)
+				return false;
+			bytes += count;
+			SetLastError(0);
+		}
+		return GetLastError() == 0 || GetLastError() == ERROR_HANDLE_EOF;
+	}
+
+	// text that does not fit in the buffer goes to the temporary file of the thread;
+	// it is opened once and emptied for every stream that needs it
+	bool Spill(Results& res, wstring_view text, bool& spilled)
+	{
+		if (!spilled) {
+			if (!res.spill.IsOpen() && !res.spill.OpenTemp())
+				return false;
+			if (res.spill.SetPosition(0) == FileSimple::InvalidPosition || !res.spill.SetEOF())
+				return false;
+			spilled = true;
+		}
+		DWORD bytes = (DWORD)(text.size() * sizeof(wchar_t));
+		return res.spill.Write(text.data(), bytes) == bytes;
+	}
+
+	// the whole text is decoded before the lock is taken, so other threads decode and walk
+	// meanwhile; under the lock it is written at once, not mixed with other streams
+	bool TypeText(const wchar_t* src, const wstring& header, Results& res, mutex& out_mtx)
+	{
+		auto in = Fs().Open(src, IFsBackend::Read);
+		if (!in)
+			return false;
+		FileStream stream(*in);
+		wstring& text = res.text;
+		text = header;
+		bool line_end = true, spilled = false;
+		for (auto str : GetStrings(&stream))
+		{
+			if (str.empty())
+				continue;
+			line_end = str.back() == L'\n';
+			if (text.size() + str.size() > OutputChunk) {
+				if (!Spill(res, text, spilled))
+					return false;
+				text.clear();
+			}
+			if (str.size() <= OutputChunk)
+				text += str;
+			else if (!Spill(res, str, spilled)) // a long line
+				return false;
+		}
+		if (!line_end)
+			text += L'\n';
+		text += L'\n';
+		if (spilled && res.spill.SetPosition(0) == FileSimple::InvalidPosition)
+			return false;
+
+		lock_guard<mutex> lock(out_mtx);
+		if (spilled) {
+			res.buf.resize(OutputChunk * sizeof(wchar_t));
+			while (DWORD bytes = res.spill.Read(res.buf.data(), (DWORD)res.buf.size()))
+				wcout.write((const wchar_t*)res.buf.data(), bytes / sizeof(wchar_t));
+		}
+		wcout << text;
+		return true;
+	}
+}
+
+int StreamBulk(int argc, TCHAR **argv)
+{
+	if (argc < 3 || _tcscmp(argv[2], L"/?") == 0)
+		return ShowHelpBulk(filesystem::path(argv[0]).filename());
+
+	wstring_view op_name(argv[2]);
+	Operation op = op_name == L"del" ? Delete : op_name == L"copy" ? Copy : op_name == L"type" ? Type :
+		throw invalid_argument("Specify operation: del, copy or type");
+	vector<wstring> stream_masks, file_masks;
+	filesystem::path to;
+	bool dry = false, quiet = false;
+	int threads = 8;
+	vector<filesystem::path> items;
+	for (int n = 3; n < argc; ++n)
+	{
+		wstring_view param(argv[n]);
+		if (param.substr(0, 3) == L"/n:")
+			stream_masks = split(param.substr(3), L';');
+		else if (param.substr(0, 3) == L"/f:")
+			file_masks = split(param.substr(3), L';');
+		else if (param.substr(0, 4) == L"/to:" && op == Copy)
+			to = param.substr(4);
+		else if (param == L"/dry")
+			dry = true;
+		else if (param == L"/q")
+			quiet = true;
+		else if (param.substr(0, 3) == L"/j:")
+			threads = max(1, _wtoi(param.data() + 3));
+		else if (param.substr(0, 1) == L"/")
+			throw invalid_argument("unrecognized option");
+		else
+			items.push_back(param);
+	}
+	MaskSet streams(stream_masks), files(file_masks);
+	if (streams.empty()) // not to delete all streams by mistake
+		throw invalid_argument("Specify names of streams by /n:, /n:* for all");
+
+	auto begin_time = high_resolution_clock::now();
+	vector<DirItem> roots;
+	if (items.empty())
+		items.push_back(Fs().CurrentDir());
+	for (auto& it : items)
+	{
+		roots.push_back(Fs().GetItem(it));
+		if (roots.back().type == DirItem::Invalid)
+			throw MyException{ L"Not found: '<path>'", it.native(), ERROR_FILE_NOT_FOUND };
+	}
+	// relative paths start after the directory given (a file given is relative to its directory)
+	vector<wstring> bases;
+	for (auto& root : roots)
+	{
+		wstring base = root.type == DirItem::Dir ? root.name.native() : root.name.parent_path().native();
+		while (!base.empty() && (base.back() == L'\\' || base.back() == L'/'))
+			base.pop_back();
+		bases.push_back(base);
+	}
+
+	mutex out_mtx;
+	TreeWalker walker(threads);
+	vector<Results> results(walker.Threads());
+	walker.Walk(roots, [&](const DirItem& item, int thread) {
+		if (item.type != DirItem::Stream)
+			return;
+		const wstring& name = item.name.native();
+		const wchar_t* colon = wcschr(filename_of(item.name), L':');
+		if (!colon || !streams.Match(colon + 1))
+			return;
+		// "file:name" or "dir\:name"
+		wstring_view file = wstring_view(name).substr(0, colon - name.c_str());
+		while (file.size() > 1 && (file.back() == L'\\' || file.back() == L'/'))
+			file.remove_suffix(1);
+		wstring_view rel = file;
+		for (auto& base : bases)
+			if (!base.empty() && file.compare(0, base.size(), base) == 0 &&
+				(file.size() == base.size() || file[base.size()] == L'\\' || file[base.size()] == L'/')) {
+				rel.remove_prefix(min(file.size(), base.size() + 1)); // empty for the directory given
+				break;
+			}
+		if (!files.empty() && !files.Match(rel))
+			return;
+
+		Results& res = results[thread];
+		++res.streams;
+		wstring line, dest;
+		bool ok = true;
+		switch (op)
+		{
+		case Delete:
+			ok = dry || Fs().Delete(name.c_str());
+			line = (dry ? L"would delete " : L"deleted ") + name;
+			break;
+		case Copy:
+			dest = to.empty() ? wstring(file) : (to / rel).native();
+			dest += L'.';
+			dest += colon + 1;
+			if (!dry) {
+				if (!to.empty() && !Fs().CreateDir(filesystem::path(dest).parent_path()))
+					ok = false;
+				else
+					ok = CopyData(name.c_str(), dest.c_str(), res.buf, res.bytes);
+			}
+			line = name + (dry ? L" would be copied to " : L" copied to ") + dest;
+			break;
+		case Type:
+			line = L"==> " + name + L" <==\n";
+			if (!dry)
+				ok = TypeText(name.c_str(), line, res, out_mtx); // writes the line and the text
+			break;
+		}
+		if (!ok) {
+			res.failed.push_back(Failed{ name, GetLastError() });
+			return;
+		}
+		if (op == Delete || dry)
+			res.bytes += item.size;
+		if ((quiet && op != Type) || (op == Type && !dry))
+			return;
+		lock_guard<mutex> lock(out_mtx);
+		wcout << line << L"\n";
+	});
+
+	ULONGLONG count = 0, bytes = 0;
+	vector<Failed> failed;
+	for (auto& res : results)
+	{
+		count += res.streams;
+		bytes += res.bytes;
+		move(res.failed.begin(), res.failed.end(), back_inserter(failed));
+	}
+	sort(failed.begin(), failed.end(), [](const Failed& a, const Failed& b) { return a.name < b.name; });
+	for (auto& it : failed)
+		wcout << L"Failed: " << it.name << L": " << GetErrorMessage(it.error) << L"\n";
+
+	duration<double> time_span = high_resolution_clock::now() - begin_time;
+	const wchar_t* done = dry ? L"matched" : op == Delete ? L"deleted" : op == Copy ? L"copied" : L"typed";
+	wcout << count - failed.size() << L" streams " << done;
+	if (op != Type)
+		wcout << L" (" << FileSizeStr(bytes) << L" bytes)";
+	if (!failed.empty())
+		wcout << L", " << failed.size() << L" failed";
+	wcout << L"; " << walker.Dirs() << L" directories, " << walker.Files() << L" files (" << time_span.count() << L" sec)" << endl;
+	return failed.empty() ? 0 : 1;
+}
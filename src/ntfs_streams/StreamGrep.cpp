@@ -0,0 +1,321 @@
+/***********************************************************************
+
+  Copyright (c) 2019 Vsevolod Lukyanin
+  All rights reserved.
+
+  This file is a part of project ntfs_file_streams:
+  https://github.com/shtirlitz-dev/ntfs_file_streams
+
+  The tool that enables to list, create, copy, delete, show, write and
+  archive NTFS files streams.
+  About file streams:
+  https://docs.microsoft.com/en-us/windows/win32/fileio/file-streams
+
+***********************************************************************/
+
+#include "pch.h"
+
+#include "StreamGrep.h"
+#include "ntfs_streams.h"
+#include "CommonFunc.h"
+#include "FsBackend.h"
+#include "TreeWalker.h"
+#include "MaskSet.h"
+#include "UnicodeFuncts.h"
+#include "Simd.h"
+#include <tchar.h>
+#include <iostream>
+#include <chrono>
+
+using namespace std;
+using namespace std::chrono;
+
+// Search of texts in contents of streams of trees, in several threads (see TreeWalker).
+// Every text is searched as bytes in every encoding at once (UTF-8, UTF-16 LE and BE,
+// current codepage), so streams are not decoded: data are read by big blocks and
+// scanned for the first and the last byte of a text by SSE2, 16 positions at once,
+// only candidates are compared.
+
+namespace
+{
+	int ShowHelpGrep(filesystem::path filename)
+	{
+		ShowCopyright();
+		wcout << L"\ncommand line arguments for '" << filename.c_str() << L" grep':\n\n";
+		wcout << L"grep [options] <text> [<item1> <item2> ...]\n";
+		wcout << L"where <itemN> are files or directories to search in, with all subdirectories\n";
+		wcout << L"If <itemN> are not specified, the current directory is searched\n";
+		wcout << L"Contents of streams are searched for <text> in UTF-8, UTF-16 and current codepage\n";
+		wcout << L"options:\n";
+		wcout << L"  /e:text        - one more text to search, all texts are searched at once\n";
+		wcout << L"  /i             - ignore case of latin letters\n";
+		wcout << L"  /n:mask1;mask2 - only streams with such names, e.g. Zone.Identifier\n";
+		wcout << L"  /l             - only names of streams with matches\n";
+		wcout << L"  /c:N           - show N chars before and after every match\n";
+		wcout << L"  /j:threads     - number of threads, default 8\n";
+		return 0;
+	}
+
+	const size_t BlockSize = 256 * 1024; // stays in cache while all texts are searched
+
+	enum Encoding { Utf8, Utf16LE, Utf16BE, Ansi };
+	const wchar_t* encoding_names[] = { L"utf-8", L"utf-16le", L"utf-16be", L"ansi" };
+
+	struct Needle
+	{
+		string bytes;
+		Encoding enc;
+		size_t text;  // index of the text
+	};
+
+	void FoldCase(const char* src, char* dst, size_t count)
+	{
+		size_t i = 0;
+#ifdef USE_SSE2
+		const __m128i before_a = _mm_set1_epi8('A' - 1), after_z = _mm_set1_epi8('Z' + 1), bit = _mm_set1_epi8(0x20);
+		for (; i + 16 <= count; i += 16)
+		{
+			__m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+			// signed compare: bytes >= 0x80 are negative, so they are not letters
+			__m128i upper = _mm_and_si128(_mm_cmpgt_epi8(v, before_a), _mm_cmplt_epi8(v, after_z));
+			_mm_storeu_si128((__m128i*)(dst + i), _mm_or_si128(v, _mm_and_si128(upper, bit)));
+		}
+#endif
+		for (; i < count; ++i)
+			dst[i] = src[i] >= 'A' && src[i] <= 'Z' ? src[i] | 0x20 : src[i];
+	}
+
+	// calls found(pos) for every position of needle in hay
+	template <class F>
+	void Search(const char* hay, size_t count, const string& needle, F&& found)
+	{
+		size_t len = needle.size();
+		if (!len || len > count)
+			return;
+		size_t last = count - len; // the last possible position
+		size_t i = 0;
+#ifdef USE_SSE2
+		if (len > 1)
+		{
+			const __m128i first = _mm_set1_epi8(needle[0]), end = _mm_set1_epi8(needle[len - 1]);
+			for (; i + 16 <= last + 1; i += 16)
+			{
+				__m128i a = _mm_loadu_si128((const __m128i*)(hay + i));
+				__m128i b = _mm_loadu_si128((const __m128i*)(hay + i + len - 1));
+				unsigned mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, end)));
+				for (; mask; mask &= mask - 1)
+				{
+					size_t pos = i + LowestBit(mask);
+					if (memcmp(hay + pos + 1, needle.data() + 1, len - 2) == 0)
+						found(pos);
+				}
+			}
+		}
+#endif
+		while (i <= last)
+		{
+			const char* p = (const char*)memchr(hay + i, needle[0], last + 1 - i);
+			if (!p)
+				break;
+			i = p - hay;
+			if (memcmp(p + 1, needle.data() + 1, len - 1) == 0)
+				found(i);
+			++i;
+		}
+	}
+
+	wstring Context(const char* data, size_t size, Encoding enc)
+	{
+		wstring res;
+		if (enc == Utf16LE || enc == Utf16BE) {
+			for (size_t i = 0; i + 1 < size; i += 2)
+				res += enc == Utf16LE ? wchar_t(((uint8_t)data[i + 1] << 8) | (uint8_t)data[i]) : wchar_t(((uint8_t)data[i] << 8) | (uint8_t)data[i + 1]);
+		}
+		else
+			res = ToWideChar(string_view(data, size), enc == Utf8 ? CP_UTF8 : CP_ACP);
+		for (auto& ch : res)
+			if (ch < 0x20)
+				ch = L' ';
+		return res;
+	}
+
+	// results of one thread
+	struct alignas(64) Results
+	{
+		vector<char> data, folded;
+		ULONGLONG streams = 0;
+		ULONGLONG bytes = 0;
+		ULONGLONG matched = 0;  // streams
+		ULONGLONG matches = 0;
+		ULONGLONG failed = 0;   // not opened
+	};
+}
+
+int StreamGrep(int argc, TCHAR **argv)
+{
+	if (argc < 3 || _tcscmp(argv[2], L"/?") == 0)
+		return ShowHelpGrep(filesystem::path(argv[0]).filename());
+
+	vector<wstring> texts;
+	bool icase = false;
+	bool names_only = false;
+	size_t context = 0;
+	vector<wstring> masks;
+	int threads = 8;
+	vector<filesystem::path> items;
+	for (int n = 2; n < argc; ++n)
+	{
+		wstring_view param(argv[n]);
+		if (param.substr(0, 3) == L"/e:")
+			texts.emplace_back(param.substr(3));
+		else if (param == L"/i")
+			icase = true;
+		else if (param.substr(0, 3) == L"/n:")
+			masks = split(param.substr(3), L';');
+		else if (param == L"/l")
+			names_only = true;
+		else if (param.substr(0, 3) == L"/c:")
+			context = max(0, _wtoi(param.data() + 3));
+		else if (param.substr(0, 3) == L"/j:")
+			threads = max(1, _wtoi(param.data() + 3));
+		else if (param.substr(0, 1) == L"/")
+			throw invalid_argument("unrecognized option");
+		else if (texts.empty())
+			texts.emplace_back(param);
+		else
+			items.push_back(param);
+	}
+	if (texts.empty() || any_of(texts.begin(), texts.end(), [](const wstring& t) { return t.empty(); }))
+		throw invalid_argument("Specify text to search");
+
+	// every text in every encoding, the same bytes only once
+	vector<Needle> needles;
+	size_t max_len = 0;
+	for (size_t t = 0; t < texts.size(); ++t)
+	{
+		string le, be;
+		for (wchar_t ch : texts[t]) {
+			le += (char)(ch & 0xFF);
+			le += (char)((ch >> 8) & 0xFF);
+			be += (char)((ch >> 8) & 0xFF);
+			be += (char)(ch & 0xFF);
+		}
+		string utf8 = ToChar(texts[t], CP_UTF8), ansi = ToChar(texts[t], CP_ACP);
+		if (ToWideChar(ansi, CP_ACP) != texts[t]) // not in current codepage
+			ansi.clear();
+		for (auto& variant : { make_pair(utf8, Utf8), make_pair(le, Utf16LE), make_pair(be, Utf16BE), make_pair(ansi, Ansi) })
+		{
+			string bytes = variant.first;
+			Encoding enc = variant.second;
+			if (icase)
+				FoldCase(bytes.data(), bytes.data(), bytes.size());
+			if (bytes.empty() || any_of(needles.begin(), needles.end(), [&](const Needle& n) { return n.bytes == bytes; }))
+				continue;
+			max_len = max(max_len, bytes.size());
+			needles.push_back(Needle{ bytes, enc, t });
+		}
+	}
+	MaskSet match(masks);
+
+	auto begin_time = high_resolution_clock::now();
+	vector<DirItem> roots;
+	if (items.empty())
+		items.push_back(Fs().CurrentDir());
+	for (auto& it : items)
+	{
+		roots.push_back(Fs().GetItem(it));
+		if (roots.back().type == DirItem::Invalid)
+			throw MyException{ L"Not found: '<path>'", it.native(), ERROR_FILE_NOT_FOUND };
+	}
+
+	mutex out_mtx;
+	TreeWalker walker(threads);
+	vector<Results> results(walker.Threads());
+	size_t keep = max_len - 1; // the end of a block is searched again with the next one
+	walker.Walk(roots, [&](const DirItem& item, int thread) {
+		if (item.type != DirItem::Stream || !item.size)
+			return;
+		const wchar_t* name = filename_of(item.name);
+		if (!match.empty() && !match.Match(wcschr(name, L':') + 1))
+			return;
+		Results& res = results[thread];
+		auto file = Fs().Open(item.name.c_str(), IFsBackend::Read);
+		if (!file) {
+			++res.failed;
+			return;
+		}
+		++res.streams;
+		res.data.resize(keep + BlockSize);
+		if (icase)
+			res.folded.resize(keep + BlockSize);
+		ULONGLONG base = 0;  // offset of data[0] in the stream
+		size_t have = 0;     // bytes in data
+		size_t kept = 0;     // of them from the previous block
+		ULONGLONG matches = 0;
+		while (!(names_only && matches))
+		{
+			DWORD count = file->Read(res.data.data() + have, (DWORD)BlockSize);
+			if (!count)
+				break;
+			res.bytes += count;
+			if (icase)
+				FoldCase(res.data.data() + have, res.folded.data() + have, count);
+			have += count;
+			const char* hay = icase ? res.folded.data() : res.data.data();
+			for (auto& needle : needles)
+			{
+				Search(hay, have, needle.bytes, [&](size_t pos) {
+					if (pos + needle.bytes.size() <= kept || (names_only && matches)) // found in the previous block
+						return;
+					if ((needle.enc == Utf16LE || needle.enc == Utf16BE) && (base + pos) % 2) // not at a char of UTF-16
+						return;
+					++matches;
+					if (names_only)
+						return;
+					wstring line = item.name.native() + L":" + to_wstring(base + pos) + L":" + encoding_names[needle.enc];
+					if (context) {
+						size_t unit = needle.enc == Utf16LE || needle.enc == Utf16BE ? 2 : 1;
+						size_t from = pos - min(pos / unit, context) * unit;
+						size_t to = min(have, pos + needle.bytes.size() + context * unit);
+						line += L": " + Context(res.data.data() + from, to - from, needle.enc);
+					}
+					lock_guard<mutex> lock(out_mtx);
+					wcout << line << L"\n";
+				});
+			}
+			if (have > keep) {
+				memmove(res.data.data(), res.data.data() + have - keep, keep);
+				if (icase)
+					memmove(res.folded.data(), res.folded.data() + have - keep, keep);
+				base += have - keep;
+				have = keep;
+			}
+			kept = have;
+		}
+		if (matches) {
+			++res.matched;
+			res.matches += matches;
+			if (names_only) {
+				lock_guard<mutex> lock(out_mtx);
+				wcout << item.name.c_str() << L"\n";
+			}
+		}
+	});
+
+	Results total;
+	for (auto& res : results)
+	{
+		total.streams += res.streams;
+		total.bytes += res.bytes;
+		total.matched += res.matched;
+		total.matches += res.matches;
+		total.failed += res.failed;
+	}
+	duration<double> time_span = high_resolution_clock::now() - begin_time;
+	wcout << total.matches << L" matches in " << total.matched << L" streams; " << total.streams << L" streams, "
+		<< FileSizeStr(total.bytes) << L" bytes searched";
+	if (total.failed)
+		wcout << L", " << total.failed << L" streams not opened";
+	wcout << L"; " << walker.Dirs() << L" directories, " << walker.Files() << L" files (" << time_span.count() << L" sec)" << endl;
+	return 0;
+}
@@ -0,0 +1,273 @@
+/***********************************************************************
+
+  Copyright (c) 2019 Vsevolod Lukyanin
+  All rights reserved.
+
+  This file is a part of project ntfs_file_streams:
+  https://github.com/shtirlitz-dev/ntfs_file_streams
+
+  The tool that enables to list, create, copy, delete, show, write and
+  archive NTFS files streams.
+  About file streams:
+  https://docs.microsoft.com/en-us/windows/win32/fileio/file-streams
+
+***********************************************************************/
+
+#include "pch.h"
+
+#include "StreamUsage.h"
+#include "ntfs_streams.h"
+#include "CommonFunc.h"
+#include "FsBackend.h"
+#include "TreeWalker.h"
+#include <tchar.h>
+#include <iostream>
+#include <iomanip>
+#include <unordered_map>
+#include <map>
+#include <chrono>
+
+using namespace std;
+using namespace std::chrono;
+
+// Space used by named streams: per directory subtree, histogram of sizes and
+// names of streams by total size. Only sizes given by stream enumeration are used,
+// contents are never read. Every thread of TreeWalker adds to its own Usage,
+// they are merged at the end.
+
+namespace
+{
+	const int Buckets = 65; // 0, [1, 2), [2, 4) ... by powers of 2
+
+	int ShowHelpDu(filesystem::path filename)
+	{
+		ShowCopyright();
+		wcout << L"\ncommand line arguments for '" << filename.c_str() << L" du':\n\n";
+		wcout << L"du [options] [<dir>]\n";
+		wcout << L"where <dir> is the directory to report, default is the current one\n";
+		wcout << L"options:\n";
+		wcout << L"  /d:depth       - levels of subdirectories with subtotals, default 1\n";
+		wcout << L"  /top:N         - number of stream names with the biggest total size, default 10\n";
+		wcout << L"  /json          - output in JSON format\n";
+		wcout << L"  /j:threads     - number of threads listing directories, default 8\n";
+		return 0;
+	}
+
+	struct Total
+	{
+		ULONGLONG count = 0;
+		ULONGLONG bytes = 0;
+		void Add(ULONGLONG size) { ++count; bytes += size; }
+		void Add(const Total& t) { count += t.count; bytes += t.bytes; }
+	};
+
+	struct NameTotal : Total
+	{
+		wstring name; // as met first, names are compared case-insensitively
+	};
+
+	struct alignas(64) Usage
+	{
+		Total total;
+		unordered_map<wstring, Total> dirs;      // directory of the file (or the directory itself)
+		unordered_map<wstring, NameTotal> names; // by upper-case name
+		Total histogram[Buckets];
+
+		void Add(const Usage& u)
+		{
+			total.Add(u.total);
+			for (auto& [dir, t] : u.dirs)
+				dirs[dir].Add(t);
+			for (auto& [key, t] : u.names) {
+				NameTotal& nt = names[key];
+				if (nt.name.empty())
+					nt.name = t.name;
+				nt.Add(t);
+			}
+			for (int i = 0; i < Buckets; ++i)
+				histogram[i].Add(u.histogram[i]);
+		}
+	};
+
+	int Bucket(ULONGLONG size)
+	{
+		int b = 0;
+		for (; size; size >>= 1)
+			++b;
+		return b;
+	}
+
+	// paths with a separator lower than any character, so every directory is followed
+	// by its subtree: "a", "a\x", "a.old" (by plain order "a.old" would be before "a\x")
+	struct PathLess
+	{
+		static unsigned Key(wchar_t c) { return c == L'\\' || c == L'/' ? 0 : (unsigned)c + 1; }
+		bool operator()(const wstring& a, const wstring& b) const
+		{
+			return lexicographical_compare(a.begin(), a.end(), b.begin(), b.end(),
+				[](wchar_t x, wchar_t y) { return Key(x) < Key(y); });
+		}
+	};
+
+	wstring Json(wstring_view str)
+	{
+		wstring res = L"\"";
+		for (wchar_t c : str)
+		{
+			if (c == L'"' || c == L'\\')
+				res += L'\\';
+			res += c < 0x20 ? L' ' : c;
+		}
+		return res + L"\"";
+	}
+}
+
+int StreamUsage(int argc, TCHAR **argv)
+{
+	if (argc >= 3 && _tcscmp(argv[2], L"/?") == 0)
+		return ShowHelpDu(filesystem::path(argv[0]).filename());
+
+	int depth = 1;
+	size_t top = 10;
+	bool json = false;
+	int threads = 8;
+	filesystem::path root;
+	for (int n = 2; n < argc; ++n)
+	{
+		wstring_view param(argv[n]);
+		if (param.substr(0, 3) == L"/d:")
+			depth = max(0, _wtoi(param.data() + 3));
+		else if (param.substr(0, 5) == L"/top:")
+			top = max(0, _wtoi(param.data() + 5));
+		else if (param == L"/json")
+			json = true;
+		else if (param.substr(0, 3) == L"/j:")
+			threads = max(1, _wtoi(param.data() + 3));
+		else if (param.substr(0, 1) == L"/")
+			throw invalid_argument("unrecognized option");
+		else if (root.empty())
+			root = param;
+		else
+			throw invalid_argument("too many parameters");
+	}
+	if (root.empty())
+		root = Fs().CurrentDir();
+
+	auto begin_time = high_resolution_clock::now();
+	DirItem root_item = Fs().GetItem(root);
+	if (root_item.type != DirItem::Dir)
+		throw MyException{ L"Directory not found: '<path>'", root.native(), ERROR_PATH_NOT_FOUND };
+
+	TreeWalker walker(threads);
+	vector<Usage> usage(walker.Threads());
+	walker.Walk({ root_item }, [&](const DirItem& item, int thread) {
+		if (item.type != DirItem::Stream)
+			return;
+		Usage& u = usage[thread];
+		wstring_view path = item.name.native();
+		size_t sep = path.find_last_of(L"\\/");
+		wstring_view dir = sep == wstring_view::npos ? wstring_view() : path.substr(0, sep);
+		wstring_view name = path.substr(path.rfind(L':') + 1);
+		u.total.Add(item.size);
+		u.dirs[wstring(dir)].Add(item.size);
+		NameTotal& nt = u.names[fold_name(name)];
+		if (nt.name.empty())
+			nt.name = name;
+		nt.Add(item.size);
+		u.histogram[Bucket(item.size)].Add(item.size);
+	});
+	Usage all;
+	for (auto& u : usage)
+	{
+		all.Add(u);
+		u = Usage();
+	}
+
+	// subtotals of subtrees up to depth: every directory adds to its ancestors
+	wstring base = root.native();
+	while (base.size() > 1 && (base.back() == L'\\' || base.back() == L'/'))
+		base.pop_back();
+	map<wstring, Total, PathLess> subtrees; // relative path, "" - the root
+	subtrees[L""];
+	for (auto& [dir, t] : all.dirs)
+	{
+		wstring_view rel = wstring_view(dir).substr(min(dir.size(), base.size()));
+		if (!rel.empty() && (rel[0] == L'\\' || rel[0] == L'/'))
+			rel.remove_prefix(1);
+		subtrees[L""].Add(t);
+		size_t pos = 0;
+		for (int level = 1; level <= depth && pos < rel.size(); ++level)
+		{
+			size_t end = rel.find_first_of(L"\\/", pos);
+			if (end == wstring_view::npos)
+				end = rel.size();
+			subtrees[wstring(rel.substr(0, end))].Add(t);
+			pos = end + 1;
+		}
+	}
+
+	vector<NameTotal> names;
+	for (auto& [key, t] : all.names)
+		names.push_back(t);
+	size_t shown = min(top, names.size());
+	partial_sort(names.begin(), names.begin() + shown, names.end(), [](const NameTotal& a, const NameTotal& b) { return a.bytes > b.bytes; });
+	names.resize(shown);
+	duration<double> time_span = high_resolution_clock::now() - begin_time;
+
+	auto level_of = [](const wstring& rel) {
+		return rel.empty() ? 0 : 1 + (int)count_if(rel.begin(), rel.end(), [](wchar_t c) { return c == L'\\' || c == L'/'; });
+	};
+	if (json)
+	{
+		wcout << L"{\"root\":" << Json(base) << L",\"streams\":" << all.total.count << L",\"bytes\":" << all.total.bytes
+			<< L",\"files\":" << walker.Files() << L",\"dirs\":" << walker.Dirs() << L",\"sec\":" << time_span.count() << L",\"subtrees\":[";
+		const wchar_t* comma = L"";
+		for (auto& [rel, t] : subtrees)
+		{
+			wcout << comma << L"{\"path\":" << Json(rel) << L",\"level\":" << level_of(rel) << L",\"streams\":" << t.count << L",\"bytes\":" << t.bytes << L"}";
+			comma = L",";
+		}
+		wcout << L"],\"histogram\":[";
+		comma = L"";
+		for (int b = 0; b < Buckets; ++b)
+		{
+			if (!all.histogram[b].count)
+				continue;
+			ULONGLONG from = b ? 1ULL << (b - 1) : 0;
+			wcout << comma << L"{\"min\":" << from << L",\"count\":" << all.histogram[b].count << L",\"bytes\":" << all.histogram[b].bytes << L"}";
+			comma = L",";
+		}
+		wcout << L"],\"names\":[";
+		comma = L"";
+		for (auto& nt : names)
+		{
+			wcout << comma << L"{\"name\":" << Json(nt.name) << L",\"streams\":" << nt.count << L",\"bytes\":" << nt.bytes << L"}";
+			comma = L",";
+		}
+		wcout << L"]}" << endl;
+		return 0;
+	}
+
+	wcout << base << L": " << all.total.count << L" streams, " << FileSizeStr(all.total.bytes) << L" bytes in "
+		<< walker.Files() << L" files of " << walker.Dirs() << L" directories (" << time_span.count() << L" sec)\n\n";
+	wcout << L"Subtrees:\n" << setw(19) << L"bytes" << setw(12) << L"streams" << L"  path\n";
+	for (auto& [rel, t] : subtrees) // parents go before their children
+	{
+		int level = level_of(rel);
+		wcout << setw(19) << FileSizeStr(t.bytes) << setw(12) << t.count << L"  " << Indent(level)
+			<< (rel.empty() ? L"." : filename_of(rel)) << L"\n";
+	}
+	wcout << L"\nSizes of streams:\n" << setw(19) << L"from" << setw(12) << L"streams" << setw(19) << L"bytes" << L"\n";
+	for (int b = 0; b < Buckets; ++b)
+		if (all.histogram[b].count)
+			wcout << setw(19) << FileSizeStr(b ? 1ULL << (b - 1) : 0) << setw(12) << all.histogram[b].count
+				<< setw(19) << FileSizeStr(all.histogram[b].bytes) << L"\n";
+	if (!names.empty())
+	{
+		wcout << L"\nNames of streams:\n" << setw(19) << L"bytes" << setw(12) << L"streams" << L"  name\n";
+		for (auto& nt : names)
+			wcout << setw(19) << FileSizeStr(nt.bytes) << setw(12) << nt.count << L"  " << nt.name << L"\n";
+	}
+	wcout << flush;
+	return 0;
+}
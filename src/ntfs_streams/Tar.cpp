@@ -18,17 +18,26 @@
 #include "Tar.h"
 #include "ntfs_streams.h"
 #include "CommonFunc.h"
-#include "FileSimple.h"
-#include "ConsoleColor.h"
+#include "FsBackend.h"
+#include "AlignedBuffer.h"
+#include "Reporter.h"
+#include "Stats.h"
+#include "Trace.h"
 #include "UnicodeFuncts.h"
+#include "MaskSet.h"
 #include "aes.h"
 #include "shaker.h"
 #include "sha1.h"
+#include "Simd.h"
 #include <tchar.h>
 #include <iostream>
 #include <random>
 #include <ratio>
 #include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <optional>
 
 using namespace std;
 using namespace std::chrono;
@@ -47,7 +56,17 @@ namespace
 		wcout << L"  /t             - test: valid console output but tar-file is not created\n";
 	//	wcout << L"  /b:size        - divide output in blocks of specified size, suffixes K, M, G\n";
 		wcout << L"  /p:password    - password to encrypt tar-file\n";
-		wcout << L"  /e:mask1;mask2 - masks to exclude files or directories\n";
+		wcout << L"  /e:mask1;mask2 - masks to exclude files or directories, e.g. *.obj or proj\\**\\Debug\n";
+		wcout << L"                   masks with '\\' are paths in tar-file, '**' is any number of directories\n";
+		wcout << L"  /j:threads     - number of threads to read big files, default 4, 1 - sequential read\n";
+		wcout << L"  /z             - blocks of zeros are stored as holes too (holes of sparse files always are)\n";
+		wcout << L"  /d             - direct I/O: tar-file is written bypassing file cache\n";
+		wcout << L"  /d:all         - direct I/O for tar-file and for files being added\n";
+		wcout << L"  /q /s /v       - output: quiet (only errors), summary (progress line), verbose (all items, default)\n";
+		wcout << L"  /stats         - show time, bytes and calls of every stage at the end\n";
+		wcout << L"  /stats:json    - the same in JSON format\n";
+		wcout << L"  /si:sec        - write stats in JSON to stderr every sec seconds\n";
+		wcout << L"  /trace:file    - write events of all threads to file in Chrome trace format (ui.perfetto.dev)\n";
 		return 0;
 	}
 
@@ -62,6 +81,12 @@ namespace
 		wcout << L"  /o             - overwrite existing files\n";
 		wcout << L"  /p:password    - password to decrypt tar-file\n";
 		wcout << L"  /f:sym         - write streams as files, sym replaces ':'\n";
+		wcout << L"  /d             - direct I/O: tar-file is read bypassing file cache\n";
+		wcout << L"  /q /s /v       - output: quiet (only errors), summary (progress line), verbose (all items, default)\n";
+		wcout << L"  /stats         - show time, bytes and calls of every stage at the end\n";
+		wcout << L"  /stats:json    - the same in JSON format\n";
+		wcout << L"  /si:sec        - write stats in JSON to stderr every sec seconds\n";
+		wcout << L"  /trace:file    - write events of all threads to file in Chrome trace format (ui.perfetto.dev)\n";
 		return 0;
 	}
 
@@ -70,22 +95,6 @@ namespace
 		return str.size() >= beg.size() && str.substr(0, beg.size()) == beg;
 	}
 
-	ULONGLONG ReadSize(wstring_view str)
-	{
-		wchar_t* e;
-		ULONGLONG ul = wcstoul(str.data(), &e, 10);
-		wstring_view suffix(e);
-		if (suffix == L"K" || suffix == L"k")
-			ul *= 1024;
-		else if (suffix == L"M" || suffix == L"m")
-			ul *= 1024 * 1024;
-		else if (suffix == L"G" || suffix == L"g")
-			ul *= 1024 * 1024 * 1024;
-		else if (suffix != L"")
-			throw invalid_argument("Invalid block size");
-		return ul;
-	}
-
 
 
 	template<class T>
@@ -112,6 +121,27 @@ namespace
 		return iv;
 	}
 
+	// counters of all stages, always collected (cost is small comparing to I/O)
+	Stats stats;
+
+	enum StatsOutput { NoStats, StatsTable, StatsJson };
+
+	void StartStats(int interval)
+	{
+		stats.Reset();
+		if (interval > 0)
+			stats.StartSnapshots(interval);
+	}
+
+	void ShowStats(StatsOutput output)
+	{
+		stats.StopSnapshots();
+		if (output == StatsTable)
+			wcout << endl << stats.Table();
+		else if (output == StatsJson)
+			wcout << stats.Json() << endl;
+	}
+
 	class ITarWriter
 	{
 	public:
@@ -131,11 +161,16 @@ namespace
 		ULONGLONG written_current = 0;
 		DWORD current_part = 0;
 		bool write_to_stream;
-		FileSimple fs;
+		bool direct;
+		unique_ptr<IFsFile> file;
+		AlignedBuffer block;   // direct mode: data are written by whole aligned blocks
+		DWORD block_count = 0; // bytes in block
 	public:
-		TarWriterFiles(filesystem::path name, ULONGLONG part_size)
-			:name(name), part_size(part_size), write_to_stream(is_stream_name(name.c_str()))
+		TarWriterFiles(filesystem::path name, ULONGLONG part_size, bool direct = false)
+			:name(name), part_size(part_size), write_to_stream(is_stream_name(name.c_str())), direct(direct)
 		{
+			if (direct)
+				block = AlignedBuffer(AlignedBufferPool::Default().BlockSize());
 		}
 		virtual bool IsMyFile(const filesystem::path& path, bool is_stream)
 		{
@@ -144,21 +179,63 @@ namespace
 			if (name == path)
 				return true;
 			std::error_code ec;
-			return filesystem::equivalent(name, path, ec);
+			return Fs().IsNative() && filesystem::equivalent(name, path, ec);
 		}
 		virtual void Write(const void* buf, DWORD size) override
 		{
-			if (!fs.IsOpen()) {
-				if(!fs.Open(name.c_str(), true, true))
+			if (!file) {
+				file = Fs().Open(name.c_str(), direct ? IFsBackend::CreateDirect : IFsBackend::Create);
+				if (!file)
 					throw MyException{ L"Failed to create '<path>': <err>", name.c_str(), GetLastError() };
 				// do not write signature
 				//if (fs.Write("star", 4) != 4)
 				//	throw MyException{ L"Failed to write to '<path>': <err>", name.c_str(), GetLastError() };
 				//written_total += 4;
 			}
-			if (fs.Write(buf, size) != size)
-				throw MyException{ L"Failed to write to '<path>': <err>", name.c_str(), GetLastError() };
 			written_total += size;
+			if (!direct) {
+				WriteFile(buf, size);
+				return;
+			}
+			const uint8_t* ptr = (const uint8_t*)buf;
+			if (block_count == 0 && size >= block.size() && AlignedBuffer::IsAligned(ptr)) {
+				// aligned source (e.g. ranges of big files), can be written without copying
+				DWORD whole = (DWORD)AlignedBuffer::AlignDown(size);
+				WriteFile(ptr, whole);
+				ptr += whole;
+				size -= whole;
+			}
+			while (size) {
+				DWORD part = min(size, block.size() - block_count);
+				memcpy(block.data() + block_count, ptr, part);
+				block_count += part;
+				ptr += part;
+				size -= part;
+				if (block_count == block.size()) {
+					WriteFile(block.data(), block_count);
+					block_count = 0;
+				}
+			}
+		}
+		virtual void Flush() override
+		{
+			if (!direct || !block_count)
+				return;
+			// unbuffered file can be written only by whole sectors: write tail with zeros and cut it then
+			DWORD padded = (DWORD)AlignedBuffer::AlignUp(block_count);
+			memset(block.data() + block_count, 0, padded - block_count);
+			WriteFile(block.data(), padded);
+			block_count = 0;
+			file.reset();
+			if (!Fs().SetLength(name.c_str(), written_total))
+				throw MyException{ L"Failed to write to '<path>': <err>", name.c_str(), GetLastError() };
+		}
+	protected:
+		void WriteFile(const void* buf, DWORD size)
+		{
+			StageTimer timer(stats, Stage::TarWrite, size);
+			if (file->Write(buf, size) != size)
+				throw MyException{ L"Failed to write to '<path>': <err>", name.c_str(), GetLastError() };
 		}
 	};
 	class TarWriterTest : public ITarWriter
@@ -228,6 +305,7 @@ namespace
 		}
 		virtual void Write(const void* buf, DWORD size) override
 		{
+			StageTimer timer(stats, Stage::Crypt, size);
 			if (data_count == 16) { // buffer can be full if it contains IV
 				dst->Write(data, 16);
 				data_count = 0;
@@ -273,6 +351,7 @@ namespace
 		}
 		virtual void Write(const void* buf, DWORD size) override
 		{
+			StageTimer timer(stats, Stage::Crypt, size);
 			const uint8_t* ptr = (const uint8_t*)buf;
 			while (size) {
 				if (size + data_count < 32) {
@@ -316,6 +395,136 @@ namespace
 
 
 
+	// files of this size and bigger are read by RangeReader
+	const ULONGLONG ParallelReadMin = 64 * 1024 * 1024;
+	int read_threads = 4;
+	bool direct_sources = false; // read files to archive bypassing file cache
+	bool zero_blocks = false;    // blocks of zeros are stored as holes
+	const DWORD ZeroBlock = 4096;
+	const ULONGLONG SparseMin = 64 * 1024; // smaller files are not checked for holes
+
+	bool IsZero(const uint8_t* data, DWORD size)
+	{
+		DWORD i = 0;
+#ifdef USE_SSE2
+		__m128i acc = _mm_setzero_si128();
+		for (; i + 64 <= size; i += 64)
+		{
+			acc = _mm_or_si128(acc, _mm_or_si128(_mm_loadu_si128((const __m128i*)(data + i)), _mm_loadu_si128((const __m128i*)(data + i + 16))));
+			acc = _mm_or_si128(acc, _mm_or_si128(_mm_loadu_si128((const __m128i*)(data + i + 32)), _mm_loadu_si128((const __m128i*)(data + i + 48))));
+		}
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(acc, _mm_setzero_si128())) != 0xFFFF)
+			return false;
+#endif
+		for (; i < size; ++i)
+			if (data[i])
+				return false;
+		return true;
+	}
+
+	Reporter reporter;
+
+	// reads a big file by ranges in several threads (each has its own handle)
+	// and returns the ranges in the original order
+	class RangeReader
+	{
+	public:
+		static const DWORD ChunkSize = 4 * 1024 * 1024;
+
+		RangeReader(const wchar_t* src, ULONGLONG total, int threads)
+			: src(src), total(total), slots(threads * 2)
+		{
+			for (auto& slot : slots)
+				slot.data = AlignedBuffer(ChunkSize);
+			for (int i = 0; i < threads; ++i)
+				workers.emplace_back(&RangeReader::Work, this, i, threads);
+		}
+		~RangeReader()
+		{
+			{
+				lock_guard<mutex> lock(mtx);
+				stop = true;
+			}
+			cv.notify_all();
+			for (auto& t : workers)
+				t.join();
+		}
+		// next range of the file, nullptr at the end
+		const uint8_t* Next(DWORD& size)
+		{
+			unique_lock<mutex> lock(mtx);
+			if (next_chunk) { // previous range is consumed, its slot can be reused
+				slots[(next_chunk - 1) % slots.size()].busy = false;
+				cv.notify_all();
+			}
+			if (next_chunk * ChunkSize >= total)
+				return nullptr;
+			Slot& slot = slots[next_chunk % slots.size()];
+			ULONGLONG chunk = next_chunk++;
+			cv.wait(lock, [&] { return slot.ready && slot.chunk == chunk; });
+			if (slot.error)
+				throw MyException{ L"Failed to read '<path>': <err>", src, slot.error };
+			size = slot.size;
+			return slot.data.data();
+		}
+	protected:
+		void Work(int first, int step)
+		{
+			auto file = Fs().Open(src, direct_sources ? IFsBackend::ReadDirect : IFsBackend::Read);
+			DWORD open_error = file ? 0 : GetLastError();
+			for (ULONGLONG chunk = first; chunk * ChunkSize < total; chunk += step)
+			{
+				Slot& slot = slots[chunk % slots.size()];
+				{
+					unique_lock<mutex> lock(mtx);
+					cv.wait(lock, [&] { return stop || !slot.busy; });
+					if (stop)
+						return;
+					slot.busy = true;
+					slot.ready = false;
+					slot.chunk = chunk;
+				}
+				ULONGLONG offset = chunk * ChunkSize;
+				DWORD size = (DWORD)min<ULONGLONG>(ChunkSize, total - offset);
+				DWORD request = direct_sources ? (DWORD)AlignedBuffer::AlignUp(size) : size; // unbuffered: whole sectors
+				DWORD error = open_error;
+				if (!error) {
+					StageTimer timer(stats, Stage::Read, size);
+					if (file->ReadAt(offset, slot.data.data(), request) < size)
+						error = GetLastError() ? GetLastError() : ERROR_HANDLE_EOF;
+					stats.read_latency.Add(stats.Microseconds(timer.Elapsed()));
+				}
+				{
+					lock_guard<mutex> lock(mtx);
+					slot.size = size;
+					slot.error = error;
+					slot.ready = true;
+				}
+				cv.notify_all();
+				if (error)
+					return;
+			}
+		}
+
+		struct Slot
+		{
+			AlignedBuffer data;
+			ULONGLONG chunk = 0;
+			DWORD size = 0;
+			DWORD error = 0;
+			bool busy = false;  // taken by worker and not yet consumed
+			bool ready = false; // data is read
+		};
+		const wchar_t* src;
+		ULONGLONG total;
+		ULONGLONG next_chunk = 0;
+		vector<Slot> slots;
+		vector<thread> workers;
+		mutex mtx;
+		condition_variable cv;
+		bool stop = false;
+	};
+
 	class ITarReader
 	{
 	public:
@@ -326,10 +535,17 @@ namespace
 
 	class FileReader : public ITarReader
 	{
-		FileSimple &fs;
+		IFsFile &fs;
 		const wchar_t* name;
 	public:
-		FileReader(FileSimple &fs, const wchar_t* name) : fs(fs), name(name) {}
+		FileReader(IFsFile &fs, const wchar_t* name, bool direct = false) : fs(fs), name(name)
+		{
+			if (direct) { // unbuffered file is read to aligned memory by whole sectors
+				direct_buf.emplace();
+				data = direct_buf->data();
+				data_size = direct_buf->size();
+			}
+		}
 		virtual void Read(void* buf, DWORD size) override
 		{
 			uint8_t* ptr = (uint8_t*)buf;
@@ -348,13 +564,22 @@ namespace
 				}
 				// size > 0
 				data_read = 0;
-				data_count = fs.Read(data, sizeof(data));
+				{
+					StageTimer timer(stats, Stage::TarRead);
+					data_count = fs.Read(data, data_size);
+					timer.AddBytes(data_count);
+					stats.read_latency.Add(stats.Microseconds(timer.Elapsed()));
+				}
 				if(!data_count)
 					throw MyException{ L"Failed to read '<path>': <err>", name, GetLastError() };
+				reporter.AddInput(data_count);
 			}
 		}
 	protected:
-		uint8_t data[4 * 1024];
+		uint8_t local_data[4 * 1024];
+		optional<PooledBuffer> direct_buf;
+		uint8_t* data = local_data;
+		DWORD data_size = sizeof(local_data);
 		DWORD data_count = 0; // bytes in buffer
 		DWORD data_read = 0;  // consumed bytes
 	};
@@ -368,6 +593,7 @@ namespace
 		}
 		virtual void Read(void* buf, DWORD size) override
 		{
+			StageTimer timer(stats, Stage::Crypt, size);
 			if (read_iv) {
 				src->Read(data, 16);
 				aes.reset_iv(data);
@@ -408,6 +634,7 @@ namespace
 		}
 		virtual void Read(void* buf, DWORD size) override
 		{
+			StageTimer timer(stats, Stage::Crypt, size);
 			uint8_t* ptr = (uint8_t*)buf;
 			while (size) {
 				if (data_count >= size) {
@@ -438,139 +665,180 @@ namespace
 static const char BeginDir    = 'D'; // DirItem info, files, EndDir
 static const char BeginFile   = 'F'; // DirItem info, data, streams, EndFile
 static const char BeginStream = 'S'; // DirItem info, data
+static const char SparseFile   = 'P'; // as BeginFile, data as segments (see WriteSparseData)
+static const char SparseStream = 'Q'; // as BeginStream, data as segments
 static const char EndFile     = 'f';
 static const char EndDir      = 'd';
 static const char EndArchive  = 'a';
 
-void WriteTarDirectory(ITarWriter * writer, const DirItem& item, const vector<wstring>& exclude, const filesystem::path& rel_path, const wstring& prefix);
-void WriteTarFile(ITarWriter * writer, const DirItem& item, const vector<wstring>& exclude, const filesystem::path& rel_path, const wstring& prefix);
-void WriteTarStream(ITarWriter * writer, const DirItem& item, const filesystem::path& rel_path, const wstring& prefix);
-
-void TarFiles(ITarWriter * writer, experimental::generator<DirItem>&& items, const vector<wstring>& exclude,
-	const filesystem::path& rel_path, const wstring& prefix)
-{
-	for (auto& it : items)
-	{
-		if (mask_match(it.name.filename().c_str(), exclude))
-			continue;
-		switch (it.type)
-		{
-		case DirItem::Dir:
-			WriteTarDirectory(writer, it, exclude, rel_path, prefix);
-			break;
-		case DirItem::File:
-			WriteTarFile(writer, it, exclude, rel_path, prefix);
-			break;
-		case DirItem::Stream:
-			WriteTarStream(writer, it, rel_path, prefix);
-			break;
-		case DirItem::Invalid: {
-			// if filename is given in command line and does not exist or just deleted after being listed
-			ConsoleColor cc(FOREGROUND_RED);
-			wcout << prefix << L"* " << it.name.c_str() << L"  *** not found *** " << endl;
-			}
-			break;
-		}
-	}
-}
-
-void WriteDirItem(ITarWriter * writer, const DirItem& di)
+void WriteDirItem(ITarWriter * writer, const DirItem& di, bool sparse = false)
 {
 	switch (di.type) {
 	case DirItem::Dir:
 		writer->Write(BeginDir);
 		break;
 	case DirItem::File:
-		writer->Write(BeginFile);
+		writer->Write(sparse ? SparseFile : BeginFile);
 		writer->Write(di.size);
 		writer->Write(di.dwFileAttributes);
 		writer->Write(di.ftLastWriteTime);
 		break;
 	case DirItem::Stream:
-		writer->Write(BeginStream);
+		writer->Write(sparse ? SparseStream : BeginStream);
 		writer->Write(di.size);
 		break;
 	default: return;
 	}
 
-	std::string name_utf8 = ToChar(di.name.filename().c_str(), CP_UTF8); // CP_ACP, 
+	static std::string name_utf8; // reused for all items
+	ToChar(filename_of(di.name), CP_UTF8, name_utf8); // CP_ACP, 
 	WORD wlen = (WORD)name_utf8.size();
 	writer->Write(wlen);
 	writer->Write(name_utf8.c_str(), wlen);
 }
 
-void WriteData(ITarWriter * writer, FileSimple& fs, ULONGLONG total, const filesystem::path& src)
+unique_ptr<IFsFile> OpenSource(const wchar_t* src)
+{
+	StageTimer timer(stats, Stage::Open);
+	auto file = Fs().Open(src, direct_sources ? IFsBackend::ReadDirect : IFsBackend::Read);
+	stats.open_latency.Add(stats.Microseconds(timer.Elapsed()));
+	return file;
+}
+
+void WriteData(ITarWriter * writer, IFsFile& fs, ULONGLONG total, const wchar_t* src, const PooledBuffer& buf)
 {
+	if (total >= ParallelReadMin && read_threads > 1)
+	{
+		RangeReader ranges(src, total, read_threads);
+		DWORD size;
+		while (const uint8_t* data = ranges.Next(size)) {
+			writer->Write(data, size);
+			reporter.AddData(size);
+		}
+		return;
+	}
 	while (total != 0)
 	{
-		BYTE buf[64 * 1024];
 		SetLastError(0);
-		ULONGLONG to_read = sizeof(buf);
-		if (to_read > total)
-			to_read = total;
-		DWORD dwBytesRead = fs.Read(buf, (DWORD)to_read);
-		if (dwBytesRead != (DWORD)to_read)
-			throw MyException{ L"Failed to read '<path>': <err>", src.c_str(), GetLastError() };
-		writer->Write(buf, dwBytesRead);
+		DWORD to_read = (DWORD)min<ULONGLONG>(buf.size(), total);
+		// unbuffered file is read by whole sectors
+		DWORD request = direct_sources ? (DWORD)AlignedBuffer::AlignUp(to_read) : to_read;
+		DWORD dwBytesRead;
+		{
+			StageTimer timer(stats, Stage::Read, to_read);
+			dwBytesRead = fs.Read(buf.data(), request);
+			stats.read_latency.Add(stats.Microseconds(timer.Elapsed()));
+		}
+		if (dwBytesRead < to_read)
+			throw MyException{ L"Failed to read '<path>': <err>", src, GetLastError() };
+		writer->Write(buf.data(), to_read);
+		reporter.AddData(to_read);
 		total -= to_read;
 	}
 }
 
-void PrintFileData(const DirItem& item, const filesystem::path& rel_path, const wstring& prefix)
+void WriteSegment(ITarWriter * writer, ULONGLONG hole, const uint8_t* data, DWORD size)
+{
+	writer->Write(hole);
+	writer->Write(size);
+	writer->Write(data, size);
+	reporter.AddData(size);
+}
+
+// Only allocated ranges are read. Data are written as segments: a hole (can be 0)
+// and data after it (DWORD size and bytes), till the whole size is covered;
+// the last hole has no data. With /z blocks of zeros become holes too.
+void WriteSparseData(ITarWriter * writer, IFsFile& fs, const vector<IFsFile::Range>& ranges, ULONGLONG total,
+	const wchar_t* src, const PooledBuffer& buf)
 {
-	WORD wColor =
-		item.type == DirItem::Stream ? FOREGROUND_GREEN | FOREGROUND_BLUE :
-		item.type == DirItem::Dir ? FOREGROUND_RED | FOREGROUND_GREEN :
-		FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE;
-	ConsoleColor cc(wColor);
-	//wcout << prefix << L"+ " << item.name.c_str() << endl;
-	//wcout << prefix << L"+ " << (rel_path / item.name.filename()).c_str() << endl;
-	auto sign = item.type == DirItem::Dir ? L"> " : L"+ ";
-	wcout << prefix << sign << item.name.filename().c_str();
-	//wcout << prefix << sign << item.name.c_str();
-	//wcout << prefix << sign << rel_path << L"   " << item.name.filename().c_str();
-	if(item.type != DirItem::Dir)
-		wcout << L"   " << item.size;
-	wcout << endl;
+	ULONGLONG pos = 0, hole = 0;
+	for (auto& range : ranges)
+	{
+		if (range.offset < pos || range.offset >= total)
+			continue;
+		hole += range.offset - pos;
+		pos = range.offset;
+		for (ULONGLONG end = min(total, range.offset + range.length); pos < end; )
+		{
+			DWORD to_read = (DWORD)min<ULONGLONG>(buf.size(), end - pos);
+			// unbuffered file is read by whole sectors, ranges are by clusters
+			DWORD request = direct_sources ? (DWORD)AlignedBuffer::AlignUp(to_read) : to_read;
+			DWORD dwBytesRead;
+			{
+				StageTimer timer(stats, Stage::Read, to_read);
+				dwBytesRead = fs.ReadAt(pos, buf.data(), request);
+				stats.read_latency.Add(stats.Microseconds(timer.Elapsed()));
+			}
+			if (dwBytesRead < to_read)
+				throw MyException{ L"Failed to read '<path>': <err>", src, GetLastError() };
+			DWORD from = 0; // data not written yet
+			for (DWORD block = 0; zero_blocks && block < to_read; block += ZeroBlock)
+			{
+				DWORD size = min(ZeroBlock, to_read - block);
+				if (!IsZero(buf.data() + block, size))
+					continue;
+				if (block > from) {
+					WriteSegment(writer, hole, buf.data() + from, block - from);
+					hole = 0;
+				}
+				hole += size;
+				from = block + size;
+			}
+			if (from < to_read) {
+				WriteSegment(writer, hole, buf.data() + from, to_read - from);
+				hole = 0;
+			}
+			pos += to_read;
+		}
+	}
+	hole += total - pos;
+	if (hole)
+		WriteSegment(writer, hole, nullptr, 0);
 }
 
-void WriteTarDirectory(ITarWriter * writer, const DirItem& item, const vector<wstring>& exclude,
-	const filesystem::path& rel_path, const wstring& prefix)
+// sparse, if there are holes (or /z), then ranges are the allocated ones
+bool IsSparse(IFsFile& fs, ULONGLONG total, vector<IFsFile::Range>& ranges)
 {
-	PrintFileData(item, rel_path, prefix);
-	WriteDirItem(writer, item);
-//	TarFiles(writer, directory_items(item.name), exclude, rel_path / item.name.filename(), prefix + L"  ");
-	TarFiles(writer, get_files(item.name), exclude, rel_path / item.name.filename(), prefix + L"  ");
-	//wcout << L"end " << item.c_str() << endl;
-	writer->Write(EndDir);
+	if (total < SparseMin)
+		return false;
+	ranges = fs.AllocatedRanges(total);
+	return zero_blocks || ranges.size() != 1 || ranges[0].offset != 0 || ranges[0].length < total;
 }
 
+void PrintFileData(const DirItem& item, wstring_view prefix)
+{
+	reporter.Entry(item.type, prefix, filename_of(item.name), item.size);
+}
 
-void WriteTarFile(ITarWriter * writer, const DirItem& item, const vector<wstring>& exclude, const filesystem::path& rel_path, const wstring& prefix)
+bool WriteTarFile(ITarWriter * writer, const DirItem& item, size_t level, const PooledBuffer& buf)
 {
 	if (writer->IsMyFile(item.name, false)) // do not add tar itself to the tar
-		return;
+		return false;
 
-	PrintFileData(item, rel_path, prefix);
+	PrintFileData(item, Indent(level));
 
-	FileSimple fs(item.name.c_str());
-	if (!fs.IsOpen())
+	TraceScope trace(L"file", item.name.native());
+	trace.AddBytes(item.size);
+	auto fs = OpenSource(item.name.c_str());
+	if (!fs)
 	{
-		ConsoleColor cc(FOREGROUND_RED);
-		wcout << prefix << L"* " << item.name.c_str() << L"  *** failed to open *** " << endl;
-		return;
+		reporter.Error(Indent(level), item.name.native(), L"failed to open");
+		return false;
 	}
-	WriteDirItem(writer, item);
+	vector<IFsFile::Range> ranges;
+	bool sparse = IsSparse(*fs, item.size, ranges);
+	WriteDirItem(writer, item, sparse);
 	// GetFileInformationByHandle  BY_HANDLE_FILE_INFORMATION
-	WriteData(writer, fs, item.size, item.name);
-	//	write streams
-	TarFiles(writer, get_streams(item.name, L""), exclude, rel_path, prefix);
-	writer->Write(EndFile);
+	if (sparse)
+		WriteSparseData(writer, *fs, ranges, item.size, item.name.c_str(), buf);
+	else
+		WriteData(writer, *fs, item.size, item.name.c_str(), buf);
+	return true; // streams and EndFile follow
 }
 
-wstring CorrectDirStreamName(const filesystem::path& str_path)
+const wchar_t* CorrectDirStreamName(const filesystem::path& str_path, wstring& fn) // fn - buffer for result
 {
-	wstring fn = str_path.c_str();
+	fn = str_path.native();
 	// directory name "dir\\:stream" -> "dir:stream"
 	// but ".\\:stream" is ok and -> ".:stream" is invalid
 	// ex1\..\:dirstr.tx3 is valid
@@ -578,26 +846,110 @@ wstring CorrectDirStreamName(const filesystem::path& str_path)
 	auto ix = fn.find(L"\\:");
 	if (ix != wstring::npos && !(ix > 0 && fn[ix-1] == '.')) // ".\\:" is ok, "\\:" must be replaced
 		fn.erase(ix, 1);
-	return fn;
+	return fn.c_str();
 }
 
-void WriteTarStream(ITarWriter * writer, const DirItem& item, const filesystem::path& rel_path, const wstring& prefix)
+void WriteTarStream(ITarWriter * writer, const DirItem& item, size_t level, const PooledBuffer& buf)
 {
 	if (writer->IsMyFile(item.name, true)) // do not add tar itself to the tar
 		return;
 
-	PrintFileData(item, rel_path, prefix);
+	PrintFileData(item, Indent(level));
 
-	wstring fn = CorrectDirStreamName(item.name);
-	FileSimple fs(fn.c_str());
-	if (!fs.IsOpen())
+	static wstring fn; // reused for all streams
+	CorrectDirStreamName(item.name, fn);
+	TraceScope trace(L"stream", fn);
+	trace.AddBytes(item.size);
+	auto fs = OpenSource(fn.c_str());
+	if (!fs)
 	{
-		ConsoleColor cc(FOREGROUND_RED);
-		wcout << prefix << L"* " << fn << L"  *** failed to open *** " << endl;
+		reporter.Error(Indent(level), fn, L"failed to open");
 		return;
 	}
-	WriteDirItem(writer, item);
-	WriteData(writer, fs, item.size, item.name);
+	vector<IFsFile::Range> ranges;
+	bool sparse = IsSparse(*fs, item.size, ranges);
+	WriteDirItem(writer, item, sparse);
+	if (sparse)
+		WriteSparseData(writer, *fs, ranges, item.size, fn.c_str(), buf);
+	else
+		WriteData(writer, *fs, item.size, fn.c_str(), buf);
+}
+
+// Level of the tree being written: items of a directory or streams of a file
+struct TarFrame
+{
+	experimental::generator<DirItem> items;
+	experimental::generator<DirItem>::iterator current;
+	char end_tag;    // EndDir, EndFile, or 0 for the top level
+	size_t level;
+	size_t root;     // where the path in the archive begins in names, npos for the top level
+};
+
+void TarFiles(ITarWriter * writer, experimental::generator<DirItem>&& items, const MaskSet& exclude)
+{
+	// the tree is walked with explicit stack (not recursion), so depth of the tree
+	// does not affect the thread stack; data of all files go through the same buffer
+	PooledBuffer buf;
+	vector<TarFrame> stack;
+	auto push = [&stack](experimental::generator<DirItem>&& items, char end_tag, size_t level, size_t root) {
+		stack.push_back(TarFrame{ move(items), {}, end_tag, level, root });
+		StageTimer timer(stats, Stage::Enumerate);
+		stack.back().current = stack.back().items.begin();
+	};
+	auto next = [](TarFrame& frame) {
+		StageTimer timer(stats, Stage::Enumerate);
+		++frame.current;
+	};
+	push(move(items), 0, 0, wstring::npos);
+
+	while (!stack.empty())
+	{
+		TarFrame& frame = stack.back();
+		if (frame.current == frame.items.end())
+		{
+			if (frame.end_tag)
+				writer->Write(frame.end_tag);
+			stack.pop_back();
+			if (!stack.empty())
+				next(stack.back()); // item (directory or file) of the parent level is done
+			continue;
+		}
+		// the item must stay valid while its children are written, so the parent
+		// generator is advanced only after the child level is finished
+		const DirItem& it = *frame.current;
+		size_t level = frame.level;
+		bool has_children = false;
+		// masks with paths are matched against the path in the archive, e.g. "proj\obj\x.o"
+		size_t root = frame.root != wstring::npos ? frame.root : filename_of(it.name) - it.name.c_str();
+		if (!exclude.Match(wstring_view(it.name.native()).substr(root)))
+		{
+			switch (it.type)
+			{
+			case DirItem::Dir:
+				PrintFileData(it, Indent(level));
+				WriteDirItem(writer, it);
+			//	push(directory_items(it.name), EndDir, level + 1);
+				push(Fs().ListDir(it.name), EndDir, level + 1, root);
+				has_children = true;
+				break;
+			case DirItem::File:
+				if (WriteTarFile(writer, it, level, buf)) {
+					push(Fs().ListStreams(it.name, L""), EndFile, level, root);
+					has_children = true;
+				}
+				break;
+			case DirItem::Stream:
+				WriteTarStream(writer, it, level, buf);
+				break;
+			case DirItem::Invalid:
+				// if filename is given in command line and does not exist or just deleted after being listed
+				reporter.Error(Indent(level), it.name.native(), L"not found");
+				break;
+			}
+		}
+		if (!has_children)
+			next(frame);
+	}
 }
 
 array<uint8_t, 16> digest_to_key(const array<uint8_t, 20>& digest)
@@ -616,11 +968,18 @@ int Tar(int argc, TCHAR **argv)
 		return ShowHelpTar(filesystem::path(argv[0]).filename());
 
 	bool test = false;
+	bool direct = false;
+	Reporter::Mode output = Reporter::Verbose;
+	StatsOutput stats_output = NoStats;
+	int stats_interval = 0;
+	wstring trace_file;
 	ULONGLONG part_size = 0;
 	wstring pass;
 	filesystem::path tarname;
 	std::vector<wstring> exclude;
 	std::vector<filesystem::path> items;
+	zero_blocks = direct_sources = false; // not as by a previous call, e.g. of bench
+	read_threads = 4;
 
 	for (int n = 2; n < argc; ++n)
 	{
@@ -633,6 +992,28 @@ int Tar(int argc, TCHAR **argv)
 			pass = param.substr(3);
 		else if (starts_with(param, L"/e:"))
 			exclude = split(param.substr(3), L';');
+		else if (starts_with(param, L"/j:"))
+			read_threads = max(1, _wtoi(param.substr(3).data()));
+		else if (param == L"/z")
+			zero_blocks = true;
+		else if (param == L"/d")
+			direct = true;
+		else if (param == L"/d:all")
+			direct = direct_sources = true;
+		else if (param == L"/q")
+			output = Reporter::Quiet;
+		else if (param == L"/s")
+			output = Reporter::Summary;
+		else if (param == L"/v")
+			output = Reporter::Verbose;
+		else if (param == L"/stats")
+			stats_output = StatsTable;
+		else if (param == L"/stats:json")
+			stats_output = StatsJson;
+		else if (starts_with(param, L"/si:"))
+			stats_interval = _wtoi(param.substr(4).data());
+		else if (starts_with(param, L"/trace:"))
+			trace_file = param.substr(7);
 		else if (starts_with(param, L"/"))
 			throw invalid_argument("unrecognized option");
 		else if (tarname.empty())
@@ -652,6 +1033,10 @@ int Tar(int argc, TCHAR **argv)
 		wcout << L", test";
 	if(part_size)
 		wcout << L", block size=" << part_size;
+	if (direct)
+		wcout << (direct_sources ? L", direct I/O for all files" : L", direct I/O");
+	if (zero_blocks)
+		wcout << L", zero blocks as holes";
 	if (!pass.empty())
 		wcout << L", pass=" << pass;
 	if (!exclude.empty())
@@ -663,16 +1048,16 @@ int Tar(int argc, TCHAR **argv)
 	wcout << endl << endl;
 
 	auto gen = items.empty() ?
-		get_files(filesystem::current_path()) : 
-		get_files_multi(items);
+		Fs().ListDir(Fs().CurrentDir()) :
+		Fs().ListItems(items);
 
 	unique_ptr<ITarWriter> writer(
 		test ? (ITarWriter*)new TarWriterTest() :
-		(ITarWriter*)new TarWriterFiles(tarname, part_size) );
+		(ITarWriter*)new TarWriterFiles(tarname, part_size, direct) );
 
 	ITarWriter * end_writer = writer.get();
 
-	if (!test)
+	if (!test && !direct) // direct writer has its own (aligned) buffer
 		writer = unique_ptr<ITarWriter>(new TarWriterBuffer(move(writer)));
 
 	if (!test && !pass.empty()) {
@@ -696,9 +1081,18 @@ int Tar(int argc, TCHAR **argv)
 
 	high_resolution_clock::time_point begin_time = high_resolution_clock::now();
 
-	TarFiles(writer.get(), std::move(gen), exclude, L"", L"");
-	writer->Write(EndArchive);
-	writer->Flush();
+	if (!trace_file.empty())
+		Trace::Enable();
+	StartStats(stats_interval);
+	{
+		ReporterSession session(reporter, output);
+		TarFiles(writer.get(), std::move(gen), MaskSet(exclude));
+		writer->Write(EndArchive);
+		writer->Flush();
+	}
+	ShowStats(stats_output);
+	if (!trace_file.empty())
+		Trace::Dump(trace_file.c_str());
 
 	high_resolution_clock::time_point end_time = high_resolution_clock::now();
 	duration<double> time_span = duration_cast<duration<double>>(end_time - begin_time);
@@ -714,70 +1108,112 @@ struct Options
 	wstring stream_separator;
 	bool test = false;
 	bool overwrite = false;
+	bool direct = false;
+	Reporter::Mode output = Reporter::Verbose;
+	StatsOutput stats_output = NoStats;
+	int stats_interval = 0;
+	wstring trace_file;
 };
 
 void EnsureDirectoryExists(const filesystem::path& dir)
 {
-	if (!filesystem::exists(dir))
-		filesystem::create_directories(dir);
-	else if(!filesystem::is_directory(dir))
+	DirItem::Type type = Fs().GetItem(dir).type;
+	if (type == DirItem::Invalid) {
+		if (!Fs().CreateDir(dir))
+			throw MyException{ L"Failed to create '<path>': <err>", dir.c_str(), GetLastError() };
+	}
+	else if (type != DirItem::Dir)
 		throw MyException{ L"Path is not a directory: '<path>'", dir.c_str(), 0 };
 }
 
-bool WriteTo(const wchar_t* dest, ITarReader* reader, ULONGLONG total, const Options& options, const wstring& prefix)
+bool WriteTo(const wchar_t* dest, ITarReader* reader, ULONGLONG total, bool sparse, const Options& options, wstring_view prefix,
+	const PooledBuffer& buf)
 {
 	// wcout << dest << endl;
-	FileSimple fs_out;
+	TraceScope trace(L"entry", dest);
+	trace.AddBytes(total);
+	unique_ptr<IFsFile> fs_out;
 	if (!options.test)
 	{
 		const wchar_t* msg = nullptr;
-		if (filesystem::exists(dest) && !options.overwrite)
+		if (!options.overwrite && Fs().GetItem(dest).type != DirItem::Invalid)
 			msg = L"already exists";
-		else if (!fs_out.Open(dest, true, true))
-			msg = L"failed to create";
+		else {
+			StageTimer timer(stats, Stage::Open);
+			fs_out = Fs().Open(dest, IFsBackend::Create);
+			if (!fs_out)
+				msg = L"failed to create";
+			stats.open_latency.Add(stats.Microseconds(timer.Elapsed()));
+		}
 		if (msg)
+			reporter.Error(prefix, dest, msg);
+	}
+
+	// sparse: segments of a hole and data, holes are skipped in the file
+	for (ULONGLONG pos = 0; sparse && pos < total; )
+	{
+		ULONGLONG hole;
+		DWORD size;
+		reader->Read(hole);
+		reader->Read(size);
+		if ((!hole && !size) || hole > total - pos || size > total - pos - hole || size > buf.size())
+			throw MyException{ L"Invalid tar file format or wrong password", L"", 0 };
+		if (hole && fs_out)
 		{
-			ConsoleColor cc(FOREGROUND_RED);
-			wcout << prefix << L"* " << dest << L"  *** " << msg << L" ***" << endl;
+			StageTimer timer(stats, Stage::Write);
+			if (!fs_out->WriteHole(hole))
+				throw MyException{ L"Failed to write '<path>': <err>", dest, GetLastError() };
 		}
+		pos += hole;
+		if (!size)
+			continue;
+		reader->Read(buf.data(), size);
+		if (fs_out)
+		{
+			StageTimer timer(stats, Stage::Write, size);
+			if (fs_out->Write(buf.data(), size) != size)
+				throw MyException{ L"Failed to write '<path>': <err>", dest, GetLastError() };
+		}
+		reporter.AddData(size);
+		pos += size;
 	}
-
-	while (total != 0)
+	while (!sparse && total != 0)
 	{
-		BYTE buf[64 * 1024];
-		SetLastError(0);
-		ULONGLONG to_read = sizeof(buf);
-		if (to_read > total)
-			to_read = total;
-		reader->Read(buf, (DWORD)to_read);
-		if (fs_out.IsOpen())
-		{
-			DWORD dwBytesWritten = fs_out.Write(buf, (DWORD)to_read);
-			if (dwBytesWritten != (DWORD)to_read)
+		DWORD to_read = (DWORD)min<ULONGLONG>(buf.size(), total);
+		reader->Read(buf.data(), to_read);
+		if (fs_out)
+		{
+			StageTimer timer(stats, Stage::Write, to_read);
+			DWORD dwBytesWritten = fs_out->Write(buf.data(), to_read);
+			if (dwBytesWritten != to_read)
 				throw MyException{ L"Failed to write '<path>': <err>", dest, GetLastError() };
 		}
+		reporter.AddData(to_read);
 		total -= to_read;
 	}
-	return fs_out.IsOpen();
+	return fs_out != nullptr;
 }
 
-bool ExtractItem(ITarReader* reader, const Options& options, const filesystem::path& dest, const wstring& prefix)
+// reads header of the next item, returns false at the end of directory, file or archive
+bool ReadItem(ITarReader* reader, const filesystem::path& dest, DirItem& di, wstring& name, bool& sparse)
 {
 	char type;
 	reader->Read(type);
+	sparse = type == SparseFile || type == SparseStream;
 
-	DirItem di = {};
 	switch (type) {
 	case BeginDir:
 		di.type = DirItem::Dir;
 		break;
 	case BeginFile:
+	case SparseFile:
 		di.type = DirItem::File;
 		reader->Read(di.size);
 		reader->Read(di.dwFileAttributes);
 		reader->Read(di.ftLastWriteTime);
 		break;
 	case BeginStream:
+	case SparseStream:
 		di.type = DirItem::Stream;
 		reader->Read(di.size);
 		break;
@@ -793,62 +1229,85 @@ bool ExtractItem(ITarReader* reader, const Options& options, const filesystem::p
 	reader->Read(wlen);
 	if(wlen > 500)
 		throw MyException{ L"Invalid tar file format or wrong password", L"", 0 };
-	std::string name_utf8(size_t(wlen), '\0');
+	static std::string name_utf8; // reused for all items
+	name_utf8.resize(wlen);
 	reader->Read(name_utf8.data(), wlen);
 	if(!IsUtf8(name_utf8.data(), wlen, true))
 		throw MyException{ L"Invalid tar file format or wrong password", L"", 0 };
 
-	wstring name = ToWideChar(name_utf8, CP_UTF8);
+	ToWideChar(name_utf8, CP_UTF8, name);
 	di.name = dest / name;
+	return true;
+}
 
-	PrintFileData(di, dest, prefix);
-
-	if (di.type == DirItem::Stream && !options.stream_separator.empty()) {
-		// replace ':' with stream_separator
-		if (auto pos = name.find(L':'); pos != wstring::npos) {
-			name = name.substr(0, pos) + options.stream_separator + name.substr(pos + 1);
-			di.name = dest / name;
-		}
-	}
+void SetFileAttribs(const DirItem& di, wstring_view prefix)
+{
+	if (!Fs().SetAttribs(di.name.c_str(), di.dwFileAttributes, di.ftLastWriteTime))
+		reporter.Error(prefix, di.name.native(), L"failed to set attributes");
+}
 
+// Level of the tree being extracted: items of a directory or streams of a file
+struct ExtractFrame
+{
+	filesystem::path dest; // directory of the items; empty for a file (the parent's one is used)
+	DirItem file;          // file which streams are extracted, its attributes are set at the end
+	bool written;          // file is created
+	size_t level;
+};
 
-	switch (di.type)
+void ExtractItems(ITarReader* reader, const Options& options, const filesystem::path& dest_dir)
+{
+	// the tree is walked with explicit stack (not recursion), so depth of the tree
+	// does not affect the thread stack; data of all files go through the same buffer
+	PooledBuffer buf;
+	vector<ExtractFrame> stack;
+	stack.push_back(ExtractFrame{ dest_dir, {}, false, 0 });
+	wstring name;
+	wstring fn;
+	bool sparse;
+	while (!stack.empty())
 	{
-	case DirItem::Dir: {
-		wstring next_prefix = prefix + L"  ";
-		if (!options.test)
-			EnsureDirectoryExists(di.name);
-		while (ExtractItem(reader, options, di.name, next_prefix)) {}   // write all streams
-		break;
+		ExtractFrame& frame = stack.back();
+		size_t level = frame.level;
+		const filesystem::path& dest = frame.dest.empty() ? stack[stack.size() - 2].dest : frame.dest;
+		DirItem di = {};
+		if (!ReadItem(reader, dest, di, name, sparse))
+		{
+			// set file attributes: this must be made after all the streams of this file is written
+			if (frame.written)
+				SetFileAttribs(frame.file, Indent(level));
+			stack.pop_back();
+			continue;
 		}
-	case DirItem::File: {
-		bool written = WriteTo(di.name.c_str(), reader, di.size, options, prefix);
-		while (ExtractItem(reader, options, dest, prefix)) {}   // write all streams
-		if (written)
-		{ // set file attributes: this must be made after all the streams of this file is written
-			FileSimple f;
-			FILE_BASIC_INFO fbi;
-			bool done = false;
-			if (f.OpenForAttribs(di.name.c_str(), true) &&
-				f.GetAttribs(&fbi))
-			{
-				fbi.LastWriteTime = fbi.ChangeTime = (LARGE_INTEGER&)di.ftLastWriteTime;
-				fbi.FileAttributes = di.dwFileAttributes;
-				done = f.SetAttribs(&fbi);
-			}
-			if (!done)
-			{
-				ConsoleColor cc(FOREGROUND_RED);
-				wcout << prefix << L"* " << di.name.c_str() << L"  *** failed to set attributes *** " << endl;
+
+		wstring_view prefix = Indent(level);
+		PrintFileData(di, prefix);
+
+		if (di.type == DirItem::Stream && !options.stream_separator.empty()) {
+			// replace ':' with stream_separator
+			if (auto pos = name.find(L':'); pos != wstring::npos) {
+				name = name.substr(0, pos) + options.stream_separator + name.substr(pos + 1);
+				di.name = dest / name;
 			}
 		}
-		break;
+
+		switch (di.type)
+		{
+		case DirItem::Dir:
+			if (!options.test)
+				EnsureDirectoryExists(di.name);
+			stack.push_back(ExtractFrame{ move(di.name), {}, false, level + 1 }); // read all items of the directory
+			break;
+		case DirItem::File: {
+			bool written = WriteTo(di.name.c_str(), reader, di.size, sparse, options, prefix, buf);
+			stack.push_back(ExtractFrame{ {}, move(di), written, level }); // read all streams of the file
+			break;
+			}
+		case DirItem::Stream:
+			WriteTo(CorrectDirStreamName(di.name, fn), reader, di.size, sparse, options, prefix, buf);
+			break;
 		}
-	case DirItem::Stream:
-		WriteTo(CorrectDirStreamName(di.name).c_str(), reader, di.size, options, prefix);
-		break;
 	}
-	return true;
 }
 
 
@@ -870,6 +1329,22 @@ int Untar(int argc, TCHAR **argv)
 			options.test = true;
 		else if (param == L"/o")
 			options.overwrite = true;
+		else if (param == L"/d")
+			options.direct = true;
+		else if (param == L"/q")
+			options.output = Reporter::Quiet;
+		else if (param == L"/s")
+			options.output = Reporter::Summary;
+		else if (param == L"/v")
+			options.output = Reporter::Verbose;
+		else if (param == L"/stats")
+			options.stats_output = StatsTable;
+		else if (param == L"/stats:json")
+			options.stats_output = StatsJson;
+		else if (starts_with(param, L"/si:"))
+			options.stats_interval = _wtoi(param.substr(4).data());
+		else if (starts_with(param, L"/trace:"))
+			options.trace_file = param.substr(7);
 		else if (starts_with(param, L"/p:"))
 			pass = param.substr(3);
 		else if (starts_with(param, L"/f:"))
@@ -889,6 +1364,8 @@ int Untar(int argc, TCHAR **argv)
 		wcout << L", test";
 	if (options.overwrite)
 		wcout << L", overwrite";
+	if (options.direct)
+		wcout << L", direct I/O";
 	if (!pass.empty())
 		wcout << L", pass=" << pass;
 	if (dest_dir.empty())
@@ -900,14 +1377,14 @@ int Untar(int argc, TCHAR **argv)
 		wcout << L", in current dir";
 	wcout << endl << endl;
 
-	FileSimple fs(tarname.c_str());
-	if (!fs.IsOpen())
+	auto fs = Fs().Open(tarname.c_str(), options.direct ? IFsBackend::ReadDirect : IFsBackend::Read);
+	if (!fs)
 		throw MyException{ L"Failed to open '<path>': <err>", tarname.c_str(), GetLastError() };
 
 	if (!options.test)
 		EnsureDirectoryExists(dest_dir);
 
-	unique_ptr<ITarReader> reader(new FileReader(fs, tarname.c_str()) );
+	unique_ptr<ITarReader> reader(new FileReader(*fs, tarname.c_str(), options.direct) );
 
 	if (!pass.empty()) {
 		vector<wstring> pw = split(pass, ',');
@@ -926,7 +1403,16 @@ int Untar(int argc, TCHAR **argv)
 
 	high_resolution_clock::time_point begin_time = high_resolution_clock::now();
 
-	while (ExtractItem(reader.get(), options, dest_dir, wstring())) {}
+	if (!options.trace_file.empty())
+		Trace::Enable();
+	StartStats(options.stats_interval);
+	{
+		ReporterSession session(reporter, options.output, fs->GetLength());
+		ExtractItems(reader.get(), options, dest_dir);
+	}
+	ShowStats(options.stats_output);
+	if (!options.trace_file.empty())
+		Trace::Dump(options.trace_file.c_str());
 
 	high_resolution_clock::time_point end_time = high_resolution_clock::now();
 	duration<double> time_span = duration_cast<duration<double>>(end_time - begin_time);
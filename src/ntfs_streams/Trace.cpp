@@ -0,0 +1,196 @@
+/***********************************************************************
+
+  Copyright (c) 2019 Vsevolod Lukyanin
+  All rights reserved.
+
+  This file is a part of project ntfs_file_streams:
+  https://github.com/shtirlitz-dev/ntfs_file_streams
+
+  The tool that enables to list, create, copy, delete, show, write and
+  archive NTFS files streams.
+  About file streams:
+  https://docs.microsoft.com/en-us/windows/win32/fileio/file-streams
+
+***********************************************************************/
+
+#include "pch.h"
+#include "Trace.h"
+#include "ntfs_streams.h"
+#include "FileSimple.h"
+#include "UnicodeFuncts.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+using namespace std;
+
+bool Trace::s_enabled = false;
+
+namespace
+{
+	struct TraceEvent
+	{
+		LONGLONG start;
+		LONGLONG end;
+		ULONGLONG bytes;
+		const wchar_t* category;
+		DWORD tid; // a ring is reused by threads one after another
+		wchar_t name[46]; // the end of long names is kept (file name is more useful than directories)
+	};
+
+	// events of one thread at a time; written only by this thread, read by Dump
+	struct ThreadEvents
+	{
+		vector<TraceEvent> events;
+		atomic<ULONGLONG> written{ 0 };
+	};
+
+	size_t events_per_thread = 0;
+	LONGLONG frequency = 1;
+	LONGLONG origin = 0;
+	mutex threads_mtx; // guards taking and giving back of rings only
+	vector<unique_ptr<ThreadEvents>> threads; // all rings: as many as threads tracing at once
+	vector<ThreadEvents*> free_rings; // of finished threads
+
+	// the ring of the thread; it is given back when the thread exits, so threads
+	// started per file (RangeReader) reuse the rings instead of adding new ones
+	struct CurrentRing
+	{
+		~CurrentRing()
+		{
+			if (!te)
+				return;
+			lock_guard<mutex> lock(threads_mtx);
+			free_rings.push_back(te);
+		}
+		ThreadEvents* te = nullptr;
+		DWORD tid = 0;
+	};
+	thread_local CurrentRing current;
+
+	ThreadEvents* CurrentThread()
+	{
+		if (!current.te) {
+			current.tid = GetCurrentThreadId();
+			lock_guard<mutex> lock(threads_mtx);
+			if (!free_rings.empty()) {
+				current.te = free_rings.back();
+				free_rings.pop_back();
+			}
+			else {
+				auto te = make_unique<ThreadEvents>();
+				te->events.resize(events_per_thread);
+				threads.push_back(move(te));
+				current.te = threads.back().get();
+			}
+		}
+		return current.te;
+	}
+
+	void AppendEscaped(string& out, wstring_view str, string& utf8)
+	{
+		ToChar(str, CP_UTF8, utf8);
+		for (char c : utf8)
+		{
+			if (c == '"' || c == '\\') {
+				out += '\\';
+				out += c;
+			}
+			else if ((unsigned char)c < 0x20)
+				out += ' ';
+			else
+				out += c;
+		}
+	}
+
+	void AppendMicroseconds(string& out, LONGLONG ticks)
+	{
+		char buf[32];
+		int len = sprintf_s(buf, "%.3f", ticks * 1000000.0 / frequency);
+		out.append(buf, len > 0 ? len : 0);
+	}
+}
+
+void Trace::Enable(size_t events)
+{
+	LARGE_INTEGER li;
+	QueryPerformanceFrequency(&li);
+	frequency = li.QuadPart;
+	origin = Now();
+	events_per_thread = max<size_t>(events, 1);
+	s_enabled = true;
+}
+
+LONGLONG Trace::Now()
+{
+	LARGE_INTEGER li;
+	QueryPerformanceCounter(&li);
+	return li.QuadPart;
+}
+
+void Trace::Complete(const wchar_t* category, wstring_view name, LONGLONG start, LONGLONG end, ULONGLONG bytes)
+{
+	if (!s_enabled)
+		return;
+	ThreadEvents* te = CurrentThread();
+	ULONGLONG n = te->written.load(memory_order_relaxed);
+	TraceEvent& ev = te->events[n % te->events.size()];
+	ev.start = start;
+	ev.end = end;
+	ev.bytes = bytes;
+	ev.category = category;
+	ev.tid = current.tid;
+	if (name.size() >= std::size(ev.name))
+		name = name.substr(name.size() - (std::size(ev.name) - 1));
+	name.copy(ev.name, name.size());
+	ev.name[name.size()] = 0;
+	te->written.store(n + 1, memory_order_release);
+}
+
+void Trace::Dump(const wchar_t* filename)
+{
+	FileSimple fs;
+	if (!fs.Open(filename, true, true))
+		throw MyException{ L"Failed to create '<path>': <err>", filename, GetLastError() };
+
+	string out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	string utf8;
+	bool first = true;
+	auto flush = [&](bool force) {
+		if (!force && out.size() < 1024 * 1024)
+			return;
+		if (fs.Write(out.data(), (DWORD)out.size()) != out.size())
+			throw MyException{ L"Failed to write to '<path>': <err>", filename, GetLastError() };
+		out.clear();
+	};
+
+	lock_guard<mutex> lock(threads_mtx);
+	DWORD pid = GetCurrentProcessId();
+	for (auto& te : threads)
+	{
+		ULONGLONG written = te->written.load(memory_order_acquire);
+		ULONGLONG size = te->events.size();
+		ULONGLONG n = written > size ? written - size : 0; // the oldest are overwritten
+		for (; n < written; ++n)
+		{
+			const TraceEvent& ev = te->events[n % size];
+			out += first ? "{\"name\":\"" : ",\n{\"name\":\"";
+			first = false;
+			AppendEscaped(out, ev.name, utf8);
+			out += "\",\"cat\":\"";
+			AppendEscaped(out, ev.category, utf8);
+			out += "\",\"ph\":\"X\",\"ts\":";
+			AppendMicroseconds(out, ev.start - origin);
+			out += ",\"dur\":";
+			AppendMicroseconds(out, ev.end - ev.start);
+			out += ",\"pid\":" + to_string(pid) + ",\"tid\":" + to_string(ev.tid);
+			if (ev.bytes)
+				out += ",\"args\":{\"bytes\":" + to_string(ev.bytes) + "}";
+			out += "}";
+			flush(false);
+		}
+	}
+	out += "\n]}\n";
+	flush(true);
+}
@@ -0,0 +1,63 @@
+/***********************************************************************
+
+  Copyright (c) 2019 Vsevolod Lukyanin
+  All rights reserved.
+
+  This file is a part of project ntfs_file_streams:
+  https://github.com/shtirlitz-dev/ntfs_file_streams
+
+  The tool that enables to list, create, copy, delete, show, write and
+  archive NTFS files streams.
+  About file streams:
+  https://docs.microsoft.com/en-us/windows/win32/fileio/file-streams
+
+***********************************************************************/
+
+#pragma once
+
+#include <string_view>
+
+// Events of tar/untar in Chrome trace-event format (chrome://tracing, ui.perfetto.dev).
+// Every thread writes its events to its own ring buffer without locks; when the buffer
+// is full the oldest events are overwritten. The ring of a finished thread is taken
+// by the next new thread, so the memory depends on the number of threads working
+// at once, not on all threads started. Events are written to file by Dump,
+// when the threads that recorded them are finished.
+// Time is in QueryPerformanceCounter ticks, as in Stats.
+class Trace
+{
+public:
+	static const size_t DefaultEvents = 128 * 1024; // per ring, ~16 MB
+
+	static void Enable(size_t events_per_thread = DefaultEvents);
+	static bool Enabled() { return s_enabled; }
+	static LONGLONG Now();
+	// complete event [start, end); category and name are copied
+	static void Complete(const wchar_t* category, std::wstring_view name, LONGLONG start, LONGLONG end, ULONGLONG bytes = 0);
+	static void Dump(const wchar_t* filename); // throws MyException
+protected:
+	static bool s_enabled;
+};
+
+// Event from construction to destruction, nothing is done if tracing is off
+class TraceScope
+{
+public:
+	TraceScope(const wchar_t* category, std::wstring_view name)
+		: m_category(category), m_name(name), m_start(Trace::Enabled() ? Trace::Now() : 0)
+	{
+	}
+	~TraceScope()
+	{
+		if (m_start)
+			Trace::Complete(m_category, m_name, m_start, Trace::Now(), m_bytes);
+	}
+	TraceScope(const TraceScope&) = delete;
+	TraceScope& operator=(const TraceScope&) = delete;
+	void AddBytes(ULONGLONG bytes) { m_bytes += bytes; }
+protected:
+	const wchar_t* m_category;
+	std::wstring_view m_name; // must be valid till the end of the scope
+	LONGLONG m_start;
+	ULONGLONG m_bytes = 0;
+};
@@ -0,0 +1,216 @@
+/***********************************************************************
+
+  Copyright (c) 2019 Vsevolod Lukyanin
+  All rights reserved.
+
+  This file is a part of project ntfs_file_streams:
+  https://github.com/shtirlitz-dev/ntfs_file_streams
+
+  The tool that enables to list, create, copy, delete, show, write and
+  archive NTFS files streams.
+  About file streams:
+  https://docs.microsoft.com/en-us/windows/win32/fileio/file-streams
+
+***********************************************************************/
+
+#include "pch.h"
+
+#include "TreeGen.h"
+#include "ntfs_streams.h"
+#include "CommonFunc.h"
+#include "FsBackend.h"
+#include "AlignedBuffer.h"
+#include <tchar.h>
+#include <iostream>
+#include <random>
+#include <chrono>
+
+using namespace std;
+using namespace std::chrono;
+
+// Generator of test trees for measuring tar/untar.
+// The same seed and parameters give the same tree: names, sizes, contents,
+// streams and times of modification, so results of different builds are comparable.
+
+namespace
+{
+	struct Shape
+	{
+		const wchar_t* name;
+		ULONGLONG files;
+		ULONGLONG min_size;
+		ULONGLONG max_size;
+		ULONGLONG files_per_dir;
+		ULONGLONG subdirs;     // subdirectories of every directory, 1 - chain (deep narrow tree)
+		int streams;           // streams of every file
+		const wchar_t* description;
+	};
+
+	const Shape shapes[] = {
+		{ L"small", 1000000, 1024, 4096, 1000, 10, 1, L"1M files of 1-4 KB with Zone.Identifier stream" },
+		{ L"big", 3, 10ULL << 30, 10ULL << 30, 3, 1, 0, L"3 files of 10 GB" },
+		{ L"deep", 400, 1024, 4096, 2, 1, 1, L"chain of 200 directories, 2 files with a stream in each" },
+		{ L"mixed", 20000, 0, 1 << 20, 100, 10, 1, L"20K files of 0-1 MB, streams on every file (default)" },
+	};
+
+	int ShowHelpGenTree(filesystem::path filename)
+	{
+		ShowCopyright();
+		wcout << L"\ncommand line arguments for '" << filename.c_str() << L" gentree':\n\n";
+		wcout << L"gentree [options] <dir>\n";
+		wcout << L"where <dir> is directory to create the tree in, it must not exist\n";
+		wcout << L"options:\n";
+		wcout << L"  /shape:name    - preset of the tree:\n";
+		for (auto& shape : shapes)
+			wcout << L"                     " << shape.name << L" - " << shape.description << L"\n";
+		wcout << L"  /seed:N        - seed of the random generator, default 1\n";
+		wcout << L"  /n:files       - number of files\n";
+		wcout << L"  /s:min-max     - range of file sizes, suffixes K, M, G\n";
+		wcout << L"  /fd:N          - files in each directory\n";
+		wcout << L"  /sd:N          - subdirectories of each directory, 1 - deep tree\n";
+		wcout << L"  /st:N          - streams of each file\n";
+		return 0;
+	}
+
+	// contents of all files are parts of one random block, the start depends on the file
+	class Content
+	{
+	public:
+		Content(mt19937_64& rnd)
+			: block(AlignedBufferPool::Default().BlockSize() * 2)
+		{
+			uint64_t* p = (uint64_t*)block.data();
+			for (size_t i = 0; i < block.size() / sizeof(uint64_t); ++i)
+				p[i] = rnd();
+		}
+		void Write(IFsFile& fs, ULONGLONG size, ULONGLONG start, const wchar_t* name)
+		{
+			DWORD half = block.size() / 2;
+			DWORD offset = (DWORD)(start % half);
+			while (size) {
+				DWORD part = (DWORD)min<ULONGLONG>(size, half);
+				if (fs.Write(block.data() + offset, part) != part)
+					throw MyException{ L"Failed to write to '<path>': <err>", name, GetLastError() };
+				size -= part;
+				offset = (offset + 4093) % half; // blocks of a big file differ
+			}
+		}
+	protected:
+		AlignedBuffer block;
+	};
+
+	void CreateDir(const wstring& dir)
+	{
+		if (!Fs().CreateDir(dir))
+			throw MyException{ L"Failed to create '<path>': <err>", dir, GetLastError() };
+	}
+}
+
+int GenTree(int argc, TCHAR **argv)
+{
+	if (argc < 3 || _tcscmp(argv[2], L"/?") == 0)
+		return ShowHelpGenTree(filesystem::path(argv[0]).filename());
+
+	Shape shape = shapes[std::size(shapes) - 1];
+	ULONGLONG seed = 1;
+	filesystem::path root;
+	for (int n = 2; n < argc; ++n)
+	{
+		wstring_view param(argv[n]);
+		if (param.substr(0, 7) == L"/shape:") {
+			auto it = find_if(begin(shapes), end(shapes), [&](const Shape& s) { return param.substr(7) == s.name; });
+			if (it == end(shapes))
+				throw invalid_argument("unknown shape");
+			shape = *it;
+		}
+		else if (param.substr(0, 6) == L"/seed:")
+			seed = wcstoull(param.data() + 6, nullptr, 10);
+		else if (param.substr(0, 3) == L"/n:")
+			shape.files = wcstoull(param.data() + 3, nullptr, 10);
+		else if (param.substr(0, 3) == L"/s:")
+			ReadRange(param.substr(3), shape.min_size, shape.max_size, false);
+		else if (param.substr(0, 4) == L"/fd:")
+			shape.files_per_dir = max(1ULL, wcstoull(param.data() + 4, nullptr, 10));
+		else if (param.substr(0, 4) == L"/sd:")
+			shape.subdirs = max(1ULL, wcstoull(param.data() + 4, nullptr, 10));
+		else if (param.substr(0, 4) == L"/st:")
+			shape.streams = _wtoi(param.data() + 4);
+		else if (param.substr(0, 1) == L"/")
+			throw invalid_argument("unrecognized option");
+		else if (root.empty())
+			root = param;
+		else
+			throw invalid_argument("too many parameters");
+	}
+	if (root.empty())
+		throw invalid_argument("Specify directory");
+	if (shape.max_size < shape.min_size)
+		throw invalid_argument("Invalid size range");
+
+	wcout << L"Generating " << root.c_str() << L", seed=" << seed << L", " << shape.files << L" files of "
+		<< FileSizeStr(shape.min_size) << L" - " << FileSizeStr(shape.max_size) << L" bytes, "
+		<< shape.files_per_dir << L" files per directory, " << shape.subdirs << L" subdirectories, "
+		<< shape.streams << L" streams per file" << endl;
+
+	high_resolution_clock::time_point begin_time = high_resolution_clock::now();
+
+	if (Fs().GetItem(root).type != DirItem::Invalid)
+		throw MyException{ L"Already exists: '<path>'", root.native(), 0 };
+	// deep trees are longer than MAX_PATH
+	wstring base = Fs().IsNative() ? L"\\\\?\\" + filesystem::absolute(root).native() : root.native();
+	CreateDir(base);
+
+	mt19937_64 rnd(seed);
+	Content content(rnd);
+	uniform_int_distribution<ULONGLONG> size_dist(shape.min_size, shape.max_size);
+	// times of modification: 2020..2023
+	uniform_int_distribution<ULONGLONG> time_dist(132223104000000000ULL, 133170048000000000ULL);
+
+	// directory d is a child of directory (d - 1) / subdirs, 0 is the root,
+	// so directories are created in order of levels and parents exist
+	auto dir_path = [&](ULONGLONG d) {
+		wstring res;
+		for (; d > 0; d = (d - 1) / shape.subdirs)
+			res.insert(0, L"\\d" + to_wstring((d - 1) % shape.subdirs));
+		return base + res;
+	};
+	ULONGLONG dirs = max(1ULL, (shape.files + shape.files_per_dir - 1) / shape.files_per_dir);
+	ULONGLONG total_bytes = 0;
+	wstring dir, name;
+	for (ULONGLONG d = 0, file = 0; d < dirs; ++d)
+	{
+		dir = dir_path(d);
+		if (d > 0)
+			CreateDir(dir);
+		for (ULONGLONG n = 0; n < shape.files_per_dir && file < shape.files; ++n, ++file)
+		{
+			name = dir + L"\\f" + to_wstring(n) + L".dat";
+			ULONGLONG size = size_dist(rnd);
+			{
+				auto fs = Fs().Open(name.c_str(), IFsBackend::Create);
+				if (!fs)
+					throw MyException{ L"Failed to create '<path>': <err>", name, GetLastError() };
+				content.Write(*fs, size, rnd(), name.c_str());
+			}
+			total_bytes += size;
+			for (int s = 0; s < shape.streams; ++s)
+			{
+				// the first stream is like the one written by browsers for downloaded files
+				wstring stream = name + (s == 0 ? wstring(L":Zone.Identifier") : L":s" + to_wstring(s));
+				string data = "[ZoneTransfer]\r\nZoneId=3\r\nHostUrl=https://example.com/files/f" + to_string(rnd() % 100000) + ".zip\r\n";
+				auto fs = Fs().Open(stream.c_str(), IFsBackend::Create);
+				if (!fs || fs->Write(data.data(), (DWORD)data.size()) != data.size())
+					throw MyException{ L"Failed to write to '<path>': <err>", stream, GetLastError() };
+				total_bytes += data.size();
+			}
+			ULARGE_INTEGER time;
+			time.QuadPart = time_dist(rnd);
+			Fs().SetAttribs(name.c_str(), FILE_ATTRIBUTE_ARCHIVE, (FILETIME&)time);
+		}
+	}
+
+	duration<double> time_span = high_resolution_clock::now() - begin_time;
+	wcout << shape.files << L" files, " << dirs << L" directories, " << FileSizeStr(total_bytes)
+		<< L" bytes (" << time_span.count() << L" sec)" << endl;
+	return 0;
+}
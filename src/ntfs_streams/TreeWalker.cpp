@@ -0,0 +1,122 @@
+/***********************************************************************
+
+  Copyright (c) 2019 Vsevolod Lukyanin
+  All rights reserved.
+
+  This file is a part of project ntfs_file_streams:
+  https://github.com/shtirlitz-dev/ntfs_file_streams
+
+  The tool that enables to list, create, copy, delete, show, write and
+  archive NTFS files streams.
+  About file streams:
+  https://docs.microsoft.com/en-us/windows/win32/fileio/file-streams
+
+***********************************************************************/
+
+#include "pch.h"
+#include "TreeWalker.h"
+#include "FsBackend.h"
+#include <thread>
+
+using namespace std;
+
+void TreeWalker::Walk(const vector<DirItem>& items, const Visit& visit)
+{
+	m_queue.clear();
+	m_error = nullptr;
+	m_busy = 0;
+	m_dirs = m_files = 0;
+	for (auto& item : items)
+	{
+		if (item.type == DirItem::Dir)
+			m_queue.push_back(item);
+		else if (item.type == DirItem::File)
+			VisitFile(item, 0, visit);
+		else if (item.type == DirItem::Stream)
+			visit(item, 0);
+	}
+	reverse(m_queue.begin(), m_queue.end()); // in the given order
+
+	vector<thread> workers;
+	for (int i = 1; i < m_threads; ++i)
+		workers.emplace_back(&TreeWalker::Work, this, i, cref(visit));
+	Work(0, visit);
+	for (auto& t : workers)
+		t.join();
+	if (m_error)
+		rethrow_exception(m_error);
+}
+
+void TreeWalker::Work(int thread, const Visit& visit)
+{
+	vector<DirItem> subdirs;
+	while (true)
+	{
+		DirItem dir;
+		{
+			unique_lock<mutex> lock(m_mtx);
+			m_cv.wait(lock, [&] { return !m_queue.empty() || m_busy == 0 || m_error; });
+			if (m_queue.empty() || m_error) // all is done
+				return;
+			dir = move(m_queue.back());
+			m_queue.pop_back();
+			++m_busy;
+			++m_dirs;
+		}
+		ULONGLONG files = 0;
+		try
+		{
+			for (auto& item : Fs().ListDir(dir.name))
+			{
+				if (item.type == DirItem::Stream) { // of the directory itself
+					DirItem stream = item;
+					stream.ftLastWriteTime = dir.ftLastWriteTime;
+					visit(stream, thread);
+					continue;
+				}
+				visit(item, thread);
+				if (item.type == DirItem::Dir)
+					subdirs.push_back(item);
+				else if (item.type == DirItem::File) {
+					++files;
+					if (m_streams)
+						for (auto& stream : Fs().ListStreams(item.name, L""))
+						{
+							DirItem it = stream;
+							it.ftLastWriteTime = item.ftLastWriteTime;
+							visit(it, thread);
+						}
+				}
+			}
+		}
+		catch (...)
+		{
+			lock_guard<mutex> lock(m_mtx);
+			if (!m_error)
+				m_error = current_exception();
+		}
+		{
+			// subdirectories are queued before the directory is done, so others do not stop early
+			lock_guard<mutex> lock(m_mtx);
+			for (auto& it : subdirs)
+				m_queue.push_back(move(it));
+			m_files += files;
+			--m_busy;
+		}
+		subdirs.clear();
+		m_cv.notify_all();
+	}
+}
+
+void TreeWalker::VisitFile(const DirItem& file, int thread, const Visit& visit)
+{
+	visit(file, thread);
+	++m_files;
+	if (m_streams)
+		for (auto& stream : Fs().ListStreams(file.name, L""))
+		{
+			DirItem it = stream;
+			it.ftLastWriteTime = file.ftLastWriteTime;
+			visit(it, thread);
+		}
+}
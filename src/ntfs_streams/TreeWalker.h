@@ -0,0 +1,60 @@
+/***********************************************************************
+
+  Copyright (c) 2019 Vsevolod Lukyanin
+  All rights reserved.
+
+  This file is a part of project ntfs_file_streams:
+  https://github.com/shtirlitz-dev/ntfs_file_streams
+
+  The tool that enables to list, create, copy, delete, show, write and
+  archive NTFS files streams.
+  About file streams:
+  https://docs.microsoft.com/en-us/windows/win32/fileio/file-streams
+
+***********************************************************************/
+
+#pragma once
+
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include "CommonFunc.h"
+
+// Walks trees in several threads: every directory is listed (Fs().ListDir) by one
+// of the threads, its subdirectories are queued for all of them.
+// The callback gets directories, files and streams (of files, if streams is set,
+// and of directories) with the index of the thread, so it can keep results per
+// thread without locks and merge them after Walk. Streams get the modification time
+// of their file or directory.
+class TreeWalker
+{
+public:
+	typedef std::function<void(const DirItem& item, int thread)> Visit;
+
+	TreeWalker(int threads, bool streams = true)
+		: m_threads(max(1, threads)), m_streams(streams)
+	{
+	}
+	int Threads() const { return m_threads; }
+	// items are files or directories (as Fs().ListItems gives), directories are walked;
+	// the first exception of visit or of listing is rethrown
+	void Walk(const std::vector<DirItem>& items, const Visit& visit);
+
+	ULONGLONG Dirs() const { return m_dirs; }   // listed
+	ULONGLONG Files() const { return m_files; }
+
+protected:
+	void Work(int thread, const Visit& visit);
+	void VisitFile(const DirItem& file, int thread, const Visit& visit);
+
+	int m_threads;
+	bool m_streams;
+	std::mutex m_mtx;
+	std::condition_variable m_cv;
+	std::vector<DirItem> m_queue; // directories to list, the last is taken first (depth first, short queue)
+	size_t m_busy = 0;            // threads listing a directory
+	std::exception_ptr m_error;
+	ULONGLONG m_dirs = 0;
+	ULONGLONG m_files = 0;
+};
@@ -0,0 +1,314 @@
+/***********************************************************************
+
+  Copyright (c) 2019 Vsevolod Lukyanin
+  All rights reserved.
+
+  This file is a part of project ntfs_file_streams:
+  https://github.com/shtirlitz-dev/ntfs_file_streams
+
+  The tool that enables to list, create, copy, delete, show, write and
+  archive NTFS files streams.
+  About file streams:
+  https://docs.microsoft.com/en-us/windows/win32/fileio/file-streams
+
+***********************************************************************/
+
+#include "pch.h"
+
+#include "TypeStream.h"
+#include "ntfs_streams.h"
+#include "CommonFunc.h"
+#include "FileSimple.h"
+#include "UnicodeStream.h"
+#include <tchar.h>
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <chrono>
+
+using namespace std;
+using namespace std::chrono;
+
+// Text is decoded to lines and written by wcout (UTF-8 with _O_U8TEXT); if stdout
+// is a file or a pipe and the stream is already UTF-8 or is binary, its bytes are
+// copied to stdout as they are, by big blocks.
+// Every option selects a range of bytes: lines are found by LF in the raw data
+// (a pair of bytes in UTF-16), from the beginning or, for /t, from the end, so
+// only the bytes around the range are read.
+
+namespace
+{
+	int ShowHelpType(filesystem::path filename)
+	{
+		ShowCopyright();
+		wcout << L"\ncommand line arguments for '" << filename.c_str() << L" type':\n\n";
+		wcout << L"type [options] <src>\n";
+		wcout << L"where <src> is a file or a stream, e.g. file.txt:stream1\n";
+		wcout << L"Text is converted to Unicode; if output is redirected to a file or a pipe,\n";
+		wcout << L"UTF-8 text and binary data are copied as they are\n";
+		wcout << L"options:\n";
+		wcout << L"  /raw           - copy bytes as they are, even to console\n";
+		wcout << L"  /text          - always convert text, line ends become \\n\n";
+		wcout << L"  /b:from-to     - bytes from offset 'from' to 'to' (not included), suffixes K, M, G, e.g. /b:1G-\n";
+		wcout << L"  /l:from-to     - lines from 'from' to 'to' (the first is 1), e.g. /l:100-200 or /l:1000-\n";
+		wcout << L"  /h:N           - the first N lines\n";
+		wcout << L"  /t:N           - the last N lines, the stream is read from the end\n";
+		wcout << L"  /f             - follow: wait for new data at the end and write it, Ctrl-C to stop\n";
+		wcout << L"Lines are counted by LF (\\n)\n";
+		return 0;
+	}
+
+	const DWORD BlockSize = 1024 * 1024;
+
+	struct Input
+	{
+		Input(const wchar_t* name) : name(name)
+		{
+			if (!fs.OpenShared(name))
+				throw MyException{ L"Failed to open source '<path>': <err>", name, GetLastError() };
+		}
+		DWORD ReadAt(ULONGLONG offset, void* data, DWORD count)
+		{
+			SetLastError(0);
+			DWORD done = fs.ReadAt(offset, data, count);
+			if (!done && count && GetLastError() && GetLastError() != ERROR_HANDLE_EOF)
+				throw MyException{ L"Failed to read '<path>': <err>", name, GetLastError() };
+			return done;
+		}
+		bool IsLF(const char* p) const
+		{
+			return fmt == TextFormat::LitteEndian ? p[0] == '\n' && !p[1] :
+				fmt == TextFormat::BigEndian ? !p[0] && p[1] == '\n' : *p == '\n';
+		}
+
+		FileSimple fs;
+		const wchar_t* name;
+		TextFormat fmt = TextFormat::Multibyte;
+		DWORD unit = 1;       // 2 for UTF-16
+		ULONGLONG data = 0;   // after BOM
+		vector<char> buf = vector<char>(BlockSize);
+	};
+
+	// position after the count-th line end from pos
+	ULONGLONG Forward(Input& in, ULONGLONG pos, ULONGLONG end, ULONGLONG lines)
+	{
+		while (lines && pos < end)
+		{
+			DWORD n = in.ReadAt(pos, in.buf.data(), (DWORD)min<ULONGLONG>(BlockSize, end - pos));
+			n -= n % in.unit;
+			if (!n)
+				break;
+			const char* p = in.buf.data();
+			if (in.unit == 1) {
+				for (const char* lf = p; (lf = (const char*)memchr(lf, '\n', p + n - lf)) != nullptr; ++lf)
+					if (!--lines)
+						return pos + (lf - p) + 1;
+			}
+			else {
+				for (DWORD i = 0; i < n; i += in.unit)
+					if (in.IsLF(p + i) && !--lines)
+						return pos + i + in.unit;
+			}
+			pos += n;
+		}
+		return lines ? end : pos;
+	}
+
+	// beginning of the last count lines before end (the line end at the end itself
+	// is not counted, unless count_last), or limit if there are less lines
+	ULONGLONG Backward(Input& in, ULONGLONG limit, ULONGLONG end, ULONGLONG lines, bool count_last)
+	{
+		end -= (end - limit) % in.unit;
+		if (!lines)
+			return end;
+		for (ULONGLONG pos = end; pos > limit; )
+		{
+			DWORD n = (DWORD)min<ULONGLONG>(BlockSize, pos - limit);
+			pos -= n;
+			if (in.ReadAt(pos, in.buf.data(), n) != n)
+				throw MyException{ L"Failed to read '<path>': <err>", in.name, ERROR_HANDLE_EOF };
+			for (DWORD i = n; i >= in.unit; )
+			{
+				i -= in.unit;
+				if (!in.IsLF(in.buf.data() + i))
+					continue;
+				ULONGLONG after = pos + i + in.unit;
+				if ((after != end || count_last) && !--lines)
+					return after;
+			}
+		}
+		return limit;
+	}
+
+	struct RangeStream : public CharStream
+	{
+		RangeStream(Input& in, ULONGLONG pos, ULONGLONG end) : in(in), pos(pos), end(end) {}
+		virtual int Read(char* buf, int count) override
+		{
+			DWORD done = in.ReadAt(pos, buf, (DWORD)min<ULONGLONG>(count, end - pos));
+			pos += done;
+			return (int)done;
+		}
+		Input& in;
+		ULONGLONG pos;
+		ULONGLONG end;
+	};
+
+	// false if the reader of the pipe has gone
+	bool WriteOut(HANDLE out, const char* data, DWORD size)
+	{
+		while (size)
+		{
+			DWORD written = 0;
+			if (!WriteFile(out, data, size, &written, nullptr)) {
+				DWORD err = GetLastError();
+				if (err == ERROR_BROKEN_PIPE || err == ERROR_NO_DATA)
+					return false;
+				throw MyException{ L"Failed to write to '<path>': <err>", L"stdout", err };
+			}
+			data += written;
+			size -= written;
+		}
+		return true;
+	}
+
+	bool Output(Input& in, ULONGLONG pos, ULONGLONG end, bool raw, HANDLE out)
+	{
+		if (raw) {
+			while (pos < end)
+			{
+				DWORD n = in.ReadAt(pos, in.buf.data(), (DWORD)min<ULONGLONG>(BlockSize, end - pos));
+				if (!n)
+					break;
+				if (!WriteOut(out, in.buf.data(), n))
+					return false;
+				pos += n;
+			}
+			return true;
+		}
+		// lines are collected and written by big portions
+		RangeStream stream(in, pos, end);
+		wstring text;
+		for (auto str : GetStrings(&stream, in.fmt))
+		{
+			text += str;
+			if (text.size() >= BlockSize / 4) {
+				wcout << text;
+				text.clear();
+			}
+		}
+		wcout << text;
+		wcout.flush();
+		return true;
+	}
+}
+
+int TypeStream(int argc, TCHAR **argv)
+{
+	if (argc >= 3 && _tcscmp(argv[2], L"/?") == 0)
+		return ShowHelpType(filesystem::path(argv[0]).filename());
+
+	enum { Auto, Raw, Text } mode = Auto;
+	enum { All, Bytes, Lines, Tail } range = All;
+	ULONGLONG from = 0, to = ~0ULL;
+	bool follow = false;
+	const wchar_t* src = nullptr;
+	for (int n = 2; n < argc; ++n)
+	{
+		wstring_view param(argv[n]);
+		if (param == L"/raw")
+			mode = Raw;
+		else if (param == L"/text")
+			mode = Text;
+		else if (param.substr(0, 3) == L"/b:") {
+			range = Bytes;
+			ReadRange(param.substr(3), from, to, true);
+		}
+		else if (param.substr(0, 3) == L"/l:") {
+			range = Lines;
+			ReadRange(param.substr(3), from, to, false);
+			if (!from || to < from)
+				throw invalid_argument("Invalid range of lines");
+		}
+		else if (param.substr(0, 3) == L"/h:") {
+			range = Lines;
+			from = 1;
+			to = ReadSize(param.substr(3));
+		}
+		else if (param.substr(0, 3) == L"/t:") {
+			range = Tail;
+			from = ReadSize(param.substr(3));
+		}
+		else if (param == L"/f")
+			follow = true;
+		else if (param.substr(0, 1) == L"/")
+			throw invalid_argument("unrecognized option");
+		else if (!src)
+			src = argv[n];
+		else
+			throw invalid_argument("too many parameters");
+	}
+	if (!src)
+		throw invalid_argument("Specify stream to type");
+	if (follow && to != ~0ULL)
+		throw invalid_argument("/f needs the range up to the end");
+
+	Input in(src);
+	ULONGLONG length = in.fs.GetLength();
+	DWORD count = in.ReadAt(0, in.buf.data(), (DWORD)min<ULONGLONG>(length, BlockSize));
+	size_t bom = 0;
+	in.fmt = DetectFormat(in.buf.data(), (int)count, bom);
+	in.unit = in.fmt == TextFormat::LitteEndian || in.fmt == TextFormat::BigEndian ? 2 : 1;
+	bool binary = in.fmt == TextFormat::Multibyte && memchr(in.buf.data(), 0, min<DWORD>(count, 2000));
+	HANDLE out = GetStdHandle(STD_OUTPUT_HANDLE);
+	in.data = mode == Raw ? 0 : bom; // with /raw BOM is written too
+	if (mode == Auto) // console shows only Unicode
+		mode = GetFileType(out) != FILE_TYPE_CHAR && (in.fmt == TextFormat::Utf8 || binary) ? Raw : Text;
+
+	ULONGLONG begin = in.data, end = length;
+	switch (range)
+	{
+	case All:
+		break;
+	case Bytes:
+		begin = max(from, in.data);
+		begin -= (begin - in.data) % in.unit;
+		end = min(to, length);
+		break;
+	case Lines:
+		begin = Forward(in, in.data, length, from - 1);
+		if (to != ~0ULL)
+			end = Forward(in, begin, length, to - from + 1);
+		break;
+	case Tail:
+		begin = Backward(in, in.data, length, from, false);
+		break;
+	}
+
+	if (mode == Raw) {
+		wcout.flush();
+		fflush(stdout);
+	}
+	if (begin < end && !Output(in, begin, end, mode == Raw, out))
+		return 0;
+	if (!follow) {
+		if (mode == Text)
+			wcout << endl;
+		return 0;
+	}
+
+	// only whole lines of text are written, the rest waits for its line end
+	for (ULONGLONG pos = end; ; )
+	{
+		this_thread::sleep_for(milliseconds(500));
+		length = in.fs.GetLength();
+		if (length < pos) // truncated: from the beginning
+			pos = in.data;
+		ULONGLONG upto = mode == Raw ? length : Backward(in, pos, length, 1, true);
+		if (upto > pos) {
+			if (!Output(in, pos, upto, mode == Raw, out))
+				return 0;
+			pos = upto;
+		}
+	}
+}
@@ -83,4 +83,20 @@ std::string ToChar(std::wstring_view str, UINT codepage) // CP_ACP, CP_UTF8
 	std::string strChar(count, '\0');
 	::WideCharToMultiByte(codepage, 0, str.data(), (int)str.size(), strChar.data(), count, nullptr, nullptr);
 	return strChar;
-}
\ No newline at end of file
+}
+
+void ToWideChar(std::string_view str, UINT codepage, std::wstring& out)
+{
+	int count = str.empty() ? 0 : ::MultiByteToWideChar(codepage, 0, str.data(), (int)str.size(), nullptr, 0);
+	out.resize(count > 0 ? count : 0);
+	if (count > 0)
+		::MultiByteToWideChar(codepage, 0, str.data(), (int)str.size(), out.data(), count);
+}
+
+void ToChar(std::wstring_view str, UINT codepage, std::string& out)
+{
+	int count = str.empty() ? 0 : ::WideCharToMultiByte(codepage, 0, str.data(), (int)str.size(), nullptr, 0, nullptr, nullptr);
+	out.resize(count > 0 ? count : 0);
+	if (count > 0)
+		::WideCharToMultiByte(codepage, 0, str.data(), (int)str.size(), out.data(), count, nullptr, nullptr);
+}
@@ -22,3 +22,6 @@ bool IsUnicodeLE(char * buf, int count);
 bool IsUnicodeBE(char * buf, int count);
 std::wstring ToWideChar(std::string_view str, UINT codepage); // CP_ACP, CP_UTF8
 std::string ToChar(std::wstring_view str, UINT codepage); // CP_ACP, CP_UTF8
+// the same, but reuse memory of 'out'
+void ToWideChar(std::string_view str, UINT codepage, std::wstring& out);
+void ToChar(std::wstring_view str, UINT codepage, std::string& out);
@@ -16,176 +16,244 @@
 #include "pch.h"
 #include "UnicodeStream.h"
 #include "UnicodeFuncts.h"
+#include "Simd.h"
+#include <vector>
 
+using namespace std;
 
-enum Format { Multibyte, LitteEndian, BigEndian, Utf8 };
+// Input is decoded by blocks to a buffer of wide chars, lines are found in it and
+// yielded as views, the unfinished line is moved to the beginning of the buffer.
 
-// UTF8:
-//  byte 0xxxxxxx -> like ASCII
-//  byte 10xxxxxx alone is not valid
-//  byte 110xxxxx must be followed by 10xxxxxx
-//  byte 1110xxxx must be followed by 10xxxxxx, 10xxxxxx
-//  byte 11110xxx must be followed by 10xxxxxx, 10xxxxxx, 10xxxxxx
-//  byte 111110xx must be followed by 10xxxxxx, 10xxxxxx, 10xxxxxx, 10xxxxxx
-//  byte 1111110x must be followed by 10xxxxxx, 10xxxxxx, 10xxxxxx, 10xxxxxx, 10xxxxxx
-//  byte 1111111x alone not valid
-
-template <class GetCh>
-std::experimental::generator<WCHAR> ConvertUtf8(GetCh in)
+namespace
 {
-	static char arrMasks[] = { 0, 0b0001'1111, 0b0000'1111, 0b0000'0111, 0b0000'0011, 0b0000'0001 };
-	bool bUtf8 = false;
-	bool bError = false;
-	int ich;
-	while (ich = in(), ich != -1)
+	// UTF8:
+	//  byte 0xxxxxxx -> like ASCII
+	//  byte 10xxxxxx alone is not valid
+	//  byte 110xxxxx must be followed by 10xxxxxx
+	//  byte 1110xxxx must be followed by 10xxxxxx, 10xxxxxx
+	//  byte 11110xxx must be followed by 10xxxxxx, 10xxxxxx, 10xxxxxx
+	//  byte 111110xx must be followed by 10xxxxxx, 10xxxxxx, 10xxxxxx, 10xxxxxx
+	//  byte 1111110x must be followed by 10xxxxxx, 10xxxxxx, 10xxxxxx, 10xxxxxx, 10xxxxxx
+	//  byte 1111111x alone not valid
+	// Illegal bytes are output as they are; if a sequence is broken, the byte that
+	// broke it is output instead (0xFF if data ended).
+	// Returns the number of bytes used, a sequence at the end is left for the next
+	// block unless it is the last one.
+	size_t DecodeUtf8(const char* in, size_t count, bool last, wstring& out)
 	{
-		char uc = (char)ich;
-		if ((uc & 0b1000'0000) == 0)
-		{
-			co_yield (uint8_t)uc;
-			continue; // usual ascii
-		}
-		if ((uc & 0b1100'0000) == 0b1000'0000 || (uc & 0b1111'1110) == 0b1111'1110)
+		static const uint8_t masks[] = { 0, 0b0001'1111, 0b0000'1111, 0b0000'0111, 0b0000'0011, 0b0000'0001 };
+		size_t base = out.size();
+		out.resize(base + count); // a char takes at least 1 byte, a surrogate pair 4 bytes
+		WCHAR* dst = (WCHAR*)out.data() + base;
+		size_t i = 0;
+		while (i < count)
 		{
-			bError = true; // illegal symbol
-			co_yield (uint8_t)uc;
-			continue; // usual ascii
-		}
-		int nCount =
-			((uc & 0b1110'0000) == 0b1100'0000) ? 1 : ((uc & 0b1111'0000) == 0b1110'0000) ? 2 : ((uc & 0b1111'1000) == 0b1111'0000) ? 3 : ((uc & 0b1111'1100) == 0b1111'1000) ? 4 : ((uc & 0b1111'1110) == 0b1111'1100) ? 5 : -1; // this is covered by "(uc & 0b1111'1110) == 0b1111'1110"
-		if (nCount == -1) // should not happen
-			return;
-		uint32_t nPoint = uc & arrMasks[nCount];
-		while (nCount--)
-		{
-			ich = in();
-			if (ich == -1 || (uc = (char)ich, (uc & 0b1100'0000) != 0b1000'0000))
+#ifdef USE_SSE2
+			if (i + 16 <= count) { // 16 ASCII chars at once
+				__m128i v = _mm_loadu_si128((const __m128i*)(in + i));
+				if (!_mm_movemask_epi8(v)) {
+					__m128i zero = _mm_setzero_si128();
+					__m128i lo = _mm_unpacklo_epi8(v, zero), hi = _mm_unpackhi_epi8(v, zero);
+					if constexpr (sizeof(WCHAR) == 2) {
+						_mm_storeu_si128((__m128i*)dst, lo);
+						_mm_storeu_si128((__m128i*)(dst + 8), hi);
+					}
+					else {
+						_mm_storeu_si128((__m128i*)dst, _mm_unpacklo_epi16(lo, zero));
+						_mm_storeu_si128((__m128i*)(dst + 4), _mm_unpackhi_epi16(lo, zero));
+						_mm_storeu_si128((__m128i*)(dst + 8), _mm_unpacklo_epi16(hi, zero));
+						_mm_storeu_si128((__m128i*)(dst + 12), _mm_unpackhi_epi16(hi, zero));
+					}
+					i += 16;
+					dst += 16;
+					continue;
+				}
+			}
+#endif
+			uint8_t uc = (uint8_t)in[i];
+			if ((uc & 0b1000'0000) == 0 || (uc & 0b1100'0000) == 0b1000'0000 || (uc & 0b1111'1110) == 0b1111'1110) {
+				*dst++ = uc; // ascii or illegal symbol
+				++i;
+				continue;
+			}
+			int nCount = uc >= 0b1111'1100 ? 5 : uc >= 0b1111'1000 ? 4 : uc >= 0b1111'0000 ? 3 : uc >= 0b1110'0000 ? 2 : 1;
+			if (!last && i + nCount >= count)
+				break; // may continue in the next block
+			uint32_t nPoint = uc & masks[nCount];
+			size_t j = i + 1;
+			for (; nCount--; ++j)
 			{
-				bError = true; // illegal symbol
-				nPoint = (uint8_t)ich; // output the original first symbol and continue from the symbol after first
-				break;
+				if (j == count) {
+					nPoint = 0xFF;
+					break;
+				}
+				uint8_t next = (uint8_t)in[j];
+				if ((next & 0b1100'0000) != 0b1000'0000) {
+					nPoint = next;
+					++j;
+					break;
+				}
+				nPoint = (nPoint << 6) | (next & 0b0011'1111);
+			}
+			i = j;
+			if (nPoint < 0x10000) // encoded with 1 symbol
+				*dst++ = (WCHAR)nPoint;
+			else { // encoded with 2 surrogates
+				nPoint -= 0x10000;
+				*dst++ = (WCHAR)(0xD800 + (WCHAR)(nPoint >> 10));
+				*dst++ = (WCHAR)(0xDC00 + (WCHAR)(nPoint & 0x3FF));
 			}
-			nPoint = (nPoint << 6) | (uc & 0b0011'1111);
-		}
-		bUtf8 = true;
-
-		if (nPoint < 0x10000) // encoded with 1 symbol
-			co_yield (WCHAR)nPoint;
-		else { // encoded with 2 surrogates
-			nPoint -= 0x10000;
-			co_yield (0xD800 + (WCHAR)(nPoint >> 10));
-			co_yield (0xDC00 + (WCHAR)(nPoint & 0x3FF));
 		}
+		out.resize(dst - (WCHAR*)out.data());
+		return i;
 	}
-}
 
-template <class GetCh>
-std::experimental::generator<WCHAR> ConvertPair(GetCh in, bool bLE)
-{
-	while (true)
+	// UTF-16, an odd byte at the end of data is ignored
+	size_t DecodePairs(const char* in, size_t count, bool last, bool bLE, wstring& out)
 	{
-		int b1 = in();
-		if (b1 == -1)
-			return;
-		int b2 = in();
-		if (b2 == -1)
-			return;
-		co_yield bLE ? wchar_t((b2 << 8) | b1) : wchar_t((b1 << 8) | b2);
+		size_t pairs = count / 2;
+		size_t base = out.size();
+		out.resize(base + pairs);
+		WCHAR* dst = (WCHAR*)out.data() + base;
+		const uint8_t* src = (const uint8_t*)in;
+		if (bLE)
+			for (size_t i = 0; i < pairs; ++i, src += 2)
+				dst[i] = (WCHAR)((src[1] << 8) | src[0]);
+		else
+			for (size_t i = 0; i < pairs; ++i, src += 2)
+				dst[i] = (WCHAR)((src[0] << 8) | src[1]);
+		return last ? count : pairs * 2;
 	}
-}
 
+	// current system codepage, by whole lines (a line never ends inside of a char)
+	size_t DecodeMultibyte(const char* in, size_t count, bool last, wstring& out)
+	{
+		size_t used = count;
+		if (!last) {
+			while (used && in[used - 1] != '\r' && in[used - 1] != '\n')
+				--used;
+		}
+		int wide = used ? ::MultiByteToWideChar(CP_ACP, 0, in, (int)used, nullptr, 0) : 0;
+		if (wide > 0) {
+			size_t base = out.size();
+			out.resize(base + wide);
+			::MultiByteToWideChar(CP_ACP, 0, in, (int)used, out.data() + base, wide);
+		}
+		return used;
+	}
 
-template <class GetCh>
-std::experimental::generator<WCHAR> ConvertMultibyte(GetCh in)
-{
-	// accumulate entire string and convert it using current system codepage
-	std::string accum;
-	accum.reserve(1000);
-	while (true)
+	bool IsLineEnd(wchar_t ch)
 	{
-		int ich = in();
-		if (ich != -1)
-			accum += (char)ich;
-		if (ich == -1 || ich == '\r' || ich == '\n')
-		{
-			std::wstring uni = ToWideChar(accum, CP_ACP);
-			for (auto c : uni)
-				co_yield c;
-			accum = "";
+		// carriage-return, line-feed, line-separator, paragraph-separator, next-line
+		return ch == '\r' || ch == '\n' || ch == 0x2028 || ch == 0x2029 || ch == 0x85;
+	}
+
+	size_t FindLineEnd(const wchar_t* str, size_t pos, size_t end)
+	{
+#ifdef USE_SSE2
+		if constexpr (sizeof(wchar_t) == 2) { // skip 8 chars at once while there is no line end
+			const __m128i cr = _mm_set1_epi16('\r'), lf = _mm_set1_epi16('\n'), nel = _mm_set1_epi16(0x85);
+			const __m128i sep = _mm_set1_epi16(0x2028), low_bit = _mm_set1_epi16(~1);
+			for (; pos + 8 <= end; pos += 8)
+			{
+				__m128i v = _mm_loadu_si128((const __m128i*)(str + pos));
+				__m128i eq = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi16(v, cr), _mm_cmpeq_epi16(v, lf)),
+					_mm_or_si128(_mm_cmpeq_epi16(v, nel), _mm_cmpeq_epi16(_mm_and_si128(v, low_bit), sep)));
+				if (_mm_movemask_epi8(eq))
+					break;
+			}
 		}
-		if (ich == -1)
-			return;
+#endif
+		for (; pos < end; ++pos)
+			if (IsLineEnd(str[pos]))
+				return pos;
+		return end;
 	}
 }
 
-std::experimental::generator<std::wstring> GetStrings(CharStream *pStream)
+TextFormat DetectFormat(char* buf, int count, size_t& bom)
 {
-	char buf[2000];
-	int count = pStream->Read(buf, (int) sizeof(buf));
-	if (!count)
-		return;
-
-	int pos = 0;
-	Format fmt = Multibyte;
+	// format is detected by the beginning, as much as a small read gives
+	count = min(count, 2000);
+	bom = 0;
 	if (count >= 2 && (WORD&)buf[0] == 0xFEFF) { // FF FE  - BOM LittleEndian, usual, sampe of space "20 00"
-		pos = 2;
-		fmt = LitteEndian;
-	}
-	else if (count >= 2 && (WORD&)buf[0] == 0xFFFE) { // FE FF  - BOM BigEndian, unusual, sample of space "00 20"
-		pos = 2;
-		fmt = BigEndian;
-	}
-	else if (count >= 3 && ((DWORD&)buf[0] & 0xFFFFFF) == 0xBFBBEF) { // EF BB BF - BOM utf8
-		pos = 3;
-		fmt = Utf8;
+		bom = 2;
+		return TextFormat::LitteEndian;
 	}
-	else if (IsUtf8(buf, count, count < 1000)) {
-		fmt = Utf8;
+	if (count >= 2 && (WORD&)buf[0] == 0xFFFE) { // FE FF  - BOM BigEndian, unusual, sample of space "00 20"
+		bom = 2;
+		return TextFormat::BigEndian;
 	}
-	else if (IsUnicodeLE(buf, count)) {
-		fmt = LitteEndian;
-	}
-	else if (IsUnicodeBE(buf, count)) {
-		fmt = BigEndian;
+	if (count >= 3 && ((DWORD&)buf[0] & 0xFFFFFF) == 0xBFBBEF) { // EF BB BF - BOM utf8
+		bom = 3;
+		return TextFormat::Utf8;
 	}
+	if (IsUtf8(buf, count, count < 1000))
+		return TextFormat::Utf8;
+	if (IsUnicodeLE(buf, count))
+		return TextFormat::LitteEndian;
+	if (IsUnicodeBE(buf, count))
+		return TextFormat::BigEndian;
+	return TextFormat::Multibyte;
+}
 
-	// pusher provides input stream, one char at once, -1 means end of data
-	auto pusher = [&pos, &buf, &count, pStream]() -> int {
-		if (pos == count) {
-			pos = 0;
-			count = pStream->Read(buf, (int)sizeof(buf));
-		}
-		if (pos < count)
-			return 0xFF & (int)buf[pos++];
-		return -1;
-	};
-
-	std::wstring str;
-	str.reserve(1000);
-	std::experimental::generator<WCHAR> gen;
-	if (fmt == Utf8)
-		gen = ConvertUtf8(pusher);
-	else if (fmt == LitteEndian || fmt == BigEndian)
-		gen = ConvertPair(pusher, fmt == LitteEndian);
-	else
-		gen = ConvertMultibyte(pusher);
-
-	wchar_t prev = 0;
-	for (wchar_t ch : gen) {
-		bool pair = (prev ^ ch) == ('\r' ^ '\n');
-		prev = pair ? 0 : ch;
-		bool rn = ch == '\r' || ch == '\n'; // carriage-return, line-feed
-		if (pair && rn)  // consider cr+lf or lf+cr as 1 symbol
-			continue;
-		if (rn || ch == 0x2028 || ch == 0x2029 || ch == 0x85) // line-separator, paragraph-separator, next-line
+std::experimental::generator<std::wstring_view> GetStrings(CharStream *pStream, optional<TextFormat> format)
+{
+	vector<char> buf(64 * 1024);
+	int count = pStream->Read(buf.data(), (int)buf.size());
+	if (count <= 0)
+		return;
+
+	size_t pos = 0;
+	TextFormat fmt = format ? *format : DetectFormat(buf.data(), count, pos);
+
+	size_t have = count;
+	bool eof = false;
+	wstring text;      // decoded: the unfinished line and the new block
+	size_t start = 0;  // of the current line in text
+	size_t scanned = 0;
+	wchar_t prev = 0;  // line end just before start, cr+lf or lf+cr are 1 line end
+	while (true)
+	{
+		const char* in = buf.data() + pos;
+		size_t used =
+			fmt == TextFormat::Utf8 ? DecodeUtf8(in, have - pos, eof, text) :
+			fmt == TextFormat::Multibyte ? DecodeMultibyte(in, have - pos, eof, text) :
+			DecodePairs(in, have - pos, eof, fmt == TextFormat::LitteEndian, text);
+		pos += used;
+
+		for (size_t i = scanned; (i = FindLineEnd(text.data(), i, text.size())) < text.size(); )
 		{
-			str += '\n';
-			co_yield str;
-			str = L"";
+			wchar_t ch = text[i];
+			bool rn = ch == '\r' || ch == '\n';
+			if (rn && i == start && (prev ^ ch) == ('\r' ^ '\n')) { // second char of the pair
+				prev = 0;
+				start = ++i;
+				continue;
+			}
+			prev = rn ? ch : 0;
+			text[i] = '\n';
+			co_yield wstring_view(text.data() + start, i + 1 - start);
+			start = ++i;
 		}
+		text.erase(0, start);
+		start = 0;
+		scanned = text.size();
+		if (eof)
+			break;
+
+		// the rest of the block (not finished char or line) goes to the beginning
+		have -= pos;
+		memmove(buf.data(), buf.data() + pos, have);
+		pos = 0;
+		if (have == buf.size()) // a long line of multibyte text
+			buf.resize(buf.size() * 2);
+		count = pStream->Read(buf.data() + have, (int)(buf.size() - have));
+		if (count > 0)
+			have += count;
 		else
-			str += ch;
+			eof = true;
 	}
-	if (!str.empty())
-		co_yield str;
+	if (!text.empty())
+		co_yield wstring_view(text);
 }
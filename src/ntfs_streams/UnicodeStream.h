@@ -16,6 +16,7 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <optional>
 #include <experimental/coroutine>
 #include <experimental/generator>
@@ -26,4 +27,13 @@ public:
 	virtual int Read(char* buf, int count) = 0;
 };
 
-std::experimental::generator<std::wstring> GetStrings(CharStream *pStream);
+enum class TextFormat { Multibyte, LitteEndian, BigEndian, Utf8 };
+
+// by BOM (its size is returned in bom) or by the first 2000 bytes of buf
+TextFormat DetectFormat(char* buf, int count, size_t& bom);
+
+// Lines of text in UTF-8, UTF-16 (LE or BE) or current codepage, detected by BOM or
+// by the beginning; every line end (cr, lf, cr+lf, lf+cr, U+2028, U+2029, U+0085)
+// is given as '\n'. A view is valid until the next line is taken.
+// If format is given, it is not detected and BOM is not expected.
+std::experimental::generator<std::wstring_view> GetStrings(CharStream *pStream, std::optional<TextFormat> format = {});
@@ -20,9 +20,20 @@
 #include <tchar.h>
 #include "ntfs_streams.h"
 #include "FileSimple.h"
-#include "UnicodeStream.h"
+#include "FsBackend.h"
+#include "NtfsImage.h"
 #include "UnicodeFuncts.h"
 #include "Tar.h"
+#include "Bench.h"
+#include "TreeGen.h"
+#include "Inventory.h"
+#include "FindStreams.h"
+#include "StreamUsage.h"
+#include "TypeStream.h"
+#include "StreamGrep.h"
+#include "EchoStream.h"
+#include "StreamBulk.h"
+#include "CopyAll.h"
 #include "CommonFunc.h"
 #include "ConsoleColor.h"
 
@@ -38,6 +49,18 @@ int wmain(int argc, TCHAR **argv) // main(int argc, char **argv)
 
 	try
 	{
+		// "/img:volume.img <command>": the command works with NTFS image instead of the disk
+		unique_ptr<NtfsImage> image;
+		struct Restore { ~Restore() { SetFs(nullptr); } } restore;
+		if (argc >= 2 && _tcsncmp(argv[1], L"/img:", 5) == 0)
+		{
+			image = make_unique<NtfsImage>(argv[1] + 5, Fs());
+			SetFs(image.get());
+			argv[1] = argv[0];
+			++argv;
+			--argc;
+		}
+
 		if (argc == 1) // only executable
 		{
 			ShowShortHelp(filesystem::path(argv[0]).filename());
@@ -58,10 +81,12 @@ int wmain(int argc, TCHAR **argv) // main(int argc, char **argv)
 
 		if (_tcscmp(cmd, L"copy") == 0) // copy src dest
 			return CopyStream(arg2, arg3);
-		if (_tcscmp(cmd, L"type") == 0) // type src
-			return TypeStream(arg2);
-		if (_tcscmp(cmd, L"echo") == 0) // echo dest
-			return EchoStream(arg2);
+		if (_tcscmp(cmd, L"copyall") == 0) // copyall [options] src dest
+			return CopyAll(argc, argv);
+		if (_tcscmp(cmd, L"type") == 0) // type [options] src
+			return TypeStream(argc, argv);
+		if (_tcscmp(cmd, L"echo") == 0) // echo [options] dest
+			return EchoStream(argc, argv);
 		if (_tcscmp(cmd, L"del") == 0) // del src
 			return DeleteStream(arg2);
 		if (_tcscmp(cmd, L"dir") == 0 || _tcscmp(cmd, L"ls") == 0)
@@ -70,6 +95,20 @@ int wmain(int argc, TCHAR **argv) // main(int argc, char **argv)
 			return Tar(argc, argv);
 		if (_tcscmp(cmd, L"untar") == 0)
 			return Untar(argc, argv);
+		if (_tcscmp(cmd, L"bench") == 0)
+			return Bench(argc, argv);
+		if (_tcscmp(cmd, L"gentree") == 0)
+			return GenTree(argc, argv);
+		if (_tcscmp(cmd, L"inventory") == 0)
+			return Inventory(argc, argv);
+		if (_tcscmp(cmd, L"find") == 0)
+			return FindStreams(argc, argv);
+		if (_tcscmp(cmd, L"du") == 0)
+			return StreamUsage(argc, argv);
+		if (_tcscmp(cmd, L"grep") == 0)
+			return StreamGrep(argc, argv);
+		if (_tcscmp(cmd, L"bulk") == 0)
+			return StreamBulk(argc, argv);
 
 		return ShowListFiles(cmd, false);
 	}
@@ -108,41 +147,33 @@ void ShowStreamsOnFile(const filesystem::path& filename, bool show_all_files, co
 {
 	// Enumerate file's streams and print their sizes and names
 
-	WIN32_FIND_STREAM_DATA fsd;
-	HANDLE hFind = ::FindFirstStreamW(filename.c_str(), FindStreamInfoStandard, &fsd, 0);
-	for (bool ok = hFind != INVALID_HANDLE_VALUE; ok; ok = !!::FindNextStreamW(hFind, &fsd))
+	size_t base_len = filename.native().size();
+	for (auto& it : Fs().ListStreams(filename, L""))
 	{
-		if (wcscmp(fsd.cStreamName, L"::$DATA") == 0) // this is the main stream
-			continue;
-		wstring_view stream_name = RemoveAtEnd(fsd.cStreamName, L":$DATA"); // name without ":$DATA" in the end
+		wstring_view stream_name = wstring_view(it.name.native()).substr(base_len); // ":name"
 		int space = show_all_files ? 35 : 15;
-		wcout << setw(space) << FileSizeStr(fsd.StreamSize.QuadPart) << L" " << prefix;
+		wcout << setw(space) << FileSizeStr(it.size) << L" " << prefix;
 		//ConsoleColor cc(FOREGROUND_BLUE | FOREGROUND_INTENSITY);
 		ConsoleColor cc(FOREGROUND_GREEN | FOREGROUND_BLUE);
 		wcout << stream_name << endl;
 	}
-	if (hFind != INVALID_HANDLE_VALUE)
-		::FindClose(hFind);
 }
 
-void PrintInfo(const std::filesystem::directory_entry& item)
+void PrintInfo(const DirItem& item)
 {
-	// no info about item.last_write_time() found
-	// but considering it as the same value as FILETIME - works!
-	ULONGLONG ftime = item.last_write_time().time_since_epoch().count();
-	FILETIME* pft = (FILETIME*)&ftime;
+	FILETIME ft;
 	SYSTEMTIME st;
-	FileTimeToLocalFileTime(pft, pft);
-	FileTimeToSystemTime(pft, &st);
+	FileTimeToLocalFileTime(&item.ftLastWriteTime, &ft);
+	FileTimeToSystemTime(&ft, &st);
 	TCHAR stime[40];
 	swprintf_s(stime, L"%02u.%02u.%04u  %02u:%02u", st.wDay, st.wMonth, st.wYear, st.wHour, st.wMinute );
 
 	wcout << stime << L" " << setw(17);
-	if (item.is_regular_file())
+	if (item.type == DirItem::File)
 	{
-		wcout << FileSizeStr(item.file_size());
+		wcout << FileSizeStr(item.size);
 	}
-	else if (item.is_directory())
+	else if (item.type == DirItem::Dir)
 	{
 		wcout << L"<DIR>         ";
 	}
@@ -150,11 +181,11 @@ void PrintInfo(const std::filesystem::directory_entry& item)
 	{
 		wcout << L"?";
 	}
-	wcout << L" " << item.path().filename().c_str() << endl;
+	wcout << L" " << filename_of(item.name) << endl;
 
 }
 
-void ListFiles(const filesystem::path& dir, bool show_all_files)
+void ShowVolumeInfo(const filesystem::path& dir)
 {
 	TCHAR szVolName[MAX_PATH], szFSName[MAX_PATH];
 	DWORD dwSN, dwMaxLen, dwVolFlags;
@@ -173,15 +204,23 @@ void ListFiles(const filesystem::path& dir, bool show_all_files)
 			wcout << L"Named streams are not supported on " << root.c_str() << endl;
 		}
 	}
+}
+
+void ListFiles(const filesystem::path& dir, bool show_all_files)
+{
+	if (Fs().IsNative()) // in-memory backend has no volume
+		ShowVolumeInfo(dir);
 
 	wcout << L"Directory: " << dir.c_str() << endl << endl;
 
 	ShowStreamsOnFile(dir, show_all_files, L".\\");
-	for (auto& item : filesystem::directory_iterator(dir))
+	for (auto& item : Fs().ListDir(dir))
 	{
+		if (item.type == DirItem::Stream) // streams of the directory itself are shown above
+			continue;
 		if (show_all_files)
 			PrintInfo(item);
-		ShowStreamsOnFile(item.path(), show_all_files, item.path().filename().c_str());
+		ShowStreamsOnFile(item.name, show_all_files, filename_of(item.name));
 	}
 }
 
@@ -189,9 +228,11 @@ int ShowListFiles(const wchar_t* dir, bool all)
 {
 	filesystem::path cvt;
 	if (!dir)
-		cvt = filesystem::current_path();
-	else
+		cvt = Fs().CurrentDir();
+	else if (Fs().IsNative())
 		cvt = filesystem::canonical(dir);
+	else
+		cvt = dir;
 	ListFiles(cvt, all);
 	return 0;
 }
@@ -235,56 +276,6 @@ int CopyStream(const wchar_t* src, const wchar_t* dest)
 	return 0;
 }
 
-int TypeStream(const wchar_t* src)
-{
-	if (!src)
-		throw invalid_argument("Specify stream to type");
-
-	FileSimple fs_src(src);
-	if (!fs_src.IsOpen())
-		throw MyException{ L"Failed to open source '<path>': <err>", src, GetLastError() };
-
-	struct MyStream : public CharStream
-	{
-		MyStream(FileSimple &fs) : fs(fs) {}
-		FileSimple &fs;
-		virtual int Read(char* buf, int count) override { return fs.Read(buf, count); }
-	};
-
-	MyStream myStream{ fs_src };
-	for (auto str : GetStrings(&myStream))
-		wcout << str;
-	wcout << endl;
-	return 0;
-}
-
-int EchoStream(const wchar_t* dest)
-{
-	if (!dest)
-		throw invalid_argument("Specify stream to echo to");
-
-	FileSimple fs_dest(dest, true);
-	if (!fs_dest.IsOpen())
-		throw MyException{ L"Failed to create destination '<path>': <err>", dest, GetLastError() };
-
-	wcout << L"Type Ctrl-Z at the end of your text" << endl;
-	wstring str;
-	ULONGLONG total = 0;
-	while (getline(wcin, str))
-	{
-		str += L"\r\n";
-		string s = ToChar(str, CP_UTF8);
-		DWORD towrite = (DWORD)s.size();
-		DWORD written = fs_dest.Write(s.c_str(), towrite);
-		total += written;
-		if (written != towrite)
-			throw MyException{ L"Failed to write '<path>': <err>", dest, GetLastError() };
-	}
-
-	wcout << total << L" bytes written to " << dest << endl;
-	return 0;
-}
-
 int DeleteStream(const wchar_t* src)
 {
 	if (!src)
@@ -321,11 +312,21 @@ void ShowUsage(filesystem::path filename)
 	wcout << L"<dir>             - lists streams in the specified directory\n";
 	wcout << L"dir|ls <dir>      - lists all files and streams in the current or specified directory\n";
 	wcout << L"copy <src> <dest> - copies contents from src to dest\n";
-	wcout << L"type <src>        - writes specified stream to stdout\n";
-	wcout << L"echo <dest>       - copies stdin to the specified stream\n";
+	wcout << L"copyall /?        - more help about copy of files and trees with all streams and attributes\n";
+	wcout << L"type <src>        - writes specified stream to stdout, type /? - more help\n";
+	wcout << L"echo <dest>       - copies stdin to the specified stream, echo /? - more help\n";
 	wcout << L"del <src>         - deletes specified stream\n";
 	wcout << L"tar|untar /?      - more help about tar-function\n";
+	wcout << L"bench /?          - more help about benchmarks of internal functions and of tar/untar\n";
+	wcout << L"gentree /?        - more help about generating of test trees\n";
+	wcout << L"inventory /?      - more help about inventory of streams of a tree, kept in a file\n";
+	wcout << L"find /?           - more help about recursive search of streams by name, size and time\n";
+	wcout << L"du /?             - more help about space used by streams per directory subtree\n";
+	wcout << L"grep /?           - more help about search of texts in contents of streams of a tree\n";
+	wcout << L"bulk /?           - more help about del, copy and type of streams of a tree by masks\n";
 	wcout << L"del <src>         - deletes specified stream\n";
+	wcout << L"/img:<image> ...  - lists or tars files and streams of NTFS volume image instead of the disk,\n";
+	wcout << L"                    e.g. /img:disk.img dir \\Users, /img:disk.img tar backup.star Users\n";
 	wcout << L"/?                - shows this help\n\n";
 	wcout << L"where <src> and <dest> are file names or stream names, e.g. file.txt:stream1 or :s1:$DATA\n";
 	wcout << L"      <dir> is some directory name, including . or ..\n";
@@ -25,8 +25,6 @@ void ShowShortHelp(std::filesystem::path filename);
 void ShowUsage(std::filesystem::path filename);
 
 int CopyStream(const wchar_t* src, const wchar_t* dest);
-int TypeStream(const wchar_t* src);
-int EchoStream(const wchar_t* dest);
 int DeleteStream(const wchar_t* src);
 int ShowListFiles(const wchar_t* dir, bool all);
 
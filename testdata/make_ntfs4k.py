@@ -0,0 +1,114 @@
+# Builds ntfs4k.img: a tiny NTFS volume with 4096-byte sectors and clusters and
+# 1024-byte MFT records (update sequence every 512 bytes), used by "bench /ntfs:".
+# Only the structures read by NtfsImage are filled: the boot sector and $MFT.
+#
+#   \:rs                  root stream "rootstream"
+#   Docs\a.txt            "hello", DOS name A.TXT, stream Zone.Identifier "[ZoneTransfer]"
+#   big.bin               24476 bytes: clusters 0-2 data, 3-4 sparse, 5 data, byte i is i*7 % 251
+#   big.bin:s             50 bytes 'S', non-resident
+#   orphan.txt            parent is not in use, not listed
+#   deleted.txt           record not in use, not listed
+import struct
+
+SECTOR = 4096
+CLUSTER = 4096
+RECORD = 1024
+STRIDE = 512         # of the update sequence, whatever the sector size
+RECORDS = 32
+MFT_LCN = 1
+
+img = bytearray(CLUSTER * 16)
+
+boot = bytearray(512)
+boot[3:11] = b"NTFS    "
+struct.pack_into('<HB', boot, 0x0B, SECTOR, CLUSTER // SECTOR)
+struct.pack_into('<Q', boot, 0x30, MFT_LCN)
+boot[0x40] = 256 - 10  # record is 2^10 bytes
+img[0:512] = boot
+
+def runs(lst):
+    out = bytearray()
+    prev = 0
+    for lcn, n in lst:
+        if lcn is None:
+            out += bytes([0x01, n])
+            continue
+        out += bytes([0x41, n]) + (lcn - prev).to_bytes(4, 'little', signed=True)
+        prev = lcn
+    return out + b'\0'
+
+def resident(type, value, name=''):
+    nm = name.encode('utf-16le')
+    value_offset = (0x18 + len(nm) + 7) & ~7
+    length = (value_offset + len(value) + 7) & ~7
+    a = bytearray(length)
+    struct.pack_into('<IIBBHHH', a, 0, type, length, 0, len(name), 0x18, 0, 0)
+    struct.pack_into('<IH', a, 0x10, len(value), value_offset)
+    a[0x18:0x18 + len(nm)] = nm
+    a[value_offset:value_offset + len(value)] = value
+    return a
+
+def nonresident(type, rl, size, name=''):
+    nm = name.encode('utf-16le')
+    runs_offset = (0x40 + len(nm) + 7) & ~7
+    length = (runs_offset + len(rl) + 7) & ~7
+    a = bytearray(length)
+    struct.pack_into('<IIBBHHH', a, 0, type, length, 1, len(name), 0x40, 0, 0)
+    struct.pack_into('<QQHH', a, 0x10, 0, 0, runs_offset, 0)
+    struct.pack_into('<QQQ', a, 0x28, size, size, size)
+    a[0x40:0x40 + len(nm)] = nm
+    a[runs_offset:runs_offset + len(rl)] = rl
+    return a
+
+def file_name(parent, name, name_space=1):
+    v = bytearray(0x42) + name.encode('utf-16le')
+    struct.pack_into('<Q', v, 0, parent)
+    v[0x40] = len(name)
+    v[0x41] = name_space
+    return resident(0x30, v)
+
+def standard_info(attribs=0x20, time=132223104000000000):
+    v = bytearray(0x48)
+    struct.pack_into('<QQ', v, 0, time, time)
+    struct.pack_into('<I', v, 0x20, attribs)
+    return resident(0x10, v)
+
+def record(number, flags, attrs, seq=1):
+    r = bytearray(RECORD)
+    usa_count = RECORD // STRIDE + 1
+    r[0:4] = b'FILE'
+    struct.pack_into('<HH', r, 4, 0x30, usa_count)
+    struct.pack_into('<H', r, 0x10, seq)
+    struct.pack_into('<HH', r, 0x14, 0x38, flags)
+    pos = 0x38
+    for a in attrs:
+        r[pos:pos + len(a)] = a
+        pos += len(a)
+    struct.pack_into('<I', r, pos, 0xFFFFFFFF)
+    usn = b'\x07\x00'
+    r[0x30:0x32] = usn
+    for i in range(1, usa_count):
+        tail = i * STRIDE - 2
+        r[0x30 + 2 * i:0x32 + 2 * i] = r[tail:tail + 2]
+        r[tail:tail + 2] = usn
+    offset = MFT_LCN * CLUSTER + number * RECORD
+    img[offset:offset + RECORD] = r
+
+ROOT = 5 | (5 << 48)
+record(0, 1, [standard_info(), file_name(ROOT, '$MFT'),
+              nonresident(0x80, runs([(MFT_LCN, RECORDS * RECORD // CLUSTER)]), RECORDS * RECORD)])
+record(5, 3, [standard_info(0x16), file_name(ROOT, '.'), resident(0x80, b'rootstream', 'rs')], seq=5)
+record(24, 3, [standard_info(0x10), file_name(ROOT, 'Docs')], seq=2)
+record(25, 1, [standard_info(), file_name(24 | (2 << 48), 'A.TXT', 2), file_name(24 | (2 << 48), 'a.txt'),
+               resident(0x80, b'hello'), resident(0x80, b'[ZoneTransfer]', 'Zone.Identifier')])
+data = bytes((i * 7) % 251 for i in range(6 * CLUSTER))
+img[10 * CLUSTER:13 * CLUSTER] = data[0:3 * CLUSTER]
+img[13 * CLUSTER:14 * CLUSTER] = data[5 * CLUSTER:6 * CLUSTER]
+img[14 * CLUSTER:14 * CLUSTER + 50] = b'S' * 50
+record(26, 1, [standard_info(), file_name(ROOT, 'big.bin'),
+               nonresident(0x80, runs([(10, 3), (None, 2), (13, 1)]), 6 * CLUSTER - 100),
+               nonresident(0x80, runs([(14, 1)]), 50, 's')])
+record(27, 1, [standard_info(), file_name(99 | (1 << 48), 'orphan.txt'), resident(0x80, b'x')])
+record(28, 0, [standard_info(), file_name(ROOT, 'deleted.txt'), resident(0x80, b'x')])
+
+open('ntfs4k.img', 'wb').write(img)